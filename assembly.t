@@ -0,0 +1,381 @@
+-- SPDX-FileCopyrightText: 2024 René Hiemstra <rrhiemstar@gmail.com>
+-- SPDX-FileCopyrightText: 2024 Torsten Keßler <t.kessler@posteo.de>
+-- SPDX-FileCopyrightText: 2025 René Hiemstra <rrhiemstar@gmail.com>
+-- SPDX-FileCopyrightText: 2025 Torsten Keßler <t.kessler@posteo.de>
+--
+-- SPDX-License-Identifier: MIT
+
+import "terraform"
+
+local alloc = require("alloc")
+local atomics = require("atomics")
+local base = require("base")
+local err = require("assert")
+local concepts = require("concepts")
+local lambda = require("lambda")
+local sparse = require("sparse")
+local stack = require("stack")
+local thread = require("thread")
+local parametrized = require("parametrized")
+
+local C = terralib.includec("stdlib.h")
+
+local Alloc = alloc.Allocator
+local Pool = alloc.SmartObject(thread.threadpool)
+
+--[=[
+    Parallel assembly of element contributions into a CSRMatrix, as in
+    finite element methods. Element e couples the ndof degrees of freedom
+    dofs[e * ndof], ..., dofs[e * ndof + ndof - 1] and contributes a dense
+    ndof x ndof element matrix.
+
+    The sparsity pattern of the matrix and the position of every entry of
+    every element matrix in the values of the matrix are computed once in
+    new. Repeated assemblies only compute the element matrices and add
+    them to the values.
+
+    Two elements that share a degree of freedom write to the same row.
+    assemble processes the elements color by color, where a greedy coloring
+    guarantees that elements of the same color do not share degrees of
+    freedom. atomicassemble processes all elements at once and adds the
+    contributions with atomic operations. It is only available for floating
+    point types.
+--]=]
+local ASSEMBLY_CHUNK = 64
+
+local Assembly = parametrized.type(function(T, I)
+    I = I or int32
+    local CSR = sparse.CSRMatrix(T, I)
+    local ST = stack.DynamicStack(T)
+    local SI = stack.DynamicStack(I)
+    local SmartI = alloc.SmartBlock(I)
+    local SmartT = alloc.SmartBlock(T)
+
+    local struct assembly {
+        nelem: I
+        ndof: I
+        -- Entry (k, l) of the matrix of element e is stored at position
+        -- pos(ndof * ndof * e + ndof * k + l) of the values.
+        pos: SmartI
+        -- Elements of color c are elem(colptr(c)), ..., elem(colptr(c + 1) - 1)
+        ncolors: I
+        colptr: SmartI
+        elem: SmartI
+        pool: Pool
+    }
+    function assembly.metamethods.__typename(self)
+        return ("Assembly(%s, %s)"):format(tostring(T), tostring(I))
+    end
+    base.AbstractBase(assembly)
+
+    local terra cmp(a: &opaque, b: &opaque): int
+        var i = @[&I](a)
+        var j = @[&I](b)
+        return terralib.select(i < j, -1, terralib.select(i > j, 1, 0))
+    end
+
+    -- Elements that contain degree of freedom d are
+    -- elem(ptr(d)), ..., elem(ptr(d + 1) - 1).
+    local terra incidence(
+        A: Alloc, n: I, nelem: I, ndof: I, dofs: &I, ptr: &SmartI, elem: &SmartI
+    )
+        @ptr = A:new(sizeof(I), n + 1)
+        for d = 0, n + 1 do
+            (@ptr)(d) = 0
+        end
+        for k = 0, nelem * ndof do
+            err.assert(dofs[k] < n)
+            (@ptr)(dofs[k] + 1) = (@ptr)(dofs[k] + 1) + 1
+        end
+        for d = 0, n do
+            (@ptr)(d + 1) = (@ptr)(d + 1) + (@ptr)(d)
+        end
+        var len = nelem * ndof
+        @elem = A:new(sizeof(I), terralib.select(len > 0, len, 1))
+        var slot: SmartI = A:new(sizeof(I), n + 1)
+        for d = 0, n do
+            slot(d) = (@ptr)(d)
+        end
+        for e = 0, nelem do
+            for k = 0, ndof do
+                var d = dofs[e * ndof + k]
+                (@elem)(slot(d)) = e
+                slot(d) = slot(d) + 1
+            end
+        end
+    end
+
+    -- Sparsity pattern of the assembled matrix with sorted column indices.
+    -- Row i couples to all degrees of freedom of the elements that contain i.
+    local terra pattern(
+        A: Alloc, a: &CSR, ndof: I, dofs: &I, ptr: &SmartI, elem: &SmartI
+    )
+        var n = a.rows
+        var marker: SmartI = A:new(sizeof(I), terralib.select(n > 0, n, 1))
+        for j = 0, n do
+            marker(j) = n
+        end
+        a.rowptr = SI.new(A, n + 1)
+        a.rowptr:push(0)
+        for i = 0, n do
+            var len: I = 0
+            for k = (@ptr)(i), (@ptr)(i + 1) do
+                var e = (@elem)(k)
+                for l = 0, ndof do
+                    var j = dofs[e * ndof + l]
+                    if marker(j) ~= i then
+                        marker(j) = i
+                        len = len + 1
+                    end
+                end
+            end
+            a.rowptr:push(a.rowptr(i) + len)
+        end
+        var nnz = a.rowptr(n)
+        var cap = terralib.select(nnz > 0, nnz, 1)
+        a.data = ST.new(A, cap)
+        a.col = SI.new(A, cap)
+        for idx = 0, nnz do
+            a.data:push(0)
+            a.col:push(0)
+        end
+        for j = 0, n do
+            marker(j) = n
+        end
+        for i = 0, n do
+            var idx = a.rowptr(i)
+            for k = (@ptr)(i), (@ptr)(i + 1) do
+                var e = (@elem)(k)
+                for l = 0, ndof do
+                    var j = dofs[e * ndof + l]
+                    if marker(j) ~= i then
+                        marker(j) = i
+                        a.col(idx) = j
+                        idx = idx + 1
+                    end
+                end
+            end
+            var first = a.rowptr(i)
+            C.qsort(&a.col(first), a.rowptr(i + 1) - first, sizeof(I), cmp)
+        end
+    end
+
+    -- Position of column j in row i of a
+    local terra find(a: &CSR, i: I, j: I)
+        var lo = a.rowptr(i)
+        var hi = a.rowptr(i + 1)
+        while lo < hi do
+            var mid = lo + (hi - lo) / 2
+            if a.col(mid) < j then
+                lo = mid + 1
+            else
+                hi = mid
+            end
+        end
+        err.assert(lo < a.rowptr(i + 1) and a.col(lo) == j)
+        return lo
+    end
+
+    -- Greedy coloring of the elements. Each element gets the smallest color
+    -- that is not used by an element with a common degree of freedom.
+    local terra coloring(
+        A: Alloc, self: &assembly, dofs: &I, ptr: &SmartI, elem: &SmartI
+    )
+        var nelem = self.nelem
+        var ndof = self.ndof
+        var len = terralib.select(nelem > 0, nelem, 1)
+        var color: SmartI = A:new(sizeof(I), len)
+        -- Colors used by neighbors of element e are marked with e + 1
+        var used: SmartI = A:new(sizeof(I), len + 1)
+        for e = 0, nelem do
+            used(e) = 0
+        end
+        self.ncolors = 0
+        for e = 0, nelem do
+            for k = 0, ndof do
+                var d = dofs[e * ndof + k]
+                for m = (@ptr)(d), (@ptr)(d + 1) do
+                    var f = (@elem)(m)
+                    if f < e then
+                        used(color(f)) = e + 1
+                    end
+                end
+            end
+            var c: I = 0
+            while used(c) == e + 1 do
+                c = c + 1
+            end
+            color(e) = c
+            self.ncolors = terralib.select(c + 1 > self.ncolors, c + 1, self.ncolors)
+        end
+        self.colptr = A:new(sizeof(I), self.ncolors + 1)
+        for c = 0, self.ncolors + 1 do
+            self.colptr(c) = 0
+        end
+        for e = 0, nelem do
+            self.colptr(color(e) + 1) = self.colptr(color(e) + 1) + 1
+        end
+        for c = 0, self.ncolors do
+            self.colptr(c + 1) = self.colptr(c + 1) + self.colptr(c)
+        end
+        self.elem = A:new(sizeof(I), len)
+        var slot: SmartI = A:new(sizeof(I), self.ncolors + 1)
+        for c = 0, self.ncolors do
+            slot(c) = self.colptr(c)
+        end
+        for e = 0, nelem do
+            self.elem(slot(color(e))) = e
+            slot(color(e)) = slot(color(e)) + 1
+        end
+    end
+
+    -- Replace the content of a by the sparsity pattern of the elements. The
+    -- values of a are set to zero.
+    assembly.staticmethods.new = terra(
+        A: Alloc, a: &CSR, nelem: I, ndof: I, dofs: &I
+    )
+        err.assert(a.rows == a.cols)
+        var self: assembly
+        self.nelem = nelem
+        self.ndof = ndof
+        var ptr: SmartI
+        var elem: SmartI
+        incidence(A, a.rows, nelem, ndof, dofs, &ptr, &elem)
+        pattern(A, a, ndof, dofs, &ptr, &elem)
+        var len = nelem * ndof * ndof
+        self.pos = A:new(sizeof(I), terralib.select(len > 0, len, 1))
+        for e = 0, nelem do
+            var d = dofs + e * ndof
+            for k = 0, ndof do
+                for l = 0, ndof do
+                    self.pos(ndof * ndof * e + ndof * k + l) = find(a, d[k], d[l])
+                end
+            end
+        end
+        coloring(A, &self, dofs, &ptr, &elem)
+        self.pool = thread.threadpool.new(A, thread.omp_get_num_threads())
+        return self
+    end
+
+    -- The element matrices of elements elem[first], ..., elem[last - 1] are
+    -- computed by kernel(e, m), which writes the ndof x ndof element matrix
+    -- of element e in row major order to m. kernel is called concurrently
+    -- from several threads.
+    local terraform chunk(
+        first: I, self: &assembly, elem: &I, last: I, data: &T, kernel: F
+    ) where {F}
+        var allocator: alloc.DefaultAllocator()
+        var ndof = self.ndof
+        var m: SmartT = allocator:new(sizeof(T), ndof * ndof)
+        var stop = terralib.select(first + ASSEMBLY_CHUNK < last, first + ASSEMBLY_CHUNK, last)
+        for k = first, stop do
+            var e = elem[k]
+            kernel(e, &m(0))
+            var pos = &self.pos(ndof * ndof * e)
+            for l = 0, ndof * ndof do
+                data[pos[l]] = data[pos[l]] + m(l)
+            end
+        end
+    end
+
+    local terraform atomicchunk(
+        first: I, self: &assembly, last: I, data: &T, kernel: F
+    ) where {F}
+        var allocator: alloc.DefaultAllocator()
+        var ndof = self.ndof
+        var m: SmartT = allocator:new(sizeof(T), ndof * ndof)
+        var stop = terralib.select(first + ASSEMBLY_CHUNK < last, first + ASSEMBLY_CHUNK, last)
+        for e = first, stop do
+            kernel(e, &m(0))
+            var pos = &self.pos(ndof * ndof * e)
+            for l = 0, ndof * ndof do
+                atomics.add(&data[pos[l]], m(l))
+            end
+        end
+    end
+
+    local terra zero(a: &CSR)
+        for idx = 0, a:nnz() do
+            a.data(idx) = 0
+        end
+    end
+
+    terraform assembly:assemble(a: &CSR, kernel: F) where {F}
+        zero(a)
+        var data = &a.data(0)
+        var allocator: alloc.DefaultAllocator()
+        for c = 0, self.ncolors do
+            var first = self.colptr(c)
+            var last = self.colptr(c + 1)
+            for k = first, last, ASSEMBLY_CHUNK do
+                self.pool:submit(
+                    &allocator,
+                    lambda.new(
+                        [
+                            terra(
+                                k: I,
+                                self: &assembly,
+                                elem: &I,
+                                last: I,
+                                data: &T,
+                                kernel: kernel.type
+                            )
+                                chunk(k, self, elem, last, data, kernel)
+                            end
+                        ],
+                        {
+                            self = self,
+                            elem = &self.elem(0),
+                            last = last,
+                            data = data,
+                            kernel = kernel,
+                        }
+                    ),
+                    k
+                )
+            end
+            -- Elements of the next color may write to the same rows
+            self.pool:barrier()
+        end
+    end
+
+    if concepts.Float(T) then
+        terraform assembly:atomicassemble(a: &CSR, kernel: F) where {F}
+            zero(a)
+            var data = &a.data(0)
+            var allocator: alloc.DefaultAllocator()
+            for k = 0, self.nelem, ASSEMBLY_CHUNK do
+                self.pool:submit(
+                    &allocator,
+                    lambda.new(
+                        [
+                            terra(
+                                k: I,
+                                self: &assembly,
+                                last: I,
+                                data: &T,
+                                kernel: kernel.type
+                            )
+                                atomicchunk(k, self, last, data, kernel)
+                            end
+                        ],
+                        {
+                            self = self,
+                            last = self.nelem,
+                            data = data,
+                            kernel = kernel,
+                        }
+                    ),
+                    k
+                )
+            end
+            self.pool:barrier()
+        end
+    end
+
+    return assembly
+end)
+
+return {
+    Assembly = Assembly,
+}
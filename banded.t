@@ -0,0 +1,285 @@
+-- SPDX-FileCopyrightText: 2024 René Hiemstra <rrhiemstar@gmail.com>
+-- SPDX-FileCopyrightText: 2024 Torsten Keßler <t.kessler@posteo.de>
+-- SPDX-FileCopyrightText: 2025 René Hiemstra <rrhiemstar@gmail.com>
+-- SPDX-FileCopyrightText: 2025 Torsten Keßler <t.kessler@posteo.de>
+--
+-- SPDX-License-Identifier: MIT
+
+import "terraform"
+
+local alloc = require("alloc")
+local base = require("base")
+local err = require("assert")
+local concepts = require("concepts")
+local tmath = require("tmath")
+local lapack = require("lapack")
+local parametrized = require("parametrized")
+
+local Alloc = alloc.Allocator
+
+--[=[
+    Square matrix with kl subdiagonals and ku superdiagonals. The entries
+    are stored column by column in the LAPACK band format: entry (i, j)
+    is stored at position kl + ku + i - j of column j. The first kl rows of
+    each column are reserved for the fill-in of the LU factorization.
+--]=]
+local BandedMatrix = parametrized.type(function(T)
+    local SmartT = alloc.SmartBlock(T)
+    local Matrix = concepts.Matrix(T)
+
+    local struct band {
+        n: int64
+        kl: int64
+        ku: int64
+        -- Leading dimension of the band storage, 2 kl + ku + 1
+        ldab: int64
+        data: SmartT
+    }
+    band.metamethods.__typename = function(self)
+        return ("BandedMatrix(%s)"):format(tostring(T))
+    end
+    base.AbstractBase(band)
+    band.traits.eltype = T
+
+    terra band:rows()
+        return self.n
+    end
+
+    terra band:cols()
+        return self.n
+    end
+
+    terra band:inband(i: int64, j: int64)
+        return j - self.ku <= i and i <= j + self.kl
+    end
+
+    -- Storage position of entry (i, j), including the fill-in rows
+    terra band:index(i: int64, j: int64)
+        return j * self.ldab + self.kl + self.ku + i - j
+    end
+
+    terra band:get(i: int64, j: int64)
+        err.assert(i < self.n and j < self.n)
+        if self:inband(i, j) then
+            return self.data(self:index(i, j))
+        else
+            return [T](0)
+        end
+    end
+
+    terra band:set(i: int64, j: int64, x: T)
+        err.assert(i < self.n and j < self.n and self:inband(i, j))
+        self.data(self:index(i, j)) = x
+    end
+
+    assert(Matrix(band))
+
+    band.staticmethods.new = terra(A: Alloc, n: int64, kl: int64, ku: int64)
+        err.assert(n > 0 and kl >= 0 and ku >= 0)
+        var b: band
+        b.n = n
+        b.kl = kl
+        b.ku = ku
+        b.ldab = 2 * kl + ku + 1
+        b.data = A:new(sizeof(T), b.ldab * n)
+        for k = 0, b.ldab * n do
+            b.data(k) = 0
+        end
+        return b
+    end
+
+    return band
+end)
+
+--[=[
+    LU factorization with partial pivoting of a BandedMatrix in place. The
+    upper factor has kl + ku superdiagonals because of the row interchanges.
+    The cost is O(n kl (kl + ku)) instead of O(n^3) for a dense
+    factorization. BLAS types use LAPACK gbtrf and, for contiguous vectors,
+    gbtrs.
+--]=]
+local BandedLUFactory = parametrized.type(function(T)
+    local Band = BandedMatrix(T)
+    local SmartI = alloc.SmartBlock(int32)
+    local Vector = concepts.Vector(T)
+    local Factorization = concepts.Factorization(T)
+    local Bool = concepts.Bool
+    local conj = tmath.conj
+
+    local struct lu {
+        a: &Band
+        -- Row i was interchanged with row piv(i)
+        piv: SmartI
+    }
+    function lu.metamethods.__typename(self)
+        return ("BandedLUFactorization(%s)"):format(tostring(T))
+    end
+    base.AbstractBase(lu)
+
+    terra lu:rows()
+        return self.a.n
+    end
+
+    terra lu:cols()
+        return self.a.n
+    end
+
+    -- LAPACK stores one-based pivot indices
+    local PIVBASE = concepts.BLASNumber(T) and 1 or 0
+
+    if concepts.BLASNumber(T) then
+        terra lu:factorize()
+            var a = self.a
+            var info = lapack.gbtrf(
+                lapack.COL_MAJOR, a.n, a.n, a.kl, a.ku,
+                &a.data(0), a.ldab, &self.piv(0)
+            )
+            err.assert(info == 0)
+        end
+    else
+        terra lu:factorize()
+            var a = self.a
+            var n = a.n
+            var kl = a.kl
+            var data = &a.data(0)
+            -- Last column of U that is changed by the row interchanges
+            var ju: int64 = 0
+            for j = 0, n do
+                var km = terralib.select(kl < n - 1 - j, kl, n - 1 - j)
+                var p: int64 = 0
+                var maxa = tmath.abs(data[a:index(j, j)])
+                for r = 1, km + 1 do
+                    var absa = tmath.abs(data[a:index(j + r, j)])
+                    if absa > maxa then
+                        maxa = absa
+                        p = r
+                    end
+                end
+                err.assert(maxa > 0)
+                self.piv(j) = j + p
+                var last = terralib.select(j + a.ku + p < n - 1, j + a.ku + p, n - 1)
+                ju = terralib.select(last > ju, last, ju)
+                if p ~= 0 then
+                    for c = j, ju + 1 do
+                        var tmp = data[a:index(j, c)]
+                        data[a:index(j, c)] = data[a:index(j + p, c)]
+                        data[a:index(j + p, c)] = tmp
+                    end
+                end
+                var ajj = data[a:index(j, j)]
+                for i = j + 1, j + km + 1 do
+                    data[a:index(i, j)] = data[a:index(i, j)] / ajj
+                end
+                for c = j + 1, ju + 1 do
+                    var ajc = data[a:index(j, c)]
+                    for i = j + 1, j + km + 1 do
+                        data[a:index(i, c)] = data[a:index(i, c)] - data[a:index(i, j)] * ajc
+                    end
+                end
+            end
+        end
+    end
+
+    terraform lu:solve(trans: B, x: &V) where {B: Bool, V: Vector}
+        var a = self.a
+        var n = a.n
+        var kl = a.kl
+        var kv = a.kl + a.ku
+        var data = &a.data(0)
+        err.assert(x:length() == n)
+        if not trans then
+            -- L y = P b
+            for j = 0, n do
+                var lm = terralib.select(kl < n - 1 - j, kl, n - 1 - j)
+                var p: int64 = self.piv(j) - PIVBASE
+                if p ~= j then
+                    var tmp = x:get(j)
+                    x:set(j, x:get(p))
+                    x:set(p, tmp)
+                end
+                var xj = x:get(j)
+                for i = j + 1, j + lm + 1 do
+                    x:set(i, x:get(i) - data[a:index(i, j)] * xj)
+                end
+            end
+            -- U x = y
+            for jj = 0, n do
+                var j = n - 1 - jj
+                var xj = x:get(j) / data[a:index(j, j)]
+                x:set(j, xj)
+                var first = terralib.select(j - kv > 0, j - kv, [int64](0))
+                for i = first, j do
+                    x:set(i, x:get(i) - data[a:index(i, j)] * xj)
+                end
+            end
+        else
+            -- U^H y = b
+            for j = 0, n do
+                var first = terralib.select(j - kv > 0, j - kv, [int64](0))
+                var xj = x:get(j)
+                for i = first, j do
+                    xj = xj - conj(data[a:index(i, j)]) * x:get(i)
+                end
+                x:set(j, xj / conj(data[a:index(j, j)]))
+            end
+            -- L^H P x = y
+            for jj = 0, n do
+                var j = n - 1 - jj
+                var lm = terralib.select(kl < n - 1 - j, kl, n - 1 - j)
+                var xj = x:get(j)
+                for i = j + 1, j + lm + 1 do
+                    xj = xj - conj(data[a:index(i, j)]) * x:get(i)
+                end
+                x:set(j, xj)
+                var p: int64 = self.piv(j) - PIVBASE
+                if p ~= j then
+                    var tmp = x:get(j)
+                    x:set(j, x:get(p))
+                    x:set(p, tmp)
+                end
+            end
+        end
+    end
+
+    if concepts.BLASNumber(T) then
+        local ContiguousVector = concepts.ContiguousVector(T)
+        terraform lu:solve(trans: B, x: &V) where {B: Bool, V: ContiguousVector}
+            var a = self.a
+            var nx, xdata = x:getbuffer()
+            err.assert(nx == a.n)
+            var lapack_trans: rawstring
+            if trans then
+                lapack_trans = [concepts.Complex(T) and "C" or "T"]
+            else
+                lapack_trans = "N"
+            end
+            lapack.gbtrs(
+                lapack.COL_MAJOR, @lapack_trans, a.n, a.kl, a.ku, 1,
+                &a.data(0), a.ldab, &self.piv(0), xdata, a.n
+            )
+        end
+    end
+
+    terraform lu:apply(trans: B, a: T, x: &V1, b: T, y: &V2)
+        where {B: Bool, V1: Vector, V2: Vector}
+        self:solve(trans, x)
+        y:scal(b)
+        y:axpy(a, x)
+    end
+
+    assert(Factorization(lu))
+
+    lu.staticmethods.new = terra(A: Alloc, a: &Band)
+        var f: lu
+        f.a = a
+        f.piv = A:new(sizeof(int32), a.n)
+        return f
+    end
+
+    return lu
+end)
+
+return {
+    BandedMatrix = BandedMatrix,
+    BandedLUFactory = BandedLUFactory,
+}
@@ -0,0 +1,539 @@
+-- SPDX-FileCopyrightText: 2024 René Hiemstra <rrhiemstar@gmail.com>
+-- SPDX-FileCopyrightText: 2024 Torsten Keßler <t.kessler@posteo.de>
+-- SPDX-FileCopyrightText: 2025 René Hiemstra <rrhiemstar@gmail.com>
+-- SPDX-FileCopyrightText: 2025 Torsten Keßler <t.kessler@posteo.de>
+--
+-- SPDX-License-Identifier: MIT
+
+import "terraform"
+
+local alloc = require("alloc")
+local base = require("base")
+local err = require("assert")
+local lambda = require("lambda")
+local simd = require("simd")
+local thread = require("thread")
+local tmath = require("tmath")
+local parametrized = require("parametrized")
+
+local Alloc = alloc.Allocator
+
+-- Width of the SIMD registers in bytes. The batch is split into chunks of
+-- SIMD_BYTES / sizeof(T) matrices that are processed in one register.
+local SIMD_BYTES = 32
+-- Largest supported matrix size
+local BATCH_MAXSIZE = 64
+
+local function lanes(T)
+    return math.floor(SIMD_BYTES / terralib.sizeof(T))
+end
+
+--[=[
+    Batch of count small matrices of equal size. Entry (i, j) of all matrices
+    of a chunk of W = lanes(T) consecutive matrices is stored contiguously,
+    so that the factorizations below process W matrices with one SIMD
+    instruction. The batch is padded with identity matrices to a multiple
+    of W. Vectors are stored as batches with one column.
+--]=]
+local BatchedMatrix = parametrized.type(function(T)
+    assert(T == float or T == double,
+           "Batched matrices are only implemented for float and double")
+    local W = lanes(T)
+    local SmartT = alloc.SmartBlock(T)
+
+    local struct batch {
+        count: int64
+        nchunks: int64
+        rows: int64
+        cols: int64
+        data: SmartT
+    }
+    batch.metamethods.__typename = function(self)
+        return ("BatchedMatrix(%s)"):format(tostring(T))
+    end
+    base.AbstractBase(batch)
+    batch.traits.eltype = T
+    batch.traits.lanes = W
+
+    -- Pointer to the W lanes of entry (i, j) of chunk c
+    terra batch:lane(c: int64, i: int64, j: int64)
+        return &self.data(((c * self.rows + i) * self.cols + j) * W)
+    end
+    batch.methods.lane:setinlined(true)
+
+    terra batch:get(b: int64, i: int64, j: int64)
+        err.assert(b < self.count and i < self.rows and j < self.cols)
+        return self:lane(b / W, i, j)[b % W]
+    end
+
+    terra batch:set(b: int64, i: int64, j: int64, x: T)
+        err.assert(b < self.count and i < self.rows and j < self.cols)
+        self:lane(b / W, i, j)[b % W] = x
+    end
+
+    batch.staticmethods.new = terra(A: Alloc, count: int64, rows: int64, cols: int64)
+        err.assert(count > 0 and rows > 0 and cols > 0)
+        var b: batch
+        b.count = count
+        b.nchunks = (count + W - 1) / W
+        b.rows = rows
+        b.cols = cols
+        b.data = A:new(sizeof(T), b.nchunks * W * rows * cols)
+        for k = 0, b.nchunks * W * rows * cols do
+            b.data(k) = 0
+        end
+        for l = count, b.nchunks * W do
+            for i = 0, terralib.select(rows < cols, rows, cols) do
+                b:lane(l / W, i, i)[l % W] = 1
+            end
+        end
+        return b
+    end
+
+    return batch
+end)
+
+-- Batches with fewer chunks run serially. Handing them to the pool costs
+-- more than the factorizations themselves.
+local BATCH_PARALLEL = 16
+
+local Pool = alloc.SmartObject(thread.threadpool)
+
+-- Contiguous range [c0, c1) of the nchunks chunks handled by task t of ntasks
+local terra chunkrange(t: int64, ntasks: int64, nchunks: int64)
+    return (t * nchunks) / ntasks, ((t + 1) * nchunks) / ntasks
+end
+chunkrange:setinlined(true)
+
+-- Number of tasks for a batch of nchunks chunks: one per thread, but
+-- never more than there are chunks, and one for small batches.
+local terra numtasks(nchunks: int64)
+    var nthreads: int64 = thread.omp_get_num_threads()
+    if nchunks < BATCH_PARALLEL or nthreads < 2 then
+        return 1
+    end
+    return terralib.select(nthreads < nchunks, nthreads, nchunks)
+end
+
+-- Run go(t, ntasks) for all tasks t of the factorization self, on its pool
+-- if it has more than one task.
+local parchunks = macro(function(self, go)
+    return quote
+        if self.ntasks == 1 then
+            go(0, 1)
+        else
+            var allocator: alloc.DefaultAllocator()
+            for t = 0, self.ntasks do
+                self.pool:submit(&allocator, go, t, self.ntasks)
+            end
+            self.pool:barrier()
+        end
+    end
+end)
+
+-- Set up the tasks and, for large batches, the thread pool of a
+-- factorization. The pool lives as long as the factorization.
+local initpool = macro(function(A, f, a)
+    return quote
+        f.ntasks = numtasks(a.nchunks)
+        if f.ntasks > 1 then
+            f.pool = thread.threadpool.new(A, f.ntasks)
+        end
+    end
+end)
+
+--[=[
+    LU factorizations with partial pivoting of all matrices of a batch. The
+    pivot search and the row interchanges are done lane by lane, the
+    elimination with SIMD instructions across the matrices of a chunk.
+--]=]
+local BatchedLU = parametrized.type(function(T)
+    local Batch = BatchedMatrix(T)
+    local W = Batch.traits.lanes
+    local V = simd.VectorFactory(T, W)
+    local SmartI = alloc.SmartBlock(int32)
+
+    local struct lu {
+        a: &Batch
+        -- Row k of matrix b was interchanged with row piv(b, k)
+        piv: SmartI
+        ntasks: int64
+        pool: Pool
+    }
+    function lu.metamethods.__typename(self)
+        return ("BatchedLU(%s)"):format(tostring(T))
+    end
+    base.AbstractBase(lu)
+
+    local factorchunk = terra(c: int64, self: &lu)
+        var a = self.a
+        var n = a.rows
+        for k = 0, n do
+            for l = 0, W do
+                var imax = k
+                var maxa = tmath.abs(a:lane(c, k, k)[l])
+                for i = k + 1, n do
+                    var absa = tmath.abs(a:lane(c, i, k)[l])
+                    if absa > maxa then
+                        maxa = absa
+                        imax = i
+                    end
+                end
+                err.assert(maxa > 0)
+                self.piv((c * n + k) * W + l) = imax
+                if imax ~= k then
+                    for j = 0, n do
+                        var tmp = a:lane(c, k, j)[l]
+                        a:lane(c, k, j)[l] = a:lane(c, imax, j)[l]
+                        a:lane(c, imax, j)[l] = tmp
+                    end
+                end
+            end
+            var akk: V = a:lane(c, k, k)
+            for i = k + 1, n do
+                var lik = [V](a:lane(c, i, k)) / akk
+                lik:store(a:lane(c, i, k))
+                for j = k + 1, n do
+                    var aij = [V](a:lane(c, i, j)) - lik * [V](a:lane(c, k, j))
+                    aij:store(a:lane(c, i, j))
+                end
+            end
+        end
+    end
+
+    local factorchunks = terra(t: int64, ntasks: int64, self: &lu)
+        var c0, c1 = chunkrange(t, ntasks, self.a.nchunks)
+        for c = c0, c1 do
+            factorchunk(c, self)
+        end
+    end
+
+    terra lu:factorize()
+        parchunks(self, lambda.new(factorchunks, {self = self}))
+    end
+
+    local solvechunk = terra(c: int64, self: &lu, x: &Batch)
+        var a = self.a
+        var n = a.rows
+        var nrhs = x.cols
+        for l = 0, W do
+            for k = 0, n do
+                var p = self.piv((c * n + k) * W + l)
+                if p ~= k then
+                    for j = 0, nrhs do
+                        var tmp = x:lane(c, k, j)[l]
+                        x:lane(c, k, j)[l] = x:lane(c, p, j)[l]
+                        x:lane(c, p, j)[l] = tmp
+                    end
+                end
+            end
+        end
+        for i = 0, n do
+            for k = 0, i do
+                var lik: V = a:lane(c, i, k)
+                for j = 0, nrhs do
+                    var xij = [V](x:lane(c, i, j)) - lik * [V](x:lane(c, k, j))
+                    xij:store(x:lane(c, i, j))
+                end
+            end
+        end
+        for ii = 0, n do
+            var i = n - 1 - ii
+            for k = i + 1, n do
+                var uik: V = a:lane(c, i, k)
+                for j = 0, nrhs do
+                    var xij = [V](x:lane(c, i, j)) - uik * [V](x:lane(c, k, j))
+                    xij:store(x:lane(c, i, j))
+                end
+            end
+            var uii: V = a:lane(c, i, i)
+            for j = 0, nrhs do
+                var xij = [V](x:lane(c, i, j)) / uii
+                xij:store(x:lane(c, i, j))
+            end
+        end
+    end
+
+    local solvechunks = terra(t: int64, ntasks: int64, self: &lu, x: &Batch)
+        var c0, c1 = chunkrange(t, ntasks, self.a.nchunks)
+        for c = c0, c1 do
+            solvechunk(c, self, x)
+        end
+    end
+
+    -- Solve for all columns of the batch x in place
+    terra lu:solve(x: &Batch)
+        err.assert(x.count == self.a.count and x.rows == self.a.rows)
+        parchunks(self, lambda.new(solvechunks, {self = self, x = x}))
+    end
+
+    lu.staticmethods.new = terra(A: Alloc, a: &Batch)
+        err.assert(a.rows == a.cols and a.rows <= BATCH_MAXSIZE)
+        var f: lu
+        f.a = a
+        f.piv = A:new(sizeof(int32), a.nchunks * W * a.rows)
+        initpool(A, f, a)
+        return f
+    end
+
+    return lu
+end)
+
+--[=[
+    Cholesky factorizations A = L L^T of all matrices of a batch. L is
+    stored in the lower triangle. Only the square roots of the diagonal are
+    computed lane by lane.
+--]=]
+local BatchedCholesky = parametrized.type(function(T)
+    local Batch = BatchedMatrix(T)
+    local W = Batch.traits.lanes
+    local V = simd.VectorFactory(T, W)
+
+    local struct cho {
+        a: &Batch
+        ntasks: int64
+        pool: Pool
+    }
+    function cho.metamethods.__typename(self)
+        return ("BatchedCholesky(%s)"):format(tostring(T))
+    end
+    base.AbstractBase(cho)
+
+    local factorchunk = terra(c: int64, self: &cho)
+        var a = self.a
+        var n = a.rows
+        for j = 0, n do
+            var d: V = a:lane(c, j, j)
+            for k = 0, j do
+                var ljk: V = a:lane(c, j, k)
+                d = d - ljk * ljk
+            end
+            d:store(a:lane(c, j, j))
+            for l = 0, W do
+                var djj = a:lane(c, j, j)[l]
+                err.assert(djj > 0)
+                a:lane(c, j, j)[l] = tmath.sqrt(djj)
+            end
+            var ljj: V = a:lane(c, j, j)
+            for i = j + 1, n do
+                var lij: V = a:lane(c, i, j)
+                for k = 0, j do
+                    lij = lij - [V](a:lane(c, i, k)) * [V](a:lane(c, j, k))
+                end
+                lij = lij / ljj
+                lij:store(a:lane(c, i, j))
+            end
+        end
+    end
+
+    local factorchunks = terra(t: int64, ntasks: int64, self: &cho)
+        var c0, c1 = chunkrange(t, ntasks, self.a.nchunks)
+        for c = c0, c1 do
+            factorchunk(c, self)
+        end
+    end
+
+    terra cho:factorize()
+        parchunks(self, lambda.new(factorchunks, {self = self}))
+    end
+
+    local solvechunk = terra(c: int64, self: &cho, x: &Batch)
+        var a = self.a
+        var n = a.rows
+        var nrhs = x.cols
+        for i = 0, n do
+            for k = 0, i do
+                var lik: V = a:lane(c, i, k)
+                for j = 0, nrhs do
+                    var xij = [V](x:lane(c, i, j)) - lik * [V](x:lane(c, k, j))
+                    xij:store(x:lane(c, i, j))
+                end
+            end
+            var lii: V = a:lane(c, i, i)
+            for j = 0, nrhs do
+                var xij = [V](x:lane(c, i, j)) / lii
+                xij:store(x:lane(c, i, j))
+            end
+        end
+        for ii = 0, n do
+            var i = n - 1 - ii
+            for k = i + 1, n do
+                var lki: V = a:lane(c, k, i)
+                for j = 0, nrhs do
+                    var xij = [V](x:lane(c, i, j)) - lki * [V](x:lane(c, k, j))
+                    xij:store(x:lane(c, i, j))
+                end
+            end
+            var lii: V = a:lane(c, i, i)
+            for j = 0, nrhs do
+                var xij = [V](x:lane(c, i, j)) / lii
+                xij:store(x:lane(c, i, j))
+            end
+        end
+    end
+
+    local solvechunks = terra(t: int64, ntasks: int64, self: &cho, x: &Batch)
+        var c0, c1 = chunkrange(t, ntasks, self.a.nchunks)
+        for c = c0, c1 do
+            solvechunk(c, self, x)
+        end
+    end
+
+    -- Solve for all columns of the batch x in place
+    terra cho:solve(x: &Batch)
+        err.assert(x.count == self.a.count and x.rows == self.a.rows)
+        parchunks(self, lambda.new(solvechunks, {self = self, x = x}))
+    end
+
+    cho.staticmethods.new = terra(A: Alloc, a: &Batch)
+        err.assert(a.rows == a.cols and a.rows <= BATCH_MAXSIZE)
+        var f: cho
+        f.a = a
+        initpool(A, f, a)
+        return f
+    end
+
+    return cho
+end)
+
+--[=[
+    Householder QR factorizations of all matrices of a batch with the same
+    storage as QRFactory: the Householder vectors are stored in the lower
+    triangle and the diagonal of R in u. The norms and phases of the
+    columns are computed lane by lane, the reflections with SIMD
+    instructions.
+--]=]
+local BatchedQR = parametrized.type(function(T)
+    local Batch = BatchedMatrix(T)
+    local W = Batch.traits.lanes
+    local V = simd.VectorFactory(T, W)
+
+    local struct qr {
+        a: &Batch
+        -- Batch of diagonals of R
+        u: Batch
+        ntasks: int64
+        pool: Pool
+    }
+    function qr.metamethods.__typename(self)
+        return ("BatchedQR(%s)"):format(tostring(T))
+    end
+    base.AbstractBase(qr)
+
+    local factorchunk = terra(c: int64, self: &qr)
+        var a = self.a
+        var n = a.rows
+        var two: V = [T](2)
+        for j = 0, n do
+            var musqr: V = [T](0)
+            for k = j, n do
+                var akj: V = a:lane(c, k, j)
+                musqr = musqr + akj * akj
+            end
+            var scale: T[W]
+            for l = 0, W do
+                var mu = tmath.sqrt(musqr.data[l])
+                var ajj = a:lane(c, j, j)[l]
+                var diag = tmath.abs(ajj)
+                var sign = terralib.select(ajj < 0, [T](-1), [T](1))
+                var beta = tmath.sqrt(2 * mu * (mu + diag))
+                a:lane(c, j, j)[l] = sign * (diag + mu)
+                self.u:lane(c, j, 0)[l] = -sign * mu
+                scale[l] = beta
+            end
+            var beta: V = &scale[0]
+            for k = j, n do
+                var vkj = [V](a:lane(c, k, j)) / beta
+                vkj:store(a:lane(c, k, j))
+            end
+            for m = j + 1, n do
+                var dot: V = [T](0)
+                for k = j, n do
+                    dot = dot + [V](a:lane(c, k, j)) * [V](a:lane(c, k, m))
+                end
+                dot = two * dot
+                for k = j, n do
+                    var akm = [V](a:lane(c, k, m)) - dot * [V](a:lane(c, k, j))
+                    akm:store(a:lane(c, k, m))
+                end
+            end
+        end
+    end
+
+    local factorchunks = terra(t: int64, ntasks: int64, self: &qr)
+        var c0, c1 = chunkrange(t, ntasks, self.a.nchunks)
+        for c = c0, c1 do
+            factorchunk(c, self)
+        end
+    end
+
+    terra qr:factorize()
+        parchunks(self, lambda.new(factorchunks, {self = self}))
+    end
+
+    local solvechunk = terra(c: int64, self: &qr, x: &Batch)
+        var a = self.a
+        var n = a.rows
+        var nrhs = x.cols
+        var two: V = [T](2)
+        for i = 0, n do
+            for j = 0, nrhs do
+                var dot: V = [T](0)
+                for k = i, n do
+                    dot = dot + [V](a:lane(c, k, i)) * [V](x:lane(c, k, j))
+                end
+                dot = two * dot
+                for k = i, n do
+                    var xkj = [V](x:lane(c, k, j)) - dot * [V](a:lane(c, k, i))
+                    xkj:store(x:lane(c, k, j))
+                end
+            end
+        end
+        for ii = 0, n do
+            var i = n - 1 - ii
+            for k = i + 1, n do
+                var rik: V = a:lane(c, i, k)
+                for j = 0, nrhs do
+                    var xij = [V](x:lane(c, i, j)) - rik * [V](x:lane(c, k, j))
+                    xij:store(x:lane(c, i, j))
+                end
+            end
+            var ui: V = self.u:lane(c, i, 0)
+            for j = 0, nrhs do
+                var xij = [V](x:lane(c, i, j)) / ui
+                xij:store(x:lane(c, i, j))
+            end
+        end
+    end
+
+    local solvechunks = terra(t: int64, ntasks: int64, self: &qr, x: &Batch)
+        var c0, c1 = chunkrange(t, ntasks, self.a.nchunks)
+        for c = c0, c1 do
+            solvechunk(c, self, x)
+        end
+    end
+
+    -- Solve for all columns of the batch x in place
+    terra qr:solve(x: &Batch)
+        err.assert(x.count == self.a.count and x.rows == self.a.rows)
+        parchunks(self, lambda.new(solvechunks, {self = self, x = x}))
+    end
+
+    qr.staticmethods.new = terra(A: Alloc, a: &Batch)
+        err.assert(a.rows == a.cols and a.rows <= BATCH_MAXSIZE)
+        var f: qr
+        f.a = a
+        f.u = Batch.new(A, a.count, a.rows, 1)
+        initpool(A, f, a)
+        return f
+    end
+
+    return qr
+end)
+
+return {
+    BatchedMatrix = BatchedMatrix,
+    BatchedLU = BatchedLU,
+    BatchedCholesky = BatchedCholesky,
+    BatchedQR = BatchedQR,
+}
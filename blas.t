@@ -43,6 +43,10 @@ S.Right = C.CblasRight
 S.Unit = C.CblasUnit
 S.NonUnit = C.CblasNonUnit
 
+-- Number of threads used by OpenBLAS. The setting is global to the process.
+S.get_num_threads = C.openblas_get_num_threads
+S.set_num_threads = C.openblas_set_num_threads
+
 -- All tables follow this ordering
 local type = {
     float, double, complexFloat, complexDouble
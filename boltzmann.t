@@ -1189,7 +1189,18 @@ local GenerateLinearBCWrapper = terralib.memoize(function()
     return impl
 end)
 
-local PrepareNonLinearInput = terralib.memoize(function(T, I)
+-- Dual number type for the derivative in N directions at once
+local function NonLinearDual(T, N)
+    if N == 1 then
+        return dual.DualNumber(T)
+    else
+        return dual.MultiDual(T, N)
+    end
+end
+
+local PrepareNonLinearInput = terralib.memoize(function(T, I, N)
+    N = N or 1
+    local D = NonLinearDual(T, N)
     local Alloc = alloc.Allocator
     local spanVDIM = span.Span(T, VDIM)
     local terra prepare_nonlinear_input(
@@ -1202,7 +1213,8 @@ local PrepareNonLinearInput = terralib.memoize(function(T, I)
         ntrialv: int32,
         -- Basis coefficients
         val: &T,
-        -- Direction of derivative for basis coefficients
+        -- Directions of derivative for basis coefficients, stored one
+        -- after the other with ntrialx * ntrialv entries each
         tng: &T,
         -- Number of spatial quadrature points
         nqx: int32,
@@ -1228,7 +1240,7 @@ local PrepareNonLinearInput = terralib.memoize(function(T, I)
         test_powers: &I,
         trial_powers: &I
     )
-        var testbasis = [TensorBasis(dual.DualNumber(T))].frombuffer(
+        var testbasis = [TensorBasis(D)].frombuffer(
                                                             A,
                                                             true,
                                                             ntestx,
@@ -1243,7 +1255,7 @@ local PrepareNonLinearInput = terralib.memoize(function(T, I)
                                                             [spanVDIM](u),
                                                             theta
                                                         )
-        var trialbasis = [TensorBasis(dual.DualNumber(T))].frombuffer(
+        var trialbasis = [TensorBasis(D)].frombuffer(
                                                             A,
                                                             false,
                                                             nqx,
@@ -1259,7 +1271,7 @@ local PrepareNonLinearInput = terralib.memoize(function(T, I)
                                                             theta
                                                         )
 
-        var normal = [darray.DynamicMatrix(dual.DualNumber(T))].zeros(
+        var normal = [darray.DynamicMatrix(D)].zeros(
                                                                     A,
                                                                     {nqx,
                                                                      VDIM}
@@ -1287,15 +1299,26 @@ local PrepareNonLinearInput = terralib.memoize(function(T, I)
         -- way to represent the unknown coefficients and their dual number
         -- representation is in matrix form with the spatial dof as row and the
         -- velocity dof as column indices.
-        var xvlhs = [darray.DynamicMatrix(dual.DualNumber(T))].new(
-                                                                    A,
-                                                                    {ntrialx,
-                                                                     ntrialv}
-                                                                )
+        -- With N directions t_1, ..., t_N the products F'(x) t_l are
+        -- computed in a single evaluation.
+        var xvlhs = [darray.DynamicMatrix(D)].new(A, {ntrialx, ntrialv})
+        var ndof = ntrialx * ntrialv
         for i = 0, ntrialx do
             for j = 0, ntrialv do
                 var idx = j + ntrialv * i
-                xvlhs(i, j) = [dual.DualNumber(T)] {val[idx], tng[idx]}
+                escape
+                    if N == 1 then
+                        emit quote xvlhs(i, j) = D {val[idx], tng[idx]} end
+                    else
+                        emit quote
+                            var t: T[N]
+                            for l = 0, N do
+                                t[l] = tng[idx + l * ndof]
+                            end
+                            xvlhs(i, j) = D.from(val[idx], &t[0])
+                        end
+                    end
+                end
             end
         end
         return testbasis, trialbasis, xvlhs, normal
@@ -1303,10 +1326,13 @@ local PrepareNonLinearInput = terralib.memoize(function(T, I)
     return prepare_nonlinear_input
 end)
 
-local GenerateNonLinearBCWrapper = terralib.memoize(function(Transform)
+-- The C wrapper computes the derivative in N directions. The directions in
+-- tng and the derivatives in restng are stored one after the other.
+local GenerateNonLinearBCWrapper = terralib.memoize(function(Transform, N)
+    N = N or 1
     local T = double
     local I = int32
-    local prepare_nonlinear_input = PrepareNonLinearInput(T, I)
+    local prepare_nonlinear_input = PrepareNonLinearInput(T, I, N)
     local types = prepare_nonlinear_input.type.parameters
     -- remove the the alloc argument from the parameter list for the C wrapper
     local sym = types:map(function(T) return symbol(T) end):sub(2, -1)
@@ -1333,10 +1359,21 @@ local GenerateNonLinearBCWrapper = terralib.memoize(function(Transform)
             )
         )
         var idx = 0
+        var nres = res:rows() * res:cols()
         for i = 0, res:rows() do
             for j = 0, res:cols() do
                 resval[idx] = res(i, j).val
-                restng[idx] = res(i, j).tng
+                escape
+                    if N == 1 then
+                        emit quote restng[idx] = res(i, j).tng end
+                    else
+                        emit quote
+                            for l = 0, N do
+                                restng[idx + l * nres] = res(i, j).tng[l]
+                            end
+                        end
+                    end
+                end
                 idx = idx + 1
             end
         end
@@ -7,9 +7,15 @@
 
 import "terraform"
 
+local alloc = require("alloc")
+local atomics = require("atomics")
 local base = require("base")
+local blas = require("blas")
 local err = require("assert")
 local concepts = require("concepts")
+local darray = require("darray")
+local lambda = require("lambda")
+local thread = require("thread")
 local tmath = require("tmath")
 local lapack = require("lapack")
 local parametrized = require("parametrized")
@@ -23,12 +29,148 @@ local BLASNumber = concepts.BLASNumber
 local BLASVector = concepts.BLASVector(BLASNumber)
 local BLASMatrix = concepts.BLASMatrix(BLASNumber)
 
-terraform factorize(a: &M, tol: T) where {M: Matrix, T: Number}
-    var n = a:size(0)
-    for i = 0, n do
-        for j = 0, i + 1 do
+local DefaultAlloc = alloc.DefaultAllocator()
+local Pool = alloc.SmartObject(thread.threadpool)
+local SmartInt32 = alloc.SmartBlock(int32)
+
+--[=[
+    Tiled Cholesky factorization A = L L^H. The lower triangle of A is split
+    into tiles of size nb x nb. With A(i, j) denoting the tile in row i and
+    column j, step k of the factorization consists of the tile operations
+
+        POTRF   A(k, k) = L(k, k) L(k, k)^H
+        TRSM    L(i, k) = A(i, k) L(k, k)^-H                    for i > k
+        SYRK    A(i, i) = A(i, i) - L(i, k) L(i, k)^H           for i > k
+        GEMM    A(i, j) = A(i, j) - L(i, k) L(j, k)^H           for i > j > k
+
+    Instead of synchronizing after each step, every tile operation is
+    submitted to the thread pool as soon as its inputs are ready. The
+    operation (i, j, k) on tile A(i, j) in step k depends on the previous
+    operation (i, j, k - 1) on the same tile and on the TRSM or POTRF
+    operations that compute its inputs. Each operation has an atomic counter
+    of resolved dependencies. The task that resolves the last dependency
+    submits the operation. A task submits its successors before it returns
+    and the pool counts a task as working from the moment it leaves the
+    queue, so a single barrier waits for the whole graph.
+--]=]
+local TaskGraph = terralib.memoize(function(M, Ts, kernels)
+    local struct dag {
+        a: &M
+        tol: Ts
+        n: int64
+        nb: int64
+        nt: int64
+        -- Resolved dependencies of operation (i, j, k), k <= j <= i
+        cnt: SmartInt32
+        pool: &Pool
+        allocator: &DefaultAlloc
+    }
+    base.AbstractBase(dag)
+
+    terra dag:index(i: int64, j: int64, k: int64)
+        return i * (i + 1) * (i + 2) / 6 + j * (j + 1) / 2 + k
+    end
+
+    terra dag:deps(i: int64, j: int64, k: int64): int32
+        var prev = terralib.select(k > 0, 1, 0)
+        if k < j then
+            return prev + terralib.select(i == j, 1, 2)
+        else
+            return prev + terralib.select(i == j, 0, 1)
+        end
+    end
+
+    -- First and last row (or column) of tile i
+    terra dag:range(i: int64)
+        var r0 = i * self.nb
+        var r1 = terralib.select(r0 + self.nb < self.n, r0 + self.nb, self.n)
+        return r0, r1
+    end
+
+    local task = terra(op: int64, self: &dag)
+        var nt = self.nt
+        self:run(op / (nt * nt), (op / nt) % nt, op % nt)
+    end
+
+    terra dag:submit(i: int64, j: int64, k: int64)
+        var nt = self.nt
+        self.pool:submit(
+            self.allocator,
+            lambda.new(task, {self = self}),
+            (i * nt + j) * nt + k
+        )
+    end
+
+    terra dag:notify(i: int64, j: int64, k: int64)
+        var old = atomics.add(&self.cnt(self:index(i, j, k)), 1)
+        if old + 1 == self:deps(i, j, k) then
+            self:submit(i, j, k)
+        end
+    end
+
+    terra dag:run(i: int64, j: int64, k: int64)
+        var ri0, ri1 = self:range(i)
+        var rj0, rj1 = self:range(j)
+        var rk0, rk1 = self:range(k)
+        if k < j then
+            if i == j then
+                [kernels.syrk](self.a, ri0, ri1, rk0, rk1)
+            else
+                [kernels.gemm](self.a, ri0, ri1, rj0, rj1, rk0, rk1)
+            end
+            self:notify(i, j, k + 1)
+        elseif i == j then
+            [kernels.potrf](self.a, self.tol, rk0, rk1)
+            for m = k + 1, self.nt do
+                self:notify(m, k, k)
+            end
+        else
+            [kernels.trsm](self.a, ri0, ri1, rk0, rk1)
+            for l = k + 1, i + 1 do
+                self:notify(i, l, k)
+            end
+            for m = i + 1, self.nt do
+                self:notify(m, i, k)
+            end
+        end
+    end
+
+    dag.staticmethods.new = terra(
+        A: &DefaultAlloc, a: &M, tol: Ts, n: int64, nb: int64, pool: &Pool
+    )
+        var g: dag
+        g.a = a
+        g.tol = tol
+        g.n = n
+        g.nb = nb
+        g.nt = (n + nb - 1) / nb
+        var len = g:index(g.nt, 0, 0)
+        g.cnt = A:new(sizeof(int32), len)
+        for l = 0, len do
+            g.cnt(l) = 0
+        end
+        g.pool = pool
+        g.allocator = A
+        return g
+    end
+
+    terra dag:factorize()
+        self:submit(0, 0, 0)
+        self.pool:barrier()
+    end
+
+    return dag
+end)
+
+-- Native tile kernels based on get and set. Only the lower triangle of the
+-- matrix is accessed.
+local native = {}
+
+terraform native.potrf(a: &M, tol: T, k0: int64, k1: int64) where {M, T}
+    for i = k0, k1 do
+        for j = k0, i + 1 do
             var sum = a:get(i, j)
-            for k = 0, j do
+            for k = k0, j do
                 sum = sum - a:get(i, k) * tmath.conj(a:get(j, k))
             end
             if i == j then
@@ -42,10 +184,149 @@ terraform factorize(a: &M, tol: T) where {M: Matrix, T: Number}
     end
 end
 
+terraform native.trsm(a: &M, r0: int64, r1: int64, k0: int64, k1: int64)
+    where {M}
+    for r = r0, r1 do
+        for j = k0, k1 do
+            var sum = a:get(r, j)
+            for p = k0, j do
+                sum = sum - a:get(r, p) * tmath.conj(a:get(j, p))
+            end
+            a:set(r, j, sum / a:get(j, j))
+        end
+    end
+end
+
+terraform native.syrk(a: &M, r0: int64, r1: int64, k0: int64, k1: int64)
+    where {M}
+    for r = r0, r1 do
+        for c = r0, r + 1 do
+            var sum = a:get(r, c)
+            for p = k0, k1 do
+                sum = sum - a:get(r, p) * tmath.conj(a:get(c, p))
+            end
+            a:set(r, c, sum)
+        end
+    end
+end
+
+terraform native.gemm(
+    a: &M, r0: int64, r1: int64, c0: int64, c1: int64, k0: int64, k1: int64
+) where {M}
+    for r = r0, r1 do
+        for c = c0, c1 do
+            var sum = a:get(r, c)
+            for p = k0, k1 do
+                sum = sum - a:get(r, p) * tmath.conj(a:get(c, p))
+            end
+            a:set(r, c, sum)
+        end
+    end
+end
+
+-- Tile size of the native tiled factorization
+local CHOL_TILE = 64
+
+terraform factorize(a: &M, tol: T) where {M: Matrix, T: Number}
+    var n: int64 = a:size(0)
+    if n <= CHOL_TILE then
+        native.potrf(a, tol, [int64](0), n)
+        return
+    end
+    var allocator: DefaultAlloc
+    var pool = thread.threadpool.new(&allocator, thread.omp_get_num_threads())
+    var g = [TaskGraph(M, T, native)].new(&allocator, a, tol, n, CHOL_TILE, &pool)
+    g:factorize()
+end
+
+-- BLAS tile kernels. The diagonal tiles are updated with gemm, which also
+-- changes their strictly upper triangle. It is restored after the
+-- factorization.
+local blastile = {}
+
+local tile = macro(function(a, r, c)
+    return quote
+        var n, m, ptr, lda = a:getblasdenseinfo()
+    in
+        ptr + r * lda + c, lda
+    end
+end)
+
+terraform blastile.potrf(a: &M, tol: T, k0: int64, k1: int64) where {M, T}
+    var akk, lda = tile(a, k0, k0)
+    var info = lapack.potrf(lapack.ROW_MAJOR, @"L", k1 - k0, akk, lda)
+    err.assert(info == 0)
+end
+
+terraform blastile.trsm(a: &M, r0: int64, r1: int64, k0: int64, k1: int64)
+    where {M}
+    var lkk, lda = tile(a, k0, k0)
+    var aik, ldb = tile(a, r0, k0)
+    blas.trsm(
+        blas.RowMajor, blas.Right, blas.Lower, blas.ConjTrans, blas.NonUnit,
+        r1 - r0, k1 - k0, [M.traits.eltype](1), lkk, lda, aik, lda
+    )
+end
+
+terraform blastile.gemm(
+    a: &M, r0: int64, r1: int64, c0: int64, c1: int64, k0: int64, k1: int64
+) where {M}
+    var aik, lda = tile(a, r0, k0)
+    var ajk, ldb = tile(a, c0, k0)
+    var aij, ldc = tile(a, r0, c0)
+    blas.gemm(
+        blas.RowMajor, blas.NoTrans, blas.ConjTrans, r1 - r0, c1 - c0, k1 - k0,
+        [M.traits.eltype](-1), aik, lda, ajk, lda, [M.traits.eltype](1), aij, lda
+    )
+end
+
+terraform blastile.syrk(a: &M, r0: int64, r1: int64, k0: int64, k1: int64)
+    where {M}
+    blastile.gemm(a, r0, r1, r0, r1, k0, k1)
+end
+
+-- Tile size of the tiled factorization with BLAS kernels
+local CHOL_TILE_BLAS = 256
+
 terraform factorize(a: &M, tol: T) where {M: BLASMatrix, T: BLASNumber}
     var n, m, adata, lda = a:getblasdenseinfo()
     err.assert(n == m)
-    lapack.potrf(lapack.ROW_MAJOR, @"L", n, adata, lda)
+    if n <= CHOL_TILE_BLAS then
+        var info = lapack.potrf(lapack.ROW_MAJOR, @"L", n, adata, lda)
+        err.assert(info == 0)
+        return
+    end
+    var nb: int64 = CHOL_TILE_BLAS
+    var allocator: DefaultAlloc
+    -- Strictly upper triangle of the diagonal tiles
+    var upper: alloc.SmartBlock(M.traits.eltype) = allocator:new(
+        sizeof(M.traits.eltype), n * nb
+    )
+    for i = 0, n do
+        var c1 = terralib.select((i / nb + 1) * nb < n, (i / nb + 1) * nb, n)
+        for j = i + 1, c1 do
+            upper(i * nb + j % nb) = adata[i * lda + j]
+        end
+    end
+    -- The tiles are processed in parallel by the pool, so each BLAS call
+    -- runs on a single thread. Otherwise, every worker would start its own
+    -- OpenBLAS threads and oversubscribe the machine.
+    var nblas = blas.get_num_threads()
+    blas.set_num_threads(1)
+    do
+        var pool = thread.threadpool.new(
+            &allocator, thread.omp_get_num_threads()
+        )
+        var g = [TaskGraph(M, T, blastile)].new(&allocator, a, tol, n, nb, &pool)
+        g:factorize()
+    end
+    blas.set_num_threads(nblas)
+    for i = 0, n do
+        var c1 = terralib.select((i / nb + 1) * nb < n, (i / nb + 1) * nb, n)
+        for j = i + 1, c1 do
+            adata[i * lda + j] = upper(i * nb + j % nb)
+        end
+    end
 end
 
 local conj = tmath.conj
@@ -75,12 +356,66 @@ terraform solve(trans: B, a: &M, x: &V)
     lapack.potrs(lapack.ROW_MAJOR, @"L", n, 1, adata, lda, xdata, incx)
 end
 
+-- Number of right-hand sides that are processed together by the generic
+-- multi-RHS solve
+local NRHS_BLOCK = 64
+
+--[=[
+    Solve with all columns of x as right-hand sides. The columns are
+    processed in blocks of NRHS_BLOCK, and each entry of the factor is
+    loaded once per block instead of once per right-hand side.
+--]=]
+terraform matsolve(trans: B, a: &M, x: &X) where {B: Bool, M: Matrix, X: Matrix}
+    var n: int64 = a:size(0)
+    var nrhs: int64 = x:size(1)
+    err.assert(x:size(0) == n)
+    for c0: int64 = 0, nrhs, NRHS_BLOCK do
+        var c1 = terralib.select(c0 + NRHS_BLOCK < nrhs, c0 + NRHS_BLOCK, nrhs)
+        for i = 0, n do
+            for k = 0, i do
+                var aik = a:get(i, k)
+                for c = c0, c1 do
+                    x:set(i, c, x:get(i, c) - aik * x:get(k, c))
+                end
+            end
+            var aii = a:get(i, i)
+            for c = c0, c1 do
+                x:set(i, c, x:get(i, c) / aii)
+            end
+        end
+
+        for ii = 0, n do
+            var i = n - 1 - ii
+            for k = i + 1, n do
+                var aki = conj(a:get(k, i))
+                for c = c0, c1 do
+                    x:set(i, c, x:get(i, c) - aki * x:get(k, c))
+                end
+            end
+            var aii = a:get(i, i)
+            for c = c0, c1 do
+                x:set(i, c, x:get(i, c) / aii)
+            end
+        end
+    end
+end
+
+terraform matsolve(trans: B, a: &M, x: &X)
+    where {B: Bool, M: BLASMatrix, X: BLASMatrix}
+    var n, m, adata, lda = a:getblasdenseinfo()
+    err.assert(n == m)
+    var nx, nrhs, xdata, ldx = x:getblasdenseinfo()
+    err.assert(n == nx)
+    lapack.potrs(lapack.ROW_MAJOR, @"L", n, nrhs, adata, lda, xdata, ldx)
+end
+
 local CholeskyFactory = parametrized.type(function(M)
 
     local T = M.traits.eltype
     local Vector = concepts.Vector(T)
     local Matrix = concepts.Matrix(T)
     local Factorization = concepts.Factorization(T)
+    local DMat = darray.DynamicMatrix(T)
 
     assert(Matrix(M), "Type " .. tostring(M)
                               .. " does not implement the matrix interface")
@@ -114,6 +449,11 @@ local CholeskyFactory = parametrized.type(function(M)
         return solve(trans, self.a, x)
     end
 
+    -- Solve for all columns of x in a single call
+    terraform cho:solve(trans: bool, x: &DMat)
+        return matsolve(trans, self.a, x)
+    end
+
     terraform cho:apply(trans: B, a: T, x: &V1, b: T, y: &V2)
         where {B: Bool, V1: Vector, V2: Vector}
         self:solve(trans, x)
@@ -16,7 +16,16 @@ local FixedMassFlowRate = boltzmann.FixedMassFlowRate
 local halfspace = GenerateLinearBCWrapper()
 local pressurebc = GenerateNonLinearBCWrapper(FixedPressure(double))
 local massflowbc = GenerateNonLinearBCWrapper(FixedMassFlowRate(double))
+-- Derivatives in eight directions per call
+local pressurebc8 = GenerateNonLinearBCWrapper(FixedPressure(double), 8)
+local massflowbc8 = GenerateNonLinearBCWrapper(FixedMassFlowRate(double), 8)
 compile.generateCAPI(
     "nonlinearbc",
-    {pressurebc = pressurebc, halfspace = halfspace, massflowbc = massflowbc}
+    {
+        pressurebc = pressurebc,
+        halfspace = halfspace,
+        massflowbc = massflowbc,
+        pressurebc8 = pressurebc8,
+        massflowbc8 = massflowbc8,
+    }
 )
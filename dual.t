@@ -10,9 +10,28 @@ local blend = require("blend")
 local concepts = require("concepts")
 local tmath = require("tmath")
 local parametrized = require("parametrized")
+local simd = require("simd")
 local io = terralib.includec("stdio.h")
 
 
+-- Power x^n with integer exponent by repeated squaring
+local intpow = terralib.memoize(function(T)
+    local terra dcpow(x: T, n: int64): T
+        if n < 0 then
+            return dcpow(1 / x, -n)
+        end
+        if n == 0 then
+            return [T](1)
+        end
+        if n == 1 then
+            return x
+        end
+        var p2 = dcpow(x * x, n / 2)
+        return terralib.select(n % 2 == 0, p2, x * p2)
+    end
+    return dcpow
+end)
+
 local DualNumber = parametrized.type(function(T)
 
     local struct dual{
@@ -166,19 +185,7 @@ local DualNumber = parametrized.type(function(T)
             tmath[name]:adddefinition(func)
         end
 
-        local terra dcpow(x: T, n: int64): T
-            if n < 0 then
-                return dcpow(1 / x, -n)
-            end
-            if n == 0 then
-                return [T](1)
-            end
-            if n == 1 then
-                return x
-            end
-            var p2 = dcpow(x * x, n / 2)
-            return terralib.select(n % 2 == 0, p2, x * p2)
-        end
+        local dcpow = intpow(T)
         for _, I in pairs({int8, int16, int32, int64}) do
             tmath.pow:adddefinition(terra(x: dual, y: I)
                 if y == 0 then
@@ -230,7 +237,255 @@ local DualNumber = parametrized.type(function(T)
     end
 
     dual.metamethods.__gt = terra(x: dual, y: dual)
-        return -x < -y
+        return y < x
+    end
+
+    dual.metamethods.__ge = terra(x: dual, y: dual)
+        return x == y or x > y
+    end
+
+    if concepts.Real(T) then
+        concepts.Real:addfriend(dual)
+    end
+
+    if concepts.Float(T) then
+        concepts.Float:addfriend(dual)
+    end
+
+    return dual
+end)
+
+--[=[
+    Dual number with N tangent directions, x = val + sum_l tng[l] e_l with
+    e_l e_m = 0. Evaluating a function F on such numbers yields F(x) and
+    the N directional derivatives F'(x) t_l in a single pass. The tangents
+    are stored as an array of T, so dual numbers can be kept in memory with
+    the natural alignment of T, and processed as a SIMD vector.
+--]=]
+local MultiDual = parametrized.type(function(T, N)
+    assert(T:isprimitive(), "Multi dual numbers need a primitive type, got "
+                            .. tostring(T))
+    local Tng = simd.VectorFactory(T, N)
+
+    local struct dual{
+        val: T
+        tng: T[N]
+    }
+    dual.eltype = T
+
+    local terra make(val: T, tng: Tng)
+        var x: dual
+        x.val = val
+        tng:store(&x.tng[0])
+        return x
+    end
+    make:setinlined(true)
+
+    -- Scalar multiple a t of the tangent t
+    local terra scale(a: T, t: Tng)
+        return [Tng](a) * t
+    end
+    scale:setinlined(true)
+
+    function dual.metamethods.__cast(from, to, exp)
+        if to == dual then
+            return `make([T](exp), [Tng]([T](0)))
+        else
+            error("Invalid scalar type of dual number data type conversion")
+        end
+    end
+
+    function dual.metamethods.__typename()
+        return ("MultiDual(%s, %d)"):format(tostring(T), N)
+    end
+
+    base.AbstractBase(dual)
+
+    terra dual:tangent()
+        var t: Tng
+        t:load(&self.tng[0])
+        return t
+    end
+    dual.methods.tangent:setinlined(true)
+
+    terra dual.metamethods.__add(self: dual, other: dual)
+        return make(self.val + other.val, self:tangent() + other:tangent())
+    end
+
+    terra dual.metamethods.__mul(self: dual, other: dual)
+        return make(
+            self.val * other.val,
+            scale(self.val, other:tangent()) + scale(other.val, self:tangent())
+        )
+    end
+
+    terra dual.metamethods.__unm(self: dual)
+        return make(-self.val, -self:tangent())
+    end
+
+    terra dual:inverse()
+        return make(1 / self.val, scale(-1 / (self.val * self.val), self:tangent()))
+    end
+
+    terra dual.metamethods.__sub(self: dual, other: dual)
+        return self + (-other)
+    end
+
+    terra dual.metamethods.__div(self: dual, other: dual)
+        return self * other:inverse()
+    end
+
+    terra dual.metamethods.__eq(self: dual, other: dual)
+        var eq = self.val == other.val
+        for l = 0, N do
+            eq = eq and self.tng[l] == other.tng[l]
+        end
+        return eq
+    end
+
+    -- Tangents are read from tng[0], ..., tng[N - 1]
+    terra dual.staticmethods.from(val: T, tng: &T)
+        var t: Tng
+        t:load(tng)
+        return make(val, t)
+    end
+
+    concepts.Number.friends[dual] = true
+
+    if concepts.Number(T) then
+        concepts.Number:addfriend(dual)
+        local fun = {}
+
+        terra fun.exp(x: dual)
+            var expval = tmath.exp(x.val)
+            return make(expval, scale(expval, x:tangent()))
+        end
+
+        terra fun.expm1(x: dual)
+            var expval = tmath.expm1(x.val)
+            return make(expval, scale(expval + 1, x:tangent()))
+        end
+
+        terra fun.log(x: dual)
+            return make(tmath.log(x.val), scale(1 / x.val, x:tangent()))
+        end
+
+        terra fun.erf(x: dual)
+            var y = x.val
+            var erfval = tmath.erf(y)
+            var expval = 2 / tmath.sqrt(tmath.pi) * tmath.exp(-y * y)
+            return make(erfval, scale(expval, x:tangent()))
+        end
+
+        terra fun.sin(x: dual)
+            return make(tmath.sin(x.val), scale(tmath.cos(x.val), x:tangent()))
+        end
+
+        terra fun.cos(x: dual)
+            return make(tmath.cos(x.val), scale(-tmath.sin(x.val), x:tangent()))
+        end
+
+        terra fun.sqrt(x: dual)
+            var sqrtval = tmath.sqrt(x.val)
+            return make(sqrtval, scale(1 / (2 * sqrtval), x:tangent()))
+        end
+
+        terra fun.j0(x: dual)
+            return make(tmath.j0(x.val), scale(-tmath.j1(x.val), x:tangent()))
+        end
+
+        terra fun.jn(n: int32, x: dual)
+            if n == 0 then
+                return fun.j0(x)
+            else
+                var val = tmath.jn(n, x.val)
+                var dval = (tmath.jn(n - 1, x.val) - tmath.jn(n + 1, x.val)) / 2
+                return make(val, scale(dval, x:tangent()))
+            end
+        end
+
+        terra fun.j1(x: dual)
+            return fun.jn(1, x)
+        end
+
+        terra fun.abs(x: dual)
+            return make(tmath.abs(x.val), scale(tmath.sign(x.val), x:tangent()))
+        end
+
+        -- Tangents are real as T is a primitive type
+        terra fun.real(x: dual)
+            return x
+        end
+
+        terra fun.conj(x: dual)
+            return x
+        end
+
+        terra fun.imag(x: dual)
+            return [dual](0)
+        end
+
+        for name, func in pairs(fun) do
+            tmath[name]:adddefinition(func)
+        end
+
+        local dcpow = intpow(T)
+        for _, I in pairs({int8, int16, int32, int64}) do
+            tmath.pow:adddefinition(terra(x: dual, y: I)
+                if y == 0 then
+                    return [dual](1)
+                else
+                    return make(
+                        dcpow(x.val, y), scale(y * dcpow(x.val, y - 1), x:tangent())
+                    )
+                end
+            end)
+        end
+
+        tmath.pow:adddefinition(terra(x: dual, y: dual)
+            var res = tmath.pow(x.val, y.val)
+            return make(
+                res,
+                scale(res * y.val / x.val, x:tangent())
+                + scale(res * tmath.log(x.val), y:tangent())
+            )
+        end)
+
+        tmath.fdexpm1:adddefinition(blend.blend(
+                terra(x: dual) return x.val == 0 end,
+                terra(x: dual) return make(1, scale([T](0.5), x:tangent())) end,
+                terra(x: dual) return tmath.expm1(x) / x end
+            )
+        )
+
+        tmath.fderf:adddefinition(blend.blend(
+                terra(x: dual) return x.val == 0 end,
+                terra(x: dual) return make(2 / tmath.sqrt(tmath.pi), [Tng]([T](0))) end,
+                terra(x: dual) return tmath.erf(x) / x end
+            )
+        )
+    end
+
+    --[=[
+        WARNING As for DualNumber, the comparison functions are only useful
+        for measuring the relative distance of two dual numbers. They use the
+        partial ordering implied by the embedding into R^(N + 1).
+    --]=]
+    local terra sqnorm(x: dual)
+        var t = x:tangent()
+        return x.val * x.val + (t * t):hsum()
+    end
+
+    dual.metamethods.__lt = terra(x: dual, y: dual)
+        return sqnorm(x) < sqnorm(y)
+    end
+
+    dual.metamethods.__le = terra(x: dual, y: dual)
+        return x == y or x < y
+    end
+
+    dual.metamethods.__gt = terra(x: dual, y: dual)
+        return y < x
     end
 
     dual.metamethods.__ge = terra(x: dual, y: dual)
@@ -249,5 +504,6 @@ local DualNumber = parametrized.type(function(T)
 end)
 
 return {
-    DualNumber = DualNumber
+    DualNumber = DualNumber,
+    MultiDual = MultiDual,
 }
@@ -0,0 +1,162 @@
+-- SPDX-FileCopyrightText: 2024 René Hiemstra <rrhiemstar@gmail.com>
+-- SPDX-FileCopyrightText: 2024 Torsten Keßler <t.kessler@posteo.de>
+-- SPDX-FileCopyrightText: 2025 René Hiemstra <rrhiemstar@gmail.com>
+-- SPDX-FileCopyrightText: 2025 Torsten Keßler <t.kessler@posteo.de>
+--
+-- SPDX-License-Identifier: MIT
+
+import "terraform"
+
+local alloc = require("alloc")
+local base = require("base")
+local blas = require("blas")
+local err = require("assert")
+local concepts = require("concepts")
+local darray = require("darray")
+local dual = require("dual")
+local matrix = require("matrix")
+local parametrized = require("parametrized")
+
+local Alloc = alloc.Allocator
+
+--[=[
+    C = alpha A B + beta C for dual matrices given by their value and
+    tangent planes. With A = Av + e At and B = Bv + e Bt the product is
+    A B = Av Bv + e (Av Bt + At Bv), so three real gemm calls suffice.
+    The tangent of C is updated before its value, since it depends on the
+    old value through the tangent of beta. p is a work plane of size m x n.
+--]=]
+local splitgemm = terralib.memoize(function(T)
+    local D = dual.DualNumber(T)
+    return terra(
+        m: int64, n: int64, k: int64, alpha: D,
+        av: &T, at: &T, lda: int64,
+        bv: &T, bt: &T, ldb: int64,
+        beta: D,
+        cv: &T, ct: &T, ldc: int64,
+        p: &T
+    )
+        -- p = Av Bv
+        blas.gemm(blas.RowMajor, blas.NoTrans, blas.NoTrans, m, n, k,
+                  [T](1), av, lda, bv, ldb, [T](0), p, n)
+        for i = 0, m do
+            for j = 0, n do
+                ct[i * ldc + j] = beta.val * ct[i * ldc + j] + beta.tng * cv[i * ldc + j]
+            end
+        end
+        blas.gemm(blas.RowMajor, blas.NoTrans, blas.NoTrans, m, n, k,
+                  alpha.val, av, lda, bt, ldb, [T](1), ct, ldc)
+        blas.gemm(blas.RowMajor, blas.NoTrans, blas.NoTrans, m, n, k,
+                  alpha.val, at, lda, bv, ldb, [T](1), ct, ldc)
+        for i = 0, m do
+            for j = 0, n do
+                var pij = p[i * n + j]
+                ct[i * ldc + j] = ct[i * ldc + j] + alpha.tng * pij
+                cv[i * ldc + j] = beta.val * cv[i * ldc + j] + alpha.val * pij
+            end
+        end
+    end
+end)
+
+--[=[
+    Dual matrix stored as two separate real matrices for the values and the
+    tangents. Products of such matrices are computed with three BLAS gemm
+    calls on the planes without any copies.
+--]=]
+local SplitDualMatrix = parametrized.type(function(T)
+    assert(concepts.BLASFloat(T), "Split dual matrices need a BLAS type, got "
+                                  .. tostring(T))
+    local D = dual.DualNumber(T)
+    local Mat = darray.DynamicMatrix(T)
+
+    local struct split {
+        val: Mat
+        tng: Mat
+    }
+    split.metamethods.__typename = function(self)
+        return ("SplitDualMatrix(%s)"):format(tostring(T))
+    end
+    base.AbstractBase(split)
+    split.traits.eltype = D
+
+    terra split:rows()
+        return self.val:rows()
+    end
+
+    terra split:cols()
+        return self.val:cols()
+    end
+
+    terra split:get(i: int64, j: int64)
+        return D {self.val:get(i, j), self.tng:get(i, j)}
+    end
+
+    terra split:set(i: int64, j: int64, x: D)
+        self.val:set(i, j, x.val)
+        self.tng:set(i, j, x.tng)
+    end
+
+    matrix.MatrixBase(split)
+
+    split.staticmethods.zeros = terra(A: Alloc, rows: int64, cols: int64)
+        var s: split
+        s.val = Mat.zeros(A, {rows, cols})
+        s.tng = Mat.zeros(A, {rows, cols})
+        return s
+    end
+
+    -- Split a dense matrix with interleaved dual entries into planes
+    terraform split.staticmethods.from(A: Alloc, a: &M) where {M: concepts.Matrix(D)}
+        var s = split.zeros(A, a:rows(), a:cols())
+        for i = 0, a:rows() do
+            for j = 0, a:cols() do
+                s:set(i, j, a:get(i, j))
+            end
+        end
+        return s
+    end
+
+    local gemm = splitgemm(T)
+
+    terraform matrix.gemm(alpha: D, A: &split, B: &split, beta: D, C: &split)
+        var m, k, av, lda = A.val:getblasdenseinfo()
+        var _, _, at, _ = A.tng:getblasdenseinfo()
+        var kb, n, bv, ldb = B.val:getblasdenseinfo()
+        var _, _, bt, _ = B.tng:getblasdenseinfo()
+        var mc, nc, cv, ldc = C.val:getblasdenseinfo()
+        var _, _, ct, _ = C.tng:getblasdenseinfo()
+        err.assert(k == kb and m == mc and n == nc)
+        var allocator: alloc.DefaultAllocator()
+        var p: alloc.SmartBlock(T) = allocator:new(sizeof(T), m * n)
+        gemm(m, n, k, alpha, av, at, lda, bv, bt, ldb, beta, cv, ct, ldc, &p(0))
+    end
+
+    return split
+end)
+
+for _, T in pairs({float, double}) do
+    local D = dual.DualNumber(T)
+    local DMat = darray.DynamicMatrix(D)
+    local Split = SplitDualMatrix(T)
+
+    -- Dense dual matrices with interleaved storage are split into planes,
+    -- multiplied with three BLAS calls and merged back. The copies cost
+    -- O(mk + kn + mn), the products O(mnk).
+    terraform matrix.gemm(alpha: D, A: &DMat, B: &DMat, beta: D, C: &DMat)
+        err.assert(A:cols() == B:rows() and C:rows() == A:rows() and C:cols() == B:cols())
+        var allocator: alloc.DefaultAllocator()
+        var a = Split.from(&allocator, A)
+        var b = Split.from(&allocator, B)
+        var c = Split.from(&allocator, C)
+        matrix.gemm(alpha, &a, &b, beta, &c)
+        for i = 0, C:rows() do
+            for j = 0, C:cols() do
+                C:set(i, j, c:get(i, j))
+            end
+        end
+    end
+end
+
+return {
+    SplitDualMatrix = SplitDualMatrix,
+}
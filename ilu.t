@@ -0,0 +1,572 @@
+-- SPDX-FileCopyrightText: 2024 René Hiemstra <rrhiemstar@gmail.com>
+-- SPDX-FileCopyrightText: 2024 Torsten Keßler <t.kessler@posteo.de>
+-- SPDX-FileCopyrightText: 2025 René Hiemstra <rrhiemstar@gmail.com>
+-- SPDX-FileCopyrightText: 2025 Torsten Keßler <t.kessler@posteo.de>
+--
+-- SPDX-License-Identifier: MIT
+
+import "terraform"
+
+local alloc = require("alloc")
+local base = require("base")
+local err = require("assert")
+local concepts = require("concepts")
+local darray = require("darray")
+local lambda = require("lambda")
+local sparse = require("sparse")
+local stack = require("stack")
+local thread = require("thread")
+local tmath = require("tmath")
+local parametrized = require("parametrized")
+
+local Bool = concepts.Bool
+local Alloc = alloc.Allocator
+local Pool = alloc.SmartObject(thread.threadpool)
+
+--[=[
+    Incomplete factorizations without fill-in, ILU(0) and IC(0), of a
+    CSRMatrix. The factors have the sparsity pattern of the matrix.
+
+    Both the factorization and the triangular solves process rows level
+    by level. The level of a row is one plus the maximal level of the rows
+    it depends on, so all rows of a level can be computed in parallel.
+    The levels are computed once in new and reused by every factorization
+    and solve.
+--]=]
+
+-- Levels with fewer rows are processed by the calling thread.
+local LEVEL_PARALLEL = 256
+-- Number of rows of a level processed by a single task
+local LEVEL_CHUNK = 64
+
+local Schedule = parametrized.type(function(I)
+    local SmartI = alloc.SmartBlock(I)
+
+    local struct schedule {
+        nlevels: I
+        -- Rows of level l are rows(ptr(l)), ..., rows(ptr(l + 1) - 1)
+        ptr: SmartI
+        rows: SmartI
+    }
+    function schedule.metamethods.__typename(self)
+        return ("LevelSchedule(%s)"):format(tostring(I))
+    end
+    base.AbstractBase(schedule)
+
+    -- Levels of the strictly lower (or upper) triangular part of a matrix
+    -- in CSR format. The diagonal of row i is stored at position diag[i].
+    schedule.staticmethods.new = terra(
+        A: Alloc, n: I, rowptr: &I, col: &I, diag: &I, lower: bool
+    )
+        var s: schedule
+        var level: SmartI = A:new(sizeof(I), terralib.select(n > 0, n, 1))
+        s.nlevels = 0
+        for ii = 0, n do
+            var i = terralib.select(lower, ii, n - 1 - ii)
+            var first = terralib.select(lower, rowptr[i], diag[i] + 1)
+            var last = terralib.select(lower, diag[i], rowptr[i + 1])
+            var lvl: I = 0
+            for idx = first, last do
+                var l = level(col[idx]) + 1
+                lvl = terralib.select(l > lvl, l, lvl)
+            end
+            level(i) = lvl
+            s.nlevels = terralib.select(lvl + 1 > s.nlevels, lvl + 1, s.nlevels)
+        end
+        s.ptr = A:new(sizeof(I), s.nlevels + 1)
+        for l = 0, s.nlevels + 1 do
+            s.ptr(l) = 0
+        end
+        for i = 0, n do
+            s.ptr(level(i) + 1) = s.ptr(level(i) + 1) + 1
+        end
+        for l = 0, s.nlevels do
+            s.ptr(l + 1) = s.ptr(l + 1) + s.ptr(l)
+        end
+        s.rows = A:new(sizeof(I), terralib.select(n > 0, n, 1))
+        var slot: SmartI = A:new(sizeof(I), s.nlevels + 1)
+        for l = 0, s.nlevels do
+            slot(l) = s.ptr(l)
+        end
+        for i = 0, n do
+            s.rows(slot(level(i))) = i
+            slot(level(i)) = slot(level(i)) + 1
+        end
+        return s
+    end
+
+    return schedule
+end)
+
+-- Returns a terra function that calls rowfunc(i, ctx) for all rows of a
+-- schedule, level by level. Large levels are split into chunks that are
+-- submitted to the thread pool.
+local levelloop = terralib.memoize(function(I, ctx, rowfunc)
+    local schedule = Schedule(I)
+
+    local terra chunk(c: I, rows: &I, last: I, ctx: &ctx)
+        var stop = terralib.select(c + LEVEL_CHUNK < last, c + LEVEL_CHUNK, last)
+        for k = c, stop do
+            rowfunc(rows[k], ctx)
+        end
+    end
+
+    return terra(pool: &Pool, sched: &schedule, ctx: &ctx)
+        var allocator: alloc.DefaultAllocator()
+        for l = 0, sched.nlevels do
+            var first = sched.ptr(l)
+            var last = sched.ptr(l + 1)
+            if last - first < LEVEL_PARALLEL then
+                for k = first, last do
+                    rowfunc(sched.rows(k), ctx)
+                end
+            else
+                for c = first, last, LEVEL_CHUNK do
+                    pool:submit(
+                        &allocator,
+                        lambda.new(
+                            chunk, {rows = &sched.rows(0), last = last, ctx = ctx}
+                        ),
+                        c
+                    )
+                end
+                pool:barrier()
+            end
+        end
+    end
+end)
+
+local Kernels = terralib.memoize(function(T, I)
+    local kernels = {}
+
+    local struct trictx {
+        rowptr: &I
+        col: &I
+        val: &T
+        diag: &I
+        -- Unit diagonal, the stored diagonal entries are ignored
+        unit: bool
+        x: &T
+    }
+    kernels.trictx = trictx
+
+    local struct factx {
+        rowptr: &I
+        col: &I
+        val: &T
+        diag: &I
+    }
+    kernels.factx = factx
+
+    local terra lowerrow(i: I, c: &trictx)
+        var s = c.x[i]
+        for idx = c.rowptr[i], c.diag[i] do
+            s = s - c.val[idx] * c.x[c.col[idx]]
+        end
+        if c.unit then
+            c.x[i] = s
+        else
+            c.x[i] = s / c.val[c.diag[i]]
+        end
+    end
+
+    local terra upperrow(i: I, c: &trictx)
+        var s = c.x[i]
+        for idx = c.diag[i] + 1, c.rowptr[i + 1] do
+            s = s - c.val[idx] * c.x[c.col[idx]]
+        end
+        if c.unit then
+            c.x[i] = s
+        else
+            c.x[i] = s / c.val[c.diag[i]]
+        end
+    end
+
+    -- Row i of ILU(0) in IKJ ordering, see Algorithm 10.4 in
+    -- Y. Saad, Iterative Methods for Sparse Linear Systems, SIAM, 2003
+    local terra ilurow(i: I, c: &factx)
+        var rowptr, col, val, diag = c.rowptr, c.col, c.val, c.diag
+        for idx = rowptr[i], diag[i] do
+            var k = col[idx]
+            val[idx] = val[idx] / val[diag[k]]
+            var lik = val[idx]
+            var jdx = idx + 1
+            var kdx = diag[k] + 1
+            while jdx < rowptr[i + 1] and kdx < rowptr[k + 1] do
+                if col[jdx] == col[kdx] then
+                    val[jdx] = val[jdx] - lik * val[kdx]
+                    jdx = jdx + 1
+                    kdx = kdx + 1
+                elseif col[jdx] < col[kdx] then
+                    jdx = jdx + 1
+                else
+                    kdx = kdx + 1
+                end
+            end
+        end
+    end
+
+    -- Row i of IC(0) for the lower triangular factor. The diagonal is the
+    -- last entry of each row.
+    local terra icrow(i: I, c: &factx)
+        var rowptr, col, val, diag = c.rowptr, c.col, c.val, c.diag
+        for idx = rowptr[i], rowptr[i + 1] do
+            var k = col[idx]
+            var s = val[idx]
+            -- Sparse dot product of rows i and k restricted to columns < k
+            var p = rowptr[i]
+            var q = rowptr[k]
+            while p < idx and q < diag[k] do
+                if col[p] == col[q] then
+                    s = s - val[p] * val[q]
+                    p = p + 1
+                    q = q + 1
+                elseif col[p] < col[q] then
+                    p = p + 1
+                else
+                    q = q + 1
+                end
+            end
+            if k < i then
+                val[idx] = s / val[diag[k]]
+            else
+                err.assert(s > 0)
+                val[idx] = tmath.sqrt(s)
+            end
+        end
+    end
+
+    kernels.lower = levelloop(I, trictx, lowerrow)
+    kernels.upper = levelloop(I, trictx, upperrow)
+    kernels.ilu = levelloop(I, factx, ilurow)
+    kernels.ic = levelloop(I, factx, icrow)
+
+    return kernels
+end)
+
+-- Owned copy of the sparsity pattern of a restricted to the columns
+-- with lo <= j - i <= hi. Returns the copy and the position in a of every
+-- entry of the copy.
+local CopyPattern = terralib.memoize(function(T, I)
+    local CSR = sparse.CSRMatrix(T, I)
+    local ST = stack.DynamicStack(T)
+    local SI = stack.DynamicStack(I)
+    return terra(A: Alloc, a: &CSR, lo: int64, hi: int64, src: &SI)
+        var b: CSR
+        b.rows = a.rows
+        b.cols = a.cols
+        var nnz = a:nnz()
+        var cap = terralib.select(nnz > 0, nnz, 1)
+        b.data = ST.new(A, cap)
+        b.col = SI.new(A, cap)
+        b.rowptr = SI.new(A, a.rows + 1)
+        @src = SI.new(A, cap)
+        b.rowptr:push(0)
+        for i = 0, a.rows do
+            for idx = a.rowptr(i), a.rowptr(i + 1) do
+                var d = [int64](a.col(idx)) - [int64](i)
+                if d >= lo and d <= hi then
+                    b.data:push(a.data(idx))
+                    b.col:push(a.col(idx))
+                    src:push(idx)
+                end
+            end
+            b.rowptr:push(b.data:size())
+        end
+        return b
+    end
+end)
+
+local ILUFactory = parametrized.type(function(T, I)
+    local CSR = sparse.CSRMatrix(T, I)
+    local SI = stack.DynamicStack(I)
+    local SmartI = alloc.SmartBlock(I)
+    local Vec = darray.DynamicVector(T)
+    local Vector = concepts.Vector(T)
+    local Factorization = concepts.Factorization(T)
+    local schedule = Schedule(I)
+    local kernels = Kernels(T, I)
+    local copypattern = CopyPattern(T, I)
+    local trictx = kernels.trictx
+    local factx = kernels.factx
+
+    local struct ilu {
+        a: &CSR
+        -- Strictly lower part of L and upper part of U in the pattern of a
+        lu: CSR
+        diag: SmartI
+        lower: schedule
+        upper: schedule
+        w: Vec
+        pool: Pool
+    }
+    function ilu.metamethods.__typename(self)
+        return ("ILU0(%s, %s)"):format(tostring(T), tostring(I))
+    end
+    base.AbstractBase(ilu)
+
+    terra ilu:rows()
+        return self.a:rows()
+    end
+
+    terra ilu:cols()
+        return self.a:cols()
+    end
+
+    terra ilu:factorize()
+        for idx = 0, self.a:nnz() do
+            self.lu.data(idx) = self.a.data(idx)
+        end
+        var ctx = factx {
+            &self.lu.rowptr(0), &self.lu.col(0), &self.lu.data(0), &self.diag(0)
+        }
+        [kernels.ilu](&self.pool, &self.lower, &ctx)
+    end
+
+    -- Solve L U x = b in the work vector
+    terra ilu:solvework()
+        var lu = &self.lu
+        var ctx = trictx {
+            &lu.rowptr(0), &lu.col(0), &lu.data(0), &self.diag(0), true, &self.w(0)
+        }
+        [kernels.lower](&self.pool, &self.lower, &ctx)
+        ctx.unit = false
+        [kernels.upper](&self.pool, &self.upper, &ctx)
+    end
+
+    -- Solve U^T L^T x = b in the work vector. This is done column by column
+    -- and hence serially.
+    terra ilu:solveworktrans()
+        var lu = &self.lu
+        var n = lu.rows
+        for i = 0, n do
+            self.w(i) = self.w(i) / lu.data(self.diag(i))
+            for idx = self.diag(i) + 1, lu.rowptr(i + 1) do
+                var j = lu.col(idx)
+                self.w(j) = self.w(j) - lu.data(idx) * self.w(i)
+            end
+        end
+        for ii = 0, n do
+            var i = n - 1 - ii
+            for idx = lu.rowptr(i), self.diag(i) do
+                var j = lu.col(idx)
+                self.w(j) = self.w(j) - lu.data(idx) * self.w(i)
+            end
+        end
+    end
+
+    terraform ilu:solve(trans: B, x: &V) where {B: Bool, V: Vector}
+        self.w:copy(x)
+        if trans then
+            self:solveworktrans()
+        else
+            self:solvework()
+        end
+        x:copy(&self.w)
+    end
+
+    -- In contrast to the dense factorizations, x is not overwritten.
+    terraform ilu:apply(trans: B, a: T, x: &V1, b: T, y: &V2)
+        where {B: Bool, V1: Vector, V2: Vector}
+        self.w:copy(x)
+        if trans then
+            self:solveworktrans()
+        else
+            self:solvework()
+        end
+        y:scal(b)
+        y:axpy(a, &self.w)
+    end
+
+    assert(Factorization(ilu))
+
+    ilu.staticmethods.new = terra(A: Alloc, a: &CSR)
+        err.assert(a.rows == a.cols)
+        var n = a.rows
+        var f: ilu
+        f.a = a
+        var src: SI
+        f.lu = copypattern(A, a, -[int64](a.rows), a.cols, &src)
+        f.diag = A:new(sizeof(I), terralib.select(n > 0, n, 1))
+        for i = 0, n do
+            var idx = a.rowptr(i)
+            while idx < a.rowptr(i + 1) and a.col(idx) < i do
+                idx = idx + 1
+            end
+            -- ILU(0) needs all diagonal entries in the pattern
+            err.assert(idx < a.rowptr(i + 1) and a.col(idx) == i)
+            f.diag(i) = idx
+        end
+        var rowptr = &f.lu.rowptr(0)
+        var col = &f.lu.col(0)
+        f.lower = schedule.new(A, n, rowptr, col, &f.diag(0), true)
+        f.upper = schedule.new(A, n, rowptr, col, &f.diag(0), false)
+        f.w = Vec.zeros(A, n)
+        f.pool = thread.threadpool.new(A, thread.omp_get_num_threads())
+        return f
+    end
+
+    return ilu
+end)
+
+local ICFactory = parametrized.type(function(T, I)
+    local CSR = sparse.CSRMatrix(T, I)
+    local SI = stack.DynamicStack(I)
+    local SmartI = alloc.SmartBlock(I)
+    local Vec = darray.DynamicVector(T)
+    local Vector = concepts.Vector(T)
+    local Factorization = concepts.Factorization(T)
+    local schedule = Schedule(I)
+    local kernels = Kernels(T, I)
+    local copypattern = CopyPattern(T, I)
+    local trictx = kernels.trictx
+    local factx = kernels.factx
+
+    local struct ic {
+        a: &CSR
+        -- Lower triangular factor L in the lower pattern of a
+        l: CSR
+        -- Position in a of each entry of l
+        src: SI
+        -- L^T in CSR format and the position in l of each entry
+        lt: CSR
+        tsrc: SmartI
+        ldiag: SmartI
+        ltdiag: SmartI
+        lower: schedule
+        upper: schedule
+        w: Vec
+        pool: Pool
+    }
+    function ic.metamethods.__typename(self)
+        return ("IC0(%s, %s)"):format(tostring(T), tostring(I))
+    end
+    base.AbstractBase(ic)
+
+    terra ic:rows()
+        return self.a:rows()
+    end
+
+    terra ic:cols()
+        return self.a:cols()
+    end
+
+    terra ic:factorize()
+        for idx = 0, self.l:nnz() do
+            self.l.data(idx) = self.a.data(self.src(idx))
+        end
+        var ctx = factx {
+            &self.l.rowptr(0), &self.l.col(0), &self.l.data(0), &self.ldiag(0)
+        }
+        [kernels.ic](&self.pool, &self.lower, &ctx)
+        for idx = 0, self.lt:nnz() do
+            self.lt.data(idx) = self.l.data(self.tsrc(idx))
+        end
+    end
+
+    -- Solve L L^T x = b in the work vector
+    terra ic:solvework()
+        var l = &self.l
+        var ctx = trictx {
+            &l.rowptr(0), &l.col(0), &l.data(0), &self.ldiag(0), false, &self.w(0)
+        }
+        [kernels.lower](&self.pool, &self.lower, &ctx)
+        var lt = &self.lt
+        ctx = trictx {
+            &lt.rowptr(0), &lt.col(0), &lt.data(0), &self.ltdiag(0), false, &self.w(0)
+        }
+        [kernels.upper](&self.pool, &self.upper, &ctx)
+    end
+
+    -- The factorization is symmetric, so trans is ignored.
+    terraform ic:solve(trans: B, x: &V) where {B: Bool, V: Vector}
+        self.w:copy(x)
+        self:solvework()
+        x:copy(&self.w)
+    end
+
+    terraform ic:apply(trans: B, a: T, x: &V1, b: T, y: &V2)
+        where {B: Bool, V1: Vector, V2: Vector}
+        self.w:copy(x)
+        self:solvework()
+        y:scal(b)
+        y:axpy(a, &self.w)
+    end
+
+    assert(Factorization(ic))
+
+    -- Only the lower triangular part of a is accessed.
+    ic.staticmethods.new = terra(A: Alloc, a: &CSR)
+        err.assert(a.rows == a.cols)
+        var n = a.rows
+        var f: ic
+        f.a = a
+        f.l = copypattern(A, a, -[int64](a.rows), 0, &f.src)
+        var l = &f.l
+        var nnz = l:nnz()
+        var cap = terralib.select(nnz > 0, nnz, 1)
+        f.ldiag = A:new(sizeof(I), terralib.select(n > 0, n, 1))
+        for i = 0, n do
+            -- IC(0) needs all diagonal entries in the pattern
+            err.assert(
+                l.rowptr(i + 1) > l.rowptr(i) and l.col(l.rowptr(i + 1) - 1) == i
+            )
+            f.ldiag(i) = l.rowptr(i + 1) - 1
+        end
+
+        -- Transpose the pattern of L by counting sort
+        var lt = &f.lt
+        lt.rows = n
+        lt.cols = n
+        lt.rowptr = SI.new(A, n + 1)
+        for i = 0, n + 1 do
+            lt.rowptr:push(0)
+        end
+        for idx = 0, nnz do
+            lt.rowptr(l.col(idx) + 1) = lt.rowptr(l.col(idx) + 1) + 1
+        end
+        for i = 0, n do
+            lt.rowptr(i + 1) = lt.rowptr(i + 1) + lt.rowptr(i)
+        end
+        lt.data = [stack.DynamicStack(T)].new(A, cap)
+        lt.col = SI.new(A, cap)
+        for idx = 0, nnz do
+            lt.data:push(0)
+            lt.col:push(0)
+        end
+        f.tsrc = A:new(sizeof(I), cap)
+        var slot: SmartI = A:new(sizeof(I), n + 1)
+        for i = 0, n do
+            slot(i) = lt.rowptr(i)
+        end
+        for i = 0, n do
+            for idx = l.rowptr(i), l.rowptr(i + 1) do
+                var j = l.col(idx)
+                lt.col(slot(j)) = i
+                f.tsrc(slot(j)) = idx
+                slot(j) = slot(j) + 1
+            end
+        end
+        -- The diagonal is the first entry of each row of L^T
+        f.ltdiag = A:new(sizeof(I), terralib.select(n > 0, n, 1))
+        for i = 0, n do
+            f.ltdiag(i) = lt.rowptr(i)
+        end
+
+        f.lower = schedule.new(A, n, &l.rowptr(0), &l.col(0), &f.ldiag(0), true)
+        f.upper = schedule.new(
+            A, n, &lt.rowptr(0), &lt.col(0), &f.ltdiag(0), false
+        )
+        f.w = Vec.zeros(A, n)
+        f.pool = thread.threadpool.new(A, thread.omp_get_num_threads())
+        return f
+    end
+
+    return ic
+end)
+
+return {
+    Schedule = Schedule,
+    ILUFactory = ILUFactory,
+    ICFactory = ICFactory,
+}
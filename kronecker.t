@@ -0,0 +1,155 @@
+-- SPDX-FileCopyrightText: 2024 René Hiemstra <rrhiemstar@gmail.com>
+-- SPDX-FileCopyrightText: 2024 Torsten Keßler <t.kessler@posteo.de>
+-- SPDX-FileCopyrightText: 2025 René Hiemstra <rrhiemstar@gmail.com>
+-- SPDX-FileCopyrightText: 2025 Torsten Keßler <t.kessler@posteo.de>
+--
+-- SPDX-License-Identifier: MIT
+
+import "terraform"
+
+local alloc = require("alloc")
+local base = require("base")
+local err = require("assert")
+local concepts = require("concepts")
+local darray = require("darray")
+local matrix = require("matrix")
+local parametrized = require("parametrized")
+
+local Bool = concepts.Bool
+local Alloc = alloc.Allocator
+local size_t = uint64
+
+-- Tile size of the out-of-place transpose
+local TILE = 32
+
+-- Y = alpha op(M) X + beta Y for dense X and Y. Sparse matrices provide an
+-- apply method for dense right hand sides, dense matrices use gemm.
+local mult = macro(function(trans, M, alpha, X, beta, Y)
+    local MT = M:gettype()
+    MT = MT:ispointer() and MT.type or MT
+    if MT.methods.apply then
+        return `M:apply(trans, alpha, X, beta, Y)
+    else
+        return quote
+            if trans then
+                matrix.gemm(alpha, M:transpose(), X, beta, Y)
+            else
+                matrix.gemm(alpha, M, X, beta, Y)
+            end
+        end
+    end
+end)
+
+--[=[
+    Matrix-free Kronecker product A ⊗ B. The entry of A ⊗ B in row
+    i * B:rows() + k and column j * B:cols() + l is A(i, j) * B(k, l).
+    If the vector x is viewed as the row major matrix X of size
+    A:cols() x B:cols(), then
+
+        (A ⊗ B) x = A X B^T,
+
+    which is the row major form of (A ⊗ B) vec(X) = vec(B X A^T). The
+    product is computed with two matrix-matrix products of A and B and never
+    forms A ⊗ B.
+--]=]
+local KroneckerOperator = parametrized.type(function(MA, MB)
+    local T = MA.traits.eltype
+    assert(T == MB.traits.eltype, "Both factors need the same element type")
+    local Mat = darray.DynamicMatrix(T)
+    local SmartT = alloc.SmartBlock(T)
+    local ContiguousVector = concepts.ContiguousVector(T)
+
+    local struct kron {
+        a: &MA
+        b: &MB
+        -- Work space for the transposed input and the intermediate product
+        xt: SmartT
+        z: SmartT
+        zt: SmartT
+    }
+    function kron.metamethods.__typename(self)
+        return ("KroneckerOperator(%s, %s)"):format(tostring(MA), tostring(MB))
+    end
+    base.AbstractBase(kron)
+    kron.traits.eltype = T
+
+    terra kron:rows()
+        return self.a:rows() * self.b:rows()
+    end
+
+    terra kron:cols()
+        return self.a:cols() * self.b:cols()
+    end
+
+    -- Out of place transpose of the row major n x m matrix x
+    local terra transpose(n: size_t, m: size_t, x: &T, y: &T)
+        for i0 = 0, n, TILE do
+            for j0 = 0, m, TILE do
+                var i1 = terralib.select(i0 + TILE < n, i0 + TILE, n)
+                var j1 = terralib.select(j0 + TILE < m, j0 + TILE, m)
+                for i = i0, i1 do
+                    for j = j0, j1 do
+                        y[j * n + i] = x[i * m + j]
+                    end
+                end
+            end
+        end
+    end
+
+    terraform kron:apply(trans: B, alpha: T, x: &V1, beta: T, y: &V2)
+        where {B: Bool, V1: ContiguousVector, V2: ContiguousVector}
+        var nx, px = x:getbuffer()
+        var ny, py = y:getbuffer()
+        var ra: size_t = self.a:rows()
+        var ca: size_t = self.a:cols()
+        var rb: size_t = self.b:rows()
+        var cb: size_t = self.b:cols()
+        if not trans then
+            err.assert(nx == ca * cb and ny == ra * rb)
+            -- A X B^T = A (B X^T)^T
+            transpose(ca, cb, px, &self.xt(0))
+            var xt = Mat.frombuffer({cb, ca}, &self.xt(0))
+            var z = Mat.frombuffer({rb, ca}, &self.z(0))
+            mult(false, self.b, [T](1), &xt, [T](0), &z)
+            transpose(rb, ca, &self.z(0), &self.zt(0))
+            var zt = Mat.frombuffer({ca, rb}, &self.zt(0))
+            var ym = Mat.frombuffer({ra, rb}, py)
+            mult(false, self.a, alpha, &zt, beta, &ym)
+        else
+            err.assert(nx == ra * rb and ny == ca * cb)
+            -- A^T X B = A^T (B^T X^T)^T
+            transpose(ra, rb, px, &self.xt(0))
+            var xt = Mat.frombuffer({rb, ra}, &self.xt(0))
+            var z = Mat.frombuffer({cb, ra}, &self.z(0))
+            mult(true, self.b, [T](1), &xt, [T](0), &z)
+            transpose(cb, ra, &self.z(0), &self.zt(0))
+            var zt = Mat.frombuffer({ra, cb}, &self.zt(0))
+            var ym = Mat.frombuffer({ca, cb}, py)
+            mult(true, self.a, alpha, &zt, beta, &ym)
+        end
+    end
+
+    kron.staticmethods.new = terra(A: Alloc, a: &MA, b: &MB)
+        var ra: size_t = a:rows()
+        var ca: size_t = a:cols()
+        var rb: size_t = b:rows()
+        var cb: size_t = b:cols()
+        var nx = terralib.select(ca * cb > ra * rb, ca * cb, ra * rb)
+        var nz = terralib.select(rb * ca > cb * ra, rb * ca, cb * ra)
+        nx = terralib.select(nx > 0, nx, 1)
+        nz = terralib.select(nz > 0, nz, 1)
+        var k: kron
+        k.a = a
+        k.b = b
+        k.xt = A:new(sizeof(T), nx)
+        k.z = A:new(sizeof(T), nz)
+        k.zt = A:new(sizeof(T), nz)
+        return k
+    end
+
+    return kron
+end)
+
+return {
+    KroneckerOperator = KroneckerOperator,
+}
@@ -0,0 +1,442 @@
+-- SPDX-FileCopyrightText: 2024 René Hiemstra <rrhiemstar@gmail.com>
+-- SPDX-FileCopyrightText: 2024 Torsten Keßler <t.kessler@posteo.de>
+-- SPDX-FileCopyrightText: 2025 René Hiemstra <rrhiemstar@gmail.com>
+-- SPDX-FileCopyrightText: 2025 Torsten Keßler <t.kessler@posteo.de>
+--
+-- SPDX-License-Identifier: MIT
+
+import "terraform"
+
+local alloc = require("alloc")
+local base = require("base")
+local err = require("assert")
+local concepts = require("concepts")
+local darray = require("darray")
+local matrix = require("matrix")
+local tmath = require("tmath")
+local parametrized = require("parametrized")
+
+local Bool = concepts.Bool
+local Alloc = alloc.Allocator
+local size_t = uint64
+
+--[=[
+    Iterative solvers for A x = b. The operator A is either a matrix or a
+    matrix-free operator with an apply method, see concepts.Operator. The
+    same holds for the preconditioner P which is applied as y = P x. Hence,
+    a factorization such as LUFactory can serve as a preconditioner.
+
+    All solvers keep their work vectors between calls to solve and
+    return the number of iterations and the relative residual |b - A x| / |b|.
+--]=]
+
+-- y = A x. Sparse matrices and matrix-free operators provide an apply
+-- method, dense matrices are multiplied with gemv.
+local matvec = macro(function(A, x, y)
+    local M = A:gettype()
+    M = M:ispointer() and M.type or M
+    local T = y:gettype().type.traits.eltype
+    if M.methods.apply then
+        return `A:apply(false, [T](1), x, [T](0), y)
+    else
+        return `matrix.gemv([T](1), A, x, [T](0), y)
+    end
+end)
+
+-- z = P r. The work vector t is needed as factorizations overwrite their
+-- input when applied.
+local precondition = macro(function(P, r, t, z)
+    local T = r:gettype().type.traits.eltype
+    return quote
+        t:copy(r)
+        z:fill([T](0))
+        P:apply(false, [T](1), t, [T](0), z)
+    end
+end)
+
+local Identity = parametrized.type(function(T)
+    local Vector = concepts.Vector(T)
+
+    local struct identity {}
+    function identity.metamethods.__typename(self)
+        return ("Identity(%s)"):format(tostring(T))
+    end
+    base.AbstractBase(identity)
+
+    terraform identity:apply(trans: B, a: T, x: &V1, b: T, y: &V2)
+        where {B: Bool, V1: Vector, V2: Vector}
+        y:scal(b)
+        y:axpy(a, x)
+    end
+
+    return identity
+end)
+
+local Stats = parametrized.type(function(T)
+    local struct stats {
+        iterations: int64
+        -- Relative residual |b - A x| / |b|
+        residual: T
+        converged: bool
+    }
+    function stats.metamethods.__typename(self)
+        return ("KrylovStats(%s)"):format(tostring(T))
+    end
+    base.AbstractBase(stats)
+    return stats
+end)
+
+--[=[
+    Preconditioned conjugate gradient method for symmetric positive definite
+    A and P, see Algorithm 9.1 in
+    Y. Saad, Iterative Methods for Sparse Linear Systems, SIAM, 2003
+--]=]
+local CGFactory = parametrized.type(function(T)
+    assert(concepts.Float(T), "CG requires a floating point type")
+    local Vec = darray.DynamicVector(T)
+    local Vector = concepts.Vector(T)
+    local stats = Stats(T)
+
+    local struct cg {
+        tol: T
+        maxiter: int64
+        r: Vec
+        z: Vec
+        p: Vec
+        q: Vec
+        t: Vec
+    }
+    function cg.metamethods.__typename(self)
+        return ("CG(%s)"):format(tostring(T))
+    end
+    base.AbstractBase(cg)
+
+    terraform cg:solve(A: &M, P: &Pre, b: &V1, x: &V2)
+        where {M, Pre, V1: Vector, V2: Vector}
+        var n = self.r:size()
+        err.assert(b:size() == n and x:size() == n)
+        var r, z, p, q, t = &self.r, &self.z, &self.p, &self.q, &self.t
+        matvec(A, x, r)
+        r:scal([T](-1))
+        r:axpy([T](1), b)
+        precondition(P, r, t, z)
+        p:copy(z)
+        var rz = r:dot(z)
+        var bnorm = b:norm()
+        bnorm = terralib.select(bnorm > 0, bnorm, [T](1))
+        var res = stats {0, r:norm() / bnorm, false}
+        while res.residual > self.tol and res.iterations < self.maxiter do
+            matvec(A, p, q)
+            var alpha = rz / p:dot(q)
+            x:axpy(alpha, p)
+            r:axpy(-alpha, q)
+            precondition(P, r, t, z)
+            var rznew = r:dot(z)
+            p:scal(rznew / rz)
+            p:axpy([T](1), z)
+            rz = rznew
+            res.iterations = res.iterations + 1
+            res.residual = r:norm() / bnorm
+        end
+        res.converged = res.residual <= self.tol
+        return res
+    end
+
+    terraform cg:solve(A: &M, b: &V1, x: &V2)
+        where {M, V1: Vector, V2: Vector}
+        var id: Identity(T)
+        return self:solve(A, &id, b, x)
+    end
+
+    cg.staticmethods.new = terra(alloc: Alloc, n: size_t, tol: T, maxiter: int64)
+        return cg {
+            tol,
+            maxiter,
+            Vec.zeros(alloc, n),
+            Vec.zeros(alloc, n),
+            Vec.zeros(alloc, n),
+            Vec.zeros(alloc, n),
+            Vec.zeros(alloc, n)
+        }
+    end
+
+    return cg
+end)
+
+--[=[
+    Restarted GMRES with right preconditioning, see Algorithm 9.5 in
+    Y. Saad, Iterative Methods for Sparse Linear Systems, SIAM, 2003
+    The Hessenberg matrix is reduced with Givens rotations, so the residual
+    is available in every step without forming the iterate.
+--]=]
+local GMRESFactory = parametrized.type(function(T)
+    assert(concepts.Float(T), "GMRES requires a floating point type")
+    local Vec = darray.DynamicVector(T)
+    local Mat = darray.DynamicMatrix(T)
+    local Vector = concepts.Vector(T)
+    local stats = Stats(T)
+
+    local struct gmres {
+        tol: T
+        maxiter: int64
+        restart: int64
+        -- Krylov basis, one vector per row
+        basis: Mat
+        h: Mat
+        cs: Vec
+        sn: Vec
+        g: Vec
+        w: Vec
+        z: Vec
+        t: Vec
+    }
+    function gmres.metamethods.__typename(self)
+        return ("GMRES(%s)"):format(tostring(T))
+    end
+    base.AbstractBase(gmres)
+
+    terra gmres:basisvector(i: int64)
+        var n = self.w:size()
+        return Vec.frombuffer({n}, &self.basis(i, 0))
+    end
+
+    terraform gmres:solve(A: &M, P: &Pre, b: &V1, x: &V2)
+        where {M, Pre, V1: Vector, V2: Vector}
+        var n = self.w:size()
+        err.assert(b:size() == n and x:size() == n)
+        var m = self.restart
+        var w, z, t = &self.w, &self.z, &self.t
+        var bnorm = b:norm()
+        bnorm = terralib.select(bnorm > 0, bnorm, [T](1))
+        var res = stats {0, [T](0), false}
+        while true do
+            -- The first basis vector is the normalized residual b - A x
+            var v0 = self:basisvector(0)
+            matvec(A, x, &v0)
+            v0:scal([T](-1))
+            v0:axpy([T](1), b)
+            var beta = v0:norm()
+            res.residual = beta / bnorm
+            if res.residual <= self.tol or res.iterations >= self.maxiter then
+                break
+            end
+            v0:scal(1 / beta)
+            self.g:fill([T](0))
+            self.g(0) = beta
+
+            var k: int64 = 0
+            for j = 0, m do
+                res.iterations = res.iterations + 1
+                var vj = self:basisvector(j)
+                precondition(P, &vj, t, z)
+                matvec(A, z, w)
+                -- Modified Gram-Schmidt
+                for i = 0, j + 1 do
+                    var vi = self:basisvector(i)
+                    var hij = w:dot(&vi)
+                    self.h(i, j) = hij
+                    w:axpy(-hij, &vi)
+                end
+                var hnext = w:norm()
+                self.h(j + 1, j) = hnext
+                if hnext > 0 then
+                    var vnext = self:basisvector(j + 1)
+                    vnext:copy(w)
+                    vnext:scal(1 / hnext)
+                end
+                -- Apply the previous rotations to the new column
+                for i = 0, j do
+                    var hi = self.h(i, j)
+                    var hip = self.h(i + 1, j)
+                    self.h(i, j) = self.cs(i) * hi + self.sn(i) * hip
+                    self.h(i + 1, j) = -self.sn(i) * hi + self.cs(i) * hip
+                end
+                -- and eliminate the subdiagonal entry
+                var hjj = self.h(j, j)
+                var denom = tmath.sqrt(hjj * hjj + hnext * hnext)
+                self.cs(j) = hjj / denom
+                self.sn(j) = hnext / denom
+                self.h(j, j) = denom
+                self.h(j + 1, j) = 0
+                self.g(j + 1) = -self.sn(j) * self.g(j)
+                self.g(j) = self.cs(j) * self.g(j)
+
+                k = j + 1
+                res.residual = tmath.abs(self.g(j + 1)) / bnorm
+                if (
+                    res.residual <= self.tol
+                    or res.iterations >= self.maxiter
+                    or hnext == 0
+                ) then
+                    break
+                end
+            end
+
+            -- Solve the upper triangular least squares system in place
+            for ii = 0, k do
+                var i = k - 1 - ii
+                var s = self.g(i)
+                for l = i + 1, k do
+                    s = s - self.h(i, l) * self.g(l)
+                end
+                self.g(i) = s / self.h(i, i)
+            end
+            -- x = x + P (V y)
+            w:fill([T](0))
+            for i = 0, k do
+                var vi = self:basisvector(i)
+                w:axpy(self.g(i), &vi)
+            end
+            precondition(P, w, t, z)
+            x:axpy([T](1), z)
+        end
+        res.converged = res.residual <= self.tol
+        return res
+    end
+
+    terraform gmres:solve(A: &M, b: &V1, x: &V2)
+        where {M, V1: Vector, V2: Vector}
+        var id: Identity(T)
+        return self:solve(A, &id, b, x)
+    end
+
+    gmres.staticmethods.new = terra(
+        alloc: Alloc, n: size_t, restart: int64, tol: T, maxiter: int64
+    )
+        err.assert(restart > 0)
+        return gmres {
+            tol,
+            maxiter,
+            restart,
+            Mat.zeros(alloc, {restart + 1, n}),
+            Mat.zeros(alloc, {restart + 1, restart}),
+            Vec.zeros(alloc, restart + 1),
+            Vec.zeros(alloc, restart + 1),
+            Vec.zeros(alloc, restart + 1),
+            Vec.zeros(alloc, n),
+            Vec.zeros(alloc, n),
+            Vec.zeros(alloc, n)
+        }
+    end
+
+    return gmres
+end)
+
+--[=[
+    BiCGStab with right preconditioning, see Algorithm 7.7 in
+    Y. Saad, Iterative Methods for Sparse Linear Systems, SIAM, 2003
+--]=]
+local BiCGStabFactory = parametrized.type(function(T)
+    assert(concepts.Float(T), "BiCGStab requires a floating point type")
+    local Vec = darray.DynamicVector(T)
+    local Vector = concepts.Vector(T)
+    local stats = Stats(T)
+
+    local struct bicgstab {
+        tol: T
+        maxiter: int64
+        r: Vec
+        rhat: Vec
+        p: Vec
+        v: Vec
+        s: Vec
+        phat: Vec
+        shat: Vec
+        t: Vec
+        -- Input of the preconditioner
+        u: Vec
+    }
+    function bicgstab.metamethods.__typename(self)
+        return ("BiCGStab(%s)"):format(tostring(T))
+    end
+    base.AbstractBase(bicgstab)
+
+    terraform bicgstab:solve(A: &M, P: &Pre, b: &V1, x: &V2)
+        where {M, Pre, V1: Vector, V2: Vector}
+        var n = self.r:size()
+        err.assert(b:size() == n and x:size() == n)
+        var r, rhat, p, v = &self.r, &self.rhat, &self.p, &self.v
+        var s, phat, shat, t, u = &self.s, &self.phat, &self.shat, &self.t, &self.u
+        matvec(A, x, r)
+        r:scal([T](-1))
+        r:axpy([T](1), b)
+        rhat:copy(r)
+        p:fill([T](0))
+        v:fill([T](0))
+        var rho: T = 1
+        var alpha: T = 1
+        var omega: T = 1
+        var bnorm = b:norm()
+        bnorm = terralib.select(bnorm > 0, bnorm, [T](1))
+        var res = stats {0, r:norm() / bnorm, false}
+        while res.residual > self.tol and res.iterations < self.maxiter do
+            var rhonew = rhat:dot(r)
+            -- Breakdown, the shadow residual is orthogonal to the residual
+            if rhonew == 0 then
+                break
+            end
+            var beta = (rhonew / rho) * (alpha / omega)
+            -- p = r + beta (p - omega v)
+            p:axpy(-omega, v)
+            p:scal(beta)
+            p:axpy([T](1), r)
+            precondition(P, p, u, phat)
+            matvec(A, phat, v)
+            alpha = rhonew / rhat:dot(v)
+            s:copy(r)
+            s:axpy(-alpha, v)
+            res.iterations = res.iterations + 1
+            if s:norm() / bnorm <= self.tol then
+                x:axpy(alpha, phat)
+                r:copy(s)
+                res.residual = r:norm() / bnorm
+                break
+            end
+            precondition(P, s, u, shat)
+            matvec(A, shat, t)
+            omega = t:dot(s) / t:dot(t)
+            x:axpy(alpha, phat)
+            x:axpy(omega, shat)
+            r:copy(s)
+            r:axpy(-omega, t)
+            rho = rhonew
+            res.residual = r:norm() / bnorm
+        end
+        res.converged = res.residual <= self.tol
+        return res
+    end
+
+    terraform bicgstab:solve(A: &M, b: &V1, x: &V2)
+        where {M, V1: Vector, V2: Vector}
+        var id: Identity(T)
+        return self:solve(A, &id, b, x)
+    end
+
+    bicgstab.staticmethods.new = terra(
+        alloc: Alloc, n: size_t, tol: T, maxiter: int64
+    )
+        return bicgstab {
+            tol,
+            maxiter,
+            Vec.zeros(alloc, n),
+            Vec.zeros(alloc, n),
+            Vec.zeros(alloc, n),
+            Vec.zeros(alloc, n),
+            Vec.zeros(alloc, n),
+            Vec.zeros(alloc, n),
+            Vec.zeros(alloc, n),
+            Vec.zeros(alloc, n),
+            Vec.zeros(alloc, n)
+        }
+    end
+
+    return bicgstab
+end)
+
+return {
+    Identity = Identity,
+    Stats = Stats,
+    CGFactory = CGFactory,
+    GMRESFactory = GMRESFactory,
+    BiCGStabFactory = BiCGStabFactory,
+}
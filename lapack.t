@@ -30,7 +30,12 @@ else
     error("Not implemented for this OS.")
 end
 
+local alloc = require("alloc")
+local base = require("base")
 local complex = require("complex")
+local concepts = require("concepts")
+local parametrized = require("parametrized")
+local tmath = require("tmath")
 
 local complexFloat = complex.complex(float)
 local complexDouble = complex.complex(double)
@@ -82,6 +87,14 @@ local lapack = {
     -- solve
     {"getrs", default_lapack(C, "getrs")},
 
+    --
+    -- Banded LU
+    --
+    -- decomposition
+    {"gbtrf", default_lapack(C, "gbtrf")},
+    -- solve
+    {"gbtrs", default_lapack(C, "gbtrs")},
+
     --
     -- Cholesky
     --
@@ -145,6 +158,21 @@ local lapack = {
     --
     -- decomposition
     {"ggsvd", default_lapack(C, "ggsvd")},
+
+    --
+    -- Variants with user provided work space. A call with lwork = -1 returns
+    -- the optimal size of the work space in work[0]. Row major layouts still
+    -- allocate a transposed copy of the matrix inside LAPACKE, so only
+    -- COL_MAJOR calls are free of allocations.
+    --
+    {"syev_work", default_lapack(C, "syev_work", "heev_work")},
+    {"geev_work", default_lapack(C, "geev_work")},
+    {"sygv_work", default_lapack(C, "sygv_work", "hegv_work")},
+    {"geqrf_work", default_lapack(C, "geqrf_work")},
+    {"ormqr_work", default_lapack(C, "ormqr_work", "unmqr_work")},
+    {"sytrf_work", default_lapack(C, "sytrf_work")},
+    {"geqp3_work", default_lapack(C, "geqp3_work")},
+    {"gesvd_work", default_lapack(C, "gesvd_work")},
 }
 
 
@@ -159,4 +187,174 @@ for _, func in pairs(lapack) do
     end
 end
 
+--[=[
+    Work space for the LAPACKE_*_work routines with buffers taken from an
+    allocator. The buffers only grow, so repeated calls with matrices of the
+    same size allocate only on the first call. The methods have the same
+    arguments as the high-level routines, query the optimal work space size
+    and call the _work variant.
+--]=]
+S.Workspace = parametrized.type(function(T)
+    local Tr = concepts.Complex(T) and T.traits.eltype or T
+    local SmartT = alloc.SmartBlock(T)
+    local SmartTr = alloc.SmartBlock(Tr)
+
+    local struct workspace {
+        work: SmartT
+        lwork: int64
+        -- Real work space of the complex routines
+        rwork: SmartTr
+        lrwork: int64
+    }
+    function workspace.metamethods.__typename(self)
+        return ("Workspace(%s)"):format(tostring(T))
+    end
+    base.AbstractBase(workspace)
+
+    -- Make sure that work and rwork have at least lwork and lrwork entries
+    terra workspace:reserve(lwork: int64, lrwork: int64)
+        if lwork > self.lwork then
+            self.work:reallocate(lwork)
+            self.lwork = lwork
+        end
+        if lrwork > self.lrwork then
+            self.rwork:reallocate(lrwork)
+            self.lrwork = lrwork
+        end
+    end
+
+    -- The optimal size is returned in the real part of the first entry.
+    local querysize = macro(function(query)
+        return `[int64](tmath.real(query))
+    end)
+
+    local iscomplex = concepts.Complex(T)
+
+    terra workspace:syev(
+        layout: int32, jobz: int8, uplo: int8, n: int32, a: &T, lda: int32,
+        w: &Tr
+    )
+        var query: T
+        escape
+            if iscomplex then
+                emit quote
+                    self:reserve(0, terralib.select(3 * n - 2 > 1, 3 * n - 2, 1))
+                    S.syev_work(
+                        layout, jobz, uplo, n, a, lda, w, &query, -1,
+                        &self.rwork(0)
+                    )
+                    self:reserve(querysize(query), 0)
+                    return S.syev_work(
+                        layout, jobz, uplo, n, a, lda, w, &self.work(0),
+                        self.lwork, &self.rwork(0)
+                    )
+                end
+            else
+                emit quote
+                    S.syev_work(layout, jobz, uplo, n, a, lda, w, &query, -1)
+                    self:reserve(querysize(query), 0)
+                    return S.syev_work(
+                        layout, jobz, uplo, n, a, lda, w, &self.work(0),
+                        self.lwork
+                    )
+                end
+            end
+        end
+    end
+
+    terra workspace:gesvd(
+        layout: int32, jobu: int8, jobvt: int8, m: int32, n: int32, a: &T,
+        lda: int32, s: &Tr, u: &T, ldu: int32, vt: &T, ldvt: int32,
+        superb: &Tr
+    )
+        var query: T
+        escape
+            if iscomplex then
+                emit quote
+                    var mn = terralib.select(m < n, m, n)
+                    self:reserve(0, 5 * mn)
+                    S.gesvd_work(
+                        layout, jobu, jobvt, m, n, a, lda, s, u, ldu, vt, ldvt,
+                        &query, -1, &self.rwork(0)
+                    )
+                    self:reserve(querysize(query), 0)
+                    var info = S.gesvd_work(
+                        layout, jobu, jobvt, m, n, a, lda, s, u, ldu, vt, ldvt,
+                        &self.work(0), self.lwork, &self.rwork(0)
+                    )
+                    -- Unconverged superdiagonals, as returned by LAPACKE_gesvd
+                    for i = 0, mn - 1 do
+                        superb[i] = self.rwork(i)
+                    end
+                    return info
+                end
+            else
+                emit quote
+                    var mn = terralib.select(m < n, m, n)
+                    S.gesvd_work(
+                        layout, jobu, jobvt, m, n, a, lda, s, u, ldu, vt, ldvt,
+                        &query, -1
+                    )
+                    self:reserve(querysize(query), 0)
+                    var info = S.gesvd_work(
+                        layout, jobu, jobvt, m, n, a, lda, s, u, ldu, vt, ldvt,
+                        &self.work(0), self.lwork
+                    )
+                    for i = 0, mn - 1 do
+                        superb[i] = self.work(i + 1)
+                    end
+                    return info
+                end
+            end
+        end
+    end
+
+    if iscomplex then
+        terra workspace:geev(
+            layout: int32, jobvl: int8, jobvr: int8, n: int32, a: &T,
+            lda: int32, w: &T, vl: &T, ldvl: int32, vr: &T, ldvr: int32
+        )
+            var query: T
+            self:reserve(0, 2 * n)
+            S.geev_work(
+                layout, jobvl, jobvr, n, a, lda, w, vl, ldvl, vr, ldvr,
+                &query, -1, &self.rwork(0)
+            )
+            self:reserve(querysize(query), 0)
+            return S.geev_work(
+                layout, jobvl, jobvr, n, a, lda, w, vl, ldvl, vr, ldvr,
+                &self.work(0), self.lwork, &self.rwork(0)
+            )
+        end
+    else
+        terra workspace:geev(
+            layout: int32, jobvl: int8, jobvr: int8, n: int32, a: &T,
+            lda: int32, wr: &T, wi: &T, vl: &T, ldvl: int32, vr: &T,
+            ldvr: int32
+        )
+            var query: T
+            S.geev_work(
+                layout, jobvl, jobvr, n, a, lda, wr, wi, vl, ldvl, vr, ldvr,
+                &query, -1
+            )
+            self:reserve(querysize(query), 0)
+            return S.geev_work(
+                layout, jobvl, jobvr, n, a, lda, wr, wi, vl, ldvl, vr, ldvr,
+                &self.work(0), self.lwork
+            )
+        end
+    end
+
+    workspace.staticmethods.new = terra(A: alloc.Allocator)
+        var ws: workspace
+        ws.work = A:new(sizeof(T), 1)
+        ws.lwork = 1
+        ws.rwork = A:new(sizeof(Tr), 1)
+        ws.lrwork = 1
+        return ws
+    end
+
+    return workspace
+end)
+
 return S
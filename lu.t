@@ -7,11 +7,17 @@
 
 import "terraform"
 
+local alloc = require("alloc")
 local base = require("base")
+local blas = require("blas")
 local err = require("assert")
 local concepts = require("concepts")
+local darray = require("darray")
+local lambda = require("lambda")
+local thread = require("thread")
 local tmath = require("tmath")
 local lapack = require("lapack")
+local matrix = require("matrix")
 local parametrized = require("parametrized")
 
 local Matrix = concepts.Matrix
@@ -19,13 +25,15 @@ local Vector = concepts.Vector
 local Number = concepts.Number
 local Integer = concepts.Integer
 
-terraform factorize(a : &M, p : &P, tol : T)
-    where {M : Matrix(Number), P : Vector(Integer), T : Number}
-    var n = a:size(0)
-    for i = 0, n do
-        p:set(i, i)
-    end
-    for i = 0, n do
+-- Block size of the blocked factorization for non-BLAS types
+local LU_BLOCK = 64
+
+-- Unblocked factorization of the panel of columns k0, ..., k1 - 1 and rows
+-- k0, ..., n - 1. Rows are swapped in full, so p is a permutation of the
+-- whole matrix.
+local terraform panel(a: &M, p: &P, tol: T, k0: int64, k1: int64) where {M, P, T}
+    var n: int64 = a:size(0)
+    for i = k0, k1 do
         var maxA = [tol.type](0)
         var imax = i
         for k = i, n do
@@ -53,7 +61,7 @@ terraform factorize(a : &M, p : &P, tol : T)
         for j = i + 1, n do
             a:set(j, i, a:get(j, i) / a:get(i, i))
 
-            for k = i + 1, n do
+            for k = i + 1, k1 do
                 var tmp = a:get(j, k)
                 a:set(j, k, tmp - a:get(j, i) * a:get(i, k))
             end
@@ -61,6 +69,75 @@ terraform factorize(a : &M, p : &P, tol : T)
     end
 end
 
+-- A(k0:k1, c0:c1) = L(k0:k1, k0:k1)^-1 A(k0:k1, c0:c1) for the unit lower
+-- triangular diagonal block L of the panel
+local terraform trsmblock(a: &M, k0: int64, k1: int64, c0: int64, c1: int64)
+    where {M}
+    for i = k0, k1 do
+        for k = k0, i do
+            var lik = a:get(i, k)
+            for j = c0, c1 do
+                a:set(i, j, a:get(i, j) - lik * a:get(k, j))
+            end
+        end
+    end
+end
+
+--[=[
+    Right-looking blocked LU factorization with partial pivoting. For each
+    panel of LU_BLOCK columns the panel is factorized with the unblocked
+    algorithm, then the block row of U to its right is computed by a
+    triangular solve and finally the trailing matrix is updated with the
+    packed gemm kernel of matrix.t. The triangular solves and the row blocks
+    of the update are independent and run on a thread pool. The result is
+    identical to the unblocked algorithm up to rounding.
+--]=]
+terraform factorize(a : &M, p : &P, tol : T)
+    where {M : Matrix(Number), P : Vector(Integer), T : Number}
+    var n: int64 = a:size(0)
+    for i = 0, n do
+        p:set(i, i)
+    end
+    if n <= LU_BLOCK then
+        panel(a, p, tol, 0, n)
+        return
+    end
+    var allocator: alloc.DefaultAllocator()
+    var pool = thread.threadpool.new(&allocator, thread.omp_get_num_threads())
+    for k0: int64 = 0, n, LU_BLOCK do
+        var k1 = terralib.select(k0 + LU_BLOCK < n, k0 + LU_BLOCK, n)
+        panel(a, p, tol, k0, k1)
+        var nb = (n - k1 + LU_BLOCK - 1) / LU_BLOCK
+        for c = 0, nb do
+            pool:submit(
+                &allocator,
+                lambda.new(
+                    [
+                        terra(c: int64, a: a.type, k0: int64, k1: int64, n: int64)
+                            var c0 = k1 + c * LU_BLOCK
+                            var c1 = terralib.select(c0 + LU_BLOCK < n, c0 + LU_BLOCK, n)
+                            trsmblock(a, k0, k1, c0, c1)
+                        end
+                    ],
+                    {a = a, k0 = k0, k1 = k1, n = n}
+                ),
+                c
+            )
+        end
+        pool:barrier()
+        -- A(k1:n, k1:n) -= A(k1:n, k0:k1) A(k0:k1, k1:n). The three blocks
+        -- are disjoint, so the kernel can read and write a at once.
+        if k1 < n then
+            [matrix.packedgemm(M.traits.eltype, M, M, M)](
+                [M.traits.eltype](-1), a, k1, k0,
+                a, k0, k1,
+                [M.traits.eltype](1), a, k1, k1,
+                n - k1, n - k1, k1 - k0, &pool
+            )
+        end
+    end
+end
+
 local BLASMatrix = concepts.BLASMatrix
 local ContiguousVector = concepts.ContiguousVector
 local BLASNumber = concepts.BLASNumber
@@ -167,6 +244,131 @@ terraform solve(trans: B, a: &M, p: &P, x: &V)
     )
 end
 
+-- Number of right-hand sides that are processed together by the generic
+-- multi-RHS solve. The rows of such a block stay in cache during the
+-- triangular solves.
+local NRHS_BLOCK = 64
+
+local terraform swaprows(x: &X, i: int64, j: int64, c0: int64, c1: int64)
+    where {X}
+    for c = c0, c1 do
+        var tmp = x:get(i, c)
+        x:set(i, c, x:get(j, c))
+        x:set(j, c, tmp)
+    end
+end
+
+--[=[
+    Solve with all columns of x as right-hand sides. The columns are
+    processed in blocks of NRHS_BLOCK, and each entry of the factors is
+    loaded once per block instead of once per right-hand side.
+--]=]
+terraform matsolve(trans: B, a: &M, p: &P, x: &X)
+    where {B: Bool, M: Matrix(Number), P: Vector(Integer), X: Matrix(Number)}
+    var n: int64 = a:size(0)
+    var nrhs: int64 = x:size(1)
+    err.assert(x:size(0) == n)
+    for c0: int64 = 0, nrhs, NRHS_BLOCK do
+        var c1 = terralib.select(c0 + NRHS_BLOCK < nrhs, c0 + NRHS_BLOCK, nrhs)
+        if not trans then
+            for i: int64 = 0, n do
+                var idx: int64 = p:get(i)
+                while idx < i do
+                    idx = p:get(idx)
+                end
+                swaprows(x, i, idx, c0, c1)
+            end
+
+            for i = 0, n do
+                for k = 0, i do
+                    var aik = a:get(i, k)
+                    for c = c0, c1 do
+                        x:set(i, c, x:get(i, c) - aik * x:get(k, c))
+                    end
+                end
+            end
+
+            for ii = 0, n do
+                var i = n - 1 - ii
+                for k = i + 1, n do
+                    var aik = a:get(i, k)
+                    for c = c0, c1 do
+                        x:set(i, c, x:get(i, c) - aik * x:get(k, c))
+                    end
+                end
+                var aii = a:get(i, i)
+                for c = c0, c1 do
+                    x:set(i, c, x:get(i, c) / aii)
+                end
+            end
+        else
+            for i = 0, n do
+                for k = 0, i do
+                    var aki = conj(a:get(k, i))
+                    for c = c0, c1 do
+                        x:set(i, c, x:get(i, c) - aki * x:get(k, c))
+                    end
+                end
+                var aii = conj(a:get(i, i))
+                for c = c0, c1 do
+                    x:set(i, c, x:get(i, c) / aii)
+                end
+            end
+
+            for ii = 0, n do
+                var i = n - 1 - ii
+                for k = i + 1, n do
+                    var aki = conj(a:get(k, i))
+                    for c = c0, c1 do
+                        x:set(i, c, x:get(i, c) - aki * x:get(k, c))
+                    end
+                end
+            end
+
+            for ii: int64 = 0, n do
+                var i = n - 1 - ii
+                var idx: int64 = p:get(i)
+                while idx < i do
+                    idx = p:get(idx)
+                end
+                swaprows(x, i, idx, c0, c1)
+            end
+        end
+    end
+end
+
+terraform matsolve(trans: B, a: &M, p: &P, x: &X)
+    where {
+        B: Bool,
+        M: BLASMatrix(BLASNumber),
+        P: ContiguousVector(int32),
+        X: BLASMatrix(BLASNumber)
+    }
+    var n, m, adata, lda = a:getblasdenseinfo()
+    err.assert(n == m)
+    var np, pdata = p:getbuffer()
+    err.assert(n == np)
+    var nx, nrhs, xdata, ldx = x:getblasdenseinfo()
+    err.assert(n == nx)
+    var lapack_trans: rawstring
+    if trans then
+        lapack_trans = [get_trans(M.traits.eltype)]
+    else
+        lapack_trans = "N"
+    end
+    lapack.getrs(
+        lapack.ROW_MAJOR,
+        @lapack_trans,
+        n,
+        nrhs,
+        adata,
+        lda,
+        pdata,
+        xdata,
+        ldx
+    )
+end
+
 local LUFactory = parametrized.type(function(M, P)
 
     local T = M.traits.eltype
@@ -174,6 +376,7 @@ local LUFactory = parametrized.type(function(M, P)
     local VectorInteger = concepts.Vector(Integer)
     local Matrix = concepts.Matrix(T)
     local Factorization = concepts.Factorization(T)
+    local DMat = darray.DynamicMatrix(T)
 
     assert(Matrix(M), "Type " .. tostring(M)
                               .. " does not implement the matrix interface")
@@ -210,6 +413,11 @@ local LUFactory = parametrized.type(function(M, P)
         solve(trans, self.a, self.p, x)
     end
 
+    -- Solve for all columns of x in a single call
+    terraform lu:solve(trans: B, x: &DMat) where {B: Bool}
+        matsolve(trans, self.a, self.p, x)
+    end
+
     terraform lu:apply(trans: B, a: T, x: &V1, b: T, y: &V2)
         where {B: Bool, V1: Vector, V2: Vector}
         self:solve(trans, x)
@@ -228,6 +436,230 @@ local LUFactory = parametrized.type(function(M, P)
     return lu
 end)
 
+-- Maximal number of refinement steps before the mixed-precision solver
+-- falls back to a double precision factorization, see LAPACK dsgesv.
+local MIXED_ITERMAX = 30
+
+--[=[
+    LU factorization of a double precision matrix that factorizes a single
+    precision copy with sgetrf and refines the solution with residuals
+    computed in double precision, as LAPACK dsgesv does. The single
+    precision factorization runs at about twice the speed. If the copy
+    cannot be factorized or the refinement stalls, a is factorized in
+    double precision and all further solves use dgetrs. In contrast to
+    dsgesv the factors are kept, so one factorization serves many solves.
+--]=]
+local MixedLUFactory = parametrized.type(function(M, P)
+
+    local T = M.traits.eltype
+    local Vector = concepts.Vector(T)
+    local Factorization = concepts.Factorization(T)
+    local SmartFloat = alloc.SmartBlock(float)
+    local SmartDouble = alloc.SmartBlock(double)
+
+    assert(T == double, "Mixed-precision LU requires double precision, got "
+                              .. tostring(T))
+    assert(BLASMatrix(T)(M), "Type " .. tostring(M)
+                              .. " does not implement the BLAS matrix interface")
+    assert(ContiguousVector(int32)(P), "Type " .. tostring(P)
+                              .. " is not a contiguous vector of int32")
+
+    local struct lu{
+        a: &M
+        p: &P
+        -- Single precision copy of a, overwritten by its factors
+        af: SmartFloat
+        -- Infinity norm and one-norm of a. The latter is the infinity norm
+        -- of a^T and bounds the residual of transposed solves.
+        anrm: double
+        anrm1: double
+        -- Work space for the refinement
+        xd: SmartDouble
+        rd: SmartDouble
+        bd: SmartDouble
+        rs: SmartFloat
+        -- a was factorized in double precision
+        fallback: bool
+        -- Refinement steps of the last solve, -1 if the double precision
+        -- factors were used
+        iter: int32
+    }
+    function lu.metamethods.__typename(self)
+        return ("MixedLUFactorization(%s)"):format(tostring(T))
+    end
+    base.AbstractBase(lu)
+
+    terra lu:rows()
+        return self.a:size(0)
+    end
+
+    terra lu:cols()
+        return self.a:size(1)
+    end
+
+    terra lu:dfactorize()
+        var n, m, adata, lda = self.a:getblasdenseinfo()
+        var np, pdata = self.p:getbuffer()
+        var info = lapack.getrf(lapack.ROW_MAJOR, n, n, adata, lda, pdata)
+        err.assert(info == 0)
+        self.fallback = true
+    end
+
+    terra lu:factorize()
+        var n, m, adata, lda = self.a:getblasdenseinfo()
+        var np, pdata = self.p:getbuffer()
+        self.fallback = false
+        self.anrm = 0
+        self.anrm1 = 0
+        -- Column sums, accumulated in the work space of the refinement
+        var colsum = &self.rd(0)
+        for j = 0, n do
+            colsum[j] = 0
+        end
+        -- Entries that overflow in single precision, see LAPACK dlag2s
+        var overflow = false
+        for i = 0, n do
+            var rowsum = 0.0
+            for j = 0, n do
+                var aij = adata[i * lda + j]
+                rowsum = rowsum + tmath.abs(aij)
+                colsum[j] = colsum[j] + tmath.abs(aij)
+                overflow = overflow or tmath.abs(aij) > 3.4028234663852886e38
+                self.af(i * n + j) = aij
+            end
+            self.anrm = terralib.select(rowsum > self.anrm, rowsum, self.anrm)
+        end
+        for j = 0, n do
+            self.anrm1 = terralib.select(colsum[j] > self.anrm1, colsum[j], self.anrm1)
+        end
+        if overflow then
+            self:dfactorize()
+            return
+        end
+        var info = lapack.getrf(lapack.ROW_MAJOR, n, n, &self.af(0), n, pdata)
+        if info ~= 0 then
+            self:dfactorize()
+        end
+    end
+
+    -- In place solve for v with the single precision factors
+    terra lu:ssolve(trans: bool, v: &double)
+        var n = self.a:size(0)
+        var np, pdata = self.p:getbuffer()
+        for i = 0, n do
+            self.rs(i) = v[i]
+        end
+        var lapack_trans: rawstring = terralib.select(trans, "T", "N")
+        lapack.getrs(
+            lapack.ROW_MAJOR, @lapack_trans, n, 1, &self.af(0), n, pdata, &self.rs(0), 1
+        )
+        for i = 0, n do
+            v[i] = self.rs(i)
+        end
+    end
+
+    -- In place solve for v with the double precision factors
+    terra lu:dsolve(trans: bool, v: &double)
+        var n, m, adata, lda = self.a:getblasdenseinfo()
+        var np, pdata = self.p:getbuffer()
+        var lapack_trans: rawstring = terralib.select(trans, "T", "N")
+        lapack.getrs(lapack.ROW_MAJOR, @lapack_trans, n, 1, adata, lda, pdata, v, 1)
+    end
+
+    terra lu:refine(trans: bool)
+        var n, m, adata, lda = self.a:getblasdenseinfo()
+        var x = &self.xd(0)
+        var r = &self.rd(0)
+        var b = &self.bd(0)
+        -- Stopping criterion of dsgesv with the infinity norm of op(a)
+        var opnrm = terralib.select(trans, self.anrm1, self.anrm)
+        var cte = opnrm * [double:eps()] * tmath.sqrt([double](n))
+        for i = 0, n do
+            x[i] = b[i]
+        end
+        self:ssolve(trans, x)
+        for iter = 0, MIXED_ITERMAX do
+            -- r = b - op(a) x in double precision
+            for i = 0, n do
+                r[i] = b[i]
+            end
+            blas.gemv(
+                blas.RowMajor,
+                terralib.select(trans, blas.Trans, blas.NoTrans),
+                n, n, -1.0, adata, lda, x, 1, 1.0, r, 1
+            )
+            var xnrm = 0.0
+            var rnrm = 0.0
+            for i = 0, n do
+                xnrm = terralib.select(tmath.abs(x[i]) > xnrm, tmath.abs(x[i]), xnrm)
+                rnrm = terralib.select(tmath.abs(r[i]) > rnrm, tmath.abs(r[i]), rnrm)
+            end
+            if rnrm <= xnrm * cte then
+                self.iter = iter
+                return true
+            end
+            self:ssolve(trans, r)
+            for i = 0, n do
+                x[i] = x[i] + r[i]
+            end
+        end
+        return false
+    end
+
+    terraform lu:solve(trans: B, x: &V) where {B: Bool, V: Vector}
+        var n = self.a:size(0)
+        err.assert(x:length() == n)
+        for i = 0, n do
+            self.bd(i) = x:get(i)
+        end
+        if self.fallback or not self:refine(trans) then
+            if not self.fallback then
+                self:dfactorize()
+            end
+            self:dsolve(trans, &self.bd(0))
+            self.iter = -1
+            for i = 0, n do
+                x:set(i, self.bd(i))
+            end
+        else
+            for i = 0, n do
+                x:set(i, self.xd(i))
+            end
+        end
+    end
+
+    terraform lu:apply(trans: B, a: T, x: &V1, b: T, y: &V2)
+        where {B: Bool, V1: Vector, V2: Vector}
+        self:solve(trans, x)
+        y:scal(b)
+        y:axpy(a, x)
+    end
+
+    assert(Factorization(lu))
+
+    lu.staticmethods.new = terra(A: alloc.Allocator, a: &M, p: &P)
+        var n = a:size(0)
+        err.assert(n == a:size(1))
+        err.assert(p:length() == n)
+        var f: lu
+        f.a = a
+        f.p = p
+        f.af = A:new(sizeof(float), n * n)
+        f.xd = A:new(sizeof(double), n)
+        f.rd = A:new(sizeof(double), n)
+        f.bd = A:new(sizeof(double), n)
+        f.rs = A:new(sizeof(float), n)
+        f.anrm = 0
+        f.anrm1 = 0
+        f.fallback = false
+        f.iter = 0
+        return f
+    end
+
+    return lu
+end)
+
 return {
     LUFactory = LUFactory,
+    MixedLUFactory = MixedLUFactory,
 }
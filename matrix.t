@@ -7,9 +7,12 @@
 
 import "terraform"
 
+local alloc = require("alloc")
 local concepts = require("concepts")
 local blas = require("blas")
 local err = require("assert")
+local lambda = require("lambda")
+local thread = require("thread")
 local vecblas = require("vector_blas")
 
 local Integer = concepts.Integer
@@ -215,12 +218,233 @@ terraform gemv(alpha : T, A : &M, x : &V1, beta : T, y : &V2)
 end
 
 
---gemm - naive falback implementation
+-- Cache blocking of the packed gemm in number of entries. A packed block of
+-- A of size GEMM_MC x GEMM_KC is reused for all micro-tiles of a block of B
+-- with GEMM_KC x GEMM_NC entries.
+local GEMM_MC = 64
+local GEMM_KC = 256
+local GEMM_NC = 1024
+-- Products with fewer multiplications use the naive loop.
+local GEMM_SMALL = 32 * 32 * 32
+-- Products with fewer multiplications run the packed kernel serially, as
+-- starting a thread pool costs about as much as the product itself.
+local GEMM_PARALLEL = 128 * 128 * 128
+
+local Pool = alloc.SmartObject(thread.threadpool)
+
+-- Size MR x NR of the register tile of the micro-kernel. Element types
+-- larger than a complex double (nested dual numbers, FixedFloat) do not fit
+-- into registers, so the tile only reduces the number of loads.
+local function registertile(T)
+    if terralib.sizeof(T) <= 16 then
+        return 4, 4
+    else
+        return 2, 2
+    end
+end
+
+-- c = a b for a packed MR x kc panel a and a packed kc x NR panel b. The
+-- MR * NR accumulators are unrolled at compile time.
+local microkernel = terralib.memoize(function(T, MR, NR)
+    local kc, a, b, c = symbol(int64), symbol(&T), symbol(&T), symbol(&T)
+    local p = symbol(int64)
+    local ai, bj, acc = {}, {}, {}
+    for i = 0, MR - 1 do
+        ai[i] = symbol(T)
+        acc[i] = {}
+        for j = 0, NR - 1 do
+            acc[i][j] = symbol(T)
+        end
+    end
+    for j = 0, NR - 1 do
+        bj[j] = symbol(T)
+    end
+    local init, update, store = terralib.newlist(), terralib.newlist(), terralib.newlist()
+    for i = 0, MR - 1 do
+        update:insert(quote var [ai[i]] = [a][[p] * MR + i] end)
+    end
+    for j = 0, NR - 1 do
+        update:insert(quote var [bj[j]] = [b][[p] * NR + j] end)
+    end
+    for i = 0, MR - 1 do
+        for j = 0, NR - 1 do
+            init:insert(quote var [acc[i][j]] = [T](0) end)
+            update:insert(quote [acc[i][j]] = [acc[i][j]] + [ai[i]] * [bj[j]] end)
+            store:insert(quote [c][i * NR + j] = [acc[i][j]] end)
+        end
+    end
+    local kernel = terra([kc], [a], [b], [c])
+        [init]
+        for [p] = 0, [kc] do
+            [update]
+        end
+        [store]
+    end
+    kernel:setinlined(true)
+    return kernel
+end)
+
+--[=[
+    Packed, cache-blocked gemm in the style of GotoBLAS for element types
+    without BLAS support. It computes
+
+        C(ic:ic+m, jc:jc+n) = beta C(ic:ic+m, jc:jc+n)
+                              + alpha A(ia:ia+m, ja:ja+k) B(ib:ib+k, jb:jb+n),
+
+    so it also updates blocks of a matrix, for instance the trailing matrix
+    of a blocked factorization. For each block of GEMM_KC x GEMM_NC entries
+    of B, the block is packed into panels of NR columns. The rows of C are
+    split into blocks of GEMM_MC rows. Each block packs its rows of alpha A
+    into panels of MR rows and updates C tile by tile with the
+    register-blocked micro-kernel. The blocks run on the pool if one is
+    given and serially if pool is nil.
+--]=]
+local packedgemm = terralib.memoize(function(T, M1, M2, M3)
+    local S = M3.traits.eltype or T
+    local MR, NR = registertile(S)
+    local kernel = microkernel(S, MR, NR)
+    local SmartS = alloc.SmartBlock(S)
+
+    local terra packa(
+        A: &M1, ap: &S, alpha: T, ia: int64, ja: int64, mc: int64, kc: int64
+    )
+        for ip = 0, (mc + MR - 1) / MR do
+            for p = 0, kc do
+                for i = 0, MR do
+                    var r = ip * MR + i
+                    if r < mc then
+                        ap[(ip * kc + p) * MR + i] = alpha * A:get(ia + r, ja + p)
+                    else
+                        ap[(ip * kc + p) * MR + i] = [S](0)
+                    end
+                end
+            end
+        end
+    end
+
+    local terra packb(B: &M2, bp: &S, ib: int64, jb: int64, nc: int64, kc: int64)
+        for jp = 0, (nc + NR - 1) / NR do
+            for p = 0, kc do
+                for j = 0, NR do
+                    var s = jp * NR + j
+                    if s < nc then
+                        bp[(jp * kc + p) * NR + j] = B:get(ib + p, jb + s)
+                    else
+                        bp[(jp * kc + p) * NR + j] = [S](0)
+                    end
+                end
+            end
+        end
+    end
+
+    -- Rows blk * GEMM_MC, ... of C(ic:ic+m, jc:jc+nc) = beta C
+    -- + alpha A(ia:ia+m, ja:ja+kc) B, with B packed in bp
+    local terra block(
+        blk: int64,
+        A: &M1,
+        C: &M3,
+        ap: &S,
+        bp: &S,
+        alpha: T,
+        beta: T,
+        ia: int64,
+        ja: int64,
+        ic: int64,
+        jc: int64,
+        m: int64,
+        nc: int64,
+        kc: int64
+    )
+        var r0 = blk * GEMM_MC
+        var mc = terralib.select(r0 + GEMM_MC < m, [int64](GEMM_MC), m - r0)
+        var a = ap + blk * GEMM_MC * GEMM_KC
+        packa(A, a, alpha, ia + r0, ja, mc, kc)
+        var c: S[MR * NR]
+        for jp = 0, (nc + NR - 1) / NR do
+            for ip = 0, (mc + MR - 1) / MR do
+                kernel(kc, a + ip * kc * MR, bp + jp * kc * NR, &c[0])
+                for i = 0, MR do
+                    var r = ic + r0 + ip * MR + i
+                    if ip * MR + i < mc then
+                        for j = 0, NR do
+                            var s = jp * NR + j
+                            if s < nc then
+                                var cij = C:get(r, jc + s)
+                                C:set(r, jc + s, beta * cij + c[i * NR + j])
+                            end
+                        end
+                    end
+                end
+            end
+        end
+    end
+
+    return terra(
+        alpha: T, A: &M1, ia: int64, ja: int64,
+        B: &M2, ib: int64, jb: int64,
+        beta: T, C: &M3, ic: int64, jc: int64,
+        m: int64, n: int64, k: int64, pool: &Pool
+    )
+        var allocator: alloc.DefaultAllocator()
+        var nblocks = (m + GEMM_MC - 1) / GEMM_MC
+        var ap: SmartS = allocator:new(sizeof(S), nblocks * GEMM_MC * GEMM_KC)
+        var bp: SmartS = allocator:new(sizeof(S), GEMM_KC * (GEMM_NC + NR))
+        for jp: int64 = 0, n, GEMM_NC do
+            var nc = terralib.select(jp + GEMM_NC < n, [int64](GEMM_NC), n - jp)
+            for pc: int64 = 0, k, GEMM_KC do
+                var kc = terralib.select(pc + GEMM_KC < k, [int64](GEMM_KC), k - pc)
+                packb(B, &bp(0), ib + pc, jb + jp, nc, kc)
+                -- C is scaled by beta only once
+                var b = terralib.select(pc == 0, beta, [T](1))
+                if pool == nil then
+                    for blk: int64 = 0, nblocks do
+                        block(
+                            blk, A, C, &ap(0), &bp(0), alpha, b,
+                            ia, ja + pc, ic, jc + jp, m, nc, kc
+                        )
+                    end
+                else
+                    for blk: int64 = 0, nblocks do
+                        pool:submit(
+                            &allocator,
+                            lambda.new(
+                                block,
+                                {
+                                    A = A, C = C, ap = &ap(0), bp = &bp(0),
+                                    alpha = alpha, beta = b, ia = ia,
+                                    ja = ja + pc, ic = ic, jc = jc + jp,
+                                    m = m, nc = nc, kc = kc
+                                }
+                            ),
+                            blk
+                        )
+                    end
+                    -- The next block of B is packed into the same buffer
+                    pool:barrier()
+                end
+            end
+        end
+    end
+end)
+
+--gemm - fallback implementation
 --C[i,j] = alpha * A[i,k] * B[k,j] + beta * C[i,j]
 local terraform gemm(alpha : T, A : &M1, B : &M2, beta : T, C : &M3)
         where {T : Number, M1 : Matrix(Number), M2 : Matrix(Number), M3 : Matrix(Number)}
     err.assert(A:cols() == B:rows(), "ArgumentError: matrix dimensions in C = alpha*C + beta * A * B are not consistent.")
     err.assert(C:rows() == A:rows() and C:cols() == B:cols(), "ArgumentError: matrix dimensions in C = alpha*C + beta * A * B are not consistent.")
+    var m: int64 = C:rows()
+    var n: int64 = C:cols()
+    var k: int64 = A:cols()
+    if m * n * k >= GEMM_PARALLEL then
+        var allocator: alloc.DefaultAllocator()
+        var pool = thread.threadpool.new(&allocator, thread.omp_get_num_threads())
+        [packedgemm(T, M1, M2, M3)](alpha, A, 0, 0, B, 0, 0, beta, C, 0, 0, m, n, k, &pool)
+        return
+    elseif m * n * k >= GEMM_SMALL then
+        [packedgemm(T, M1, M2, M3)](alpha, A, 0, 0, B, 0, 0, beta, C, 0, 0, m, n, k, nil)
+        return
+    end
     for i = 0, C:rows() do
         for j = 0, C:cols() do
             var sum = beta * C:get(i, j)
@@ -300,5 +524,6 @@ end
 return {
     MatrixBase = MatrixBase,
     gemv = gemv,
-    gemm = gemm
+    gemm = gemm,
+    packedgemm = packedgemm,
 }
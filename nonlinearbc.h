@@ -4,4 +4,6 @@
 #include <stdbool.h>
 void halfspace(double *, double, double *, double, int32_t, int32_t, int32_t *, int32_t *, double, double *, double, double *, bool, double *);
 void massflowbc(int32_t, int32_t, int32_t, int32_t, double *, double *, int32_t, int32_t, double *, int32_t, double *, int32_t *, int32_t *, int32_t, double *, int32_t *, int32_t *, double, double *, double, int32_t *, int32_t *, double *, double *, double);
-void pressurebc(int32_t, int32_t, int32_t, int32_t, double *, double *, int32_t, int32_t, double *, int32_t, double *, int32_t *, int32_t *, int32_t, double *, int32_t *, int32_t *, double, double *, double, int32_t *, int32_t *, double *, double *, double);
\ No newline at end of file
+void massflowbc8(int32_t, int32_t, int32_t, int32_t, double *, double *, int32_t, int32_t, double *, int32_t, double *, int32_t *, int32_t *, int32_t, double *, int32_t *, int32_t *, double, double *, double, int32_t *, int32_t *, double *, double *, double);
+void pressurebc(int32_t, int32_t, int32_t, int32_t, double *, double *, int32_t, int32_t, double *, int32_t, double *, int32_t *, int32_t *, int32_t, double *, int32_t *, int32_t *, double, double *, double, int32_t *, int32_t *, double *, double *, double);
+void pressurebc8(int32_t, int32_t, int32_t, int32_t, double *, double *, int32_t, int32_t, double *, int32_t, double *, int32_t *, int32_t *, int32_t, double *, int32_t *, int32_t *, double, double *, double, int32_t *, int32_t *, double *, double *, double);
\ No newline at end of file
@@ -82,6 +82,34 @@ local SparsePackedFactory = parametrized.type(function(T, I, M, K)
     return sparse_packed
 end)
 
+-- Non-owning view of a sparse packed tile with the same layout as
+-- SparsePacked. The data is owned by a persistent packed representation of
+-- the full matrix. If the tile has less than K nonempty columns, the list of
+-- columns is terminated by a zero entry in nnz.
+local SparsePackedViewFactory = parametrized.type(function(T, I, M, K)
+    local struct sparse_packed_view {
+        Ap: &T
+        loc: &I
+        col: &I
+        nnz: &I
+    }
+    function sparse_packed_view.metamethods.__typename(Self)
+        return (
+            (
+                "SparsePackedView(%s, %s, %d, %d)"
+            ):format(tostring(T), tostring(I), M, K)
+        )
+    end
+    base.AbstractBase(sparse_packed_view)
+    sparse_packed_view.traits.eltype = T
+    sparse_packed_view.traits.issparse = true
+    sparse_packed_view.traits.Rows = M
+    sparse_packed_view.traits.Cols = K
+
+    assert(concepts.SparsePacked(T)(sparse_packed_view))
+    return sparse_packed_view
+end)
+
 local DensePackedFactory = parametrized.type(function(T, M, K)
     local struct dense_packed {
         A: T[M * K]
@@ -142,5 +170,6 @@ end)
 
 return {
     SparsePackedFactory = SparsePackedFactory,
+    SparsePackedViewFactory = SparsePackedViewFactory,
     DensePackedFactory = DensePackedFactory,
 }
@@ -7,9 +7,13 @@
 
 import "terraform"
 
+local alloc = require("alloc")
 local base = require("base")
 local err = require("assert")
 local concepts = require("concepts")
+local darray = require("darray")
+local lambda = require("lambda")
+local thread = require("thread")
 local tmath = require("tmath")
 local lapack = require("lapack")
 local parametrized = require("parametrized")
@@ -24,9 +28,11 @@ local BLASVector = concepts.BLASVector
 local BLASMatrix = concepts.BLASMatrix
 local ContiguousVector = concepts.ContiguousVector
 
-terraform factorize(a: &M, u: &U) where {M: Matrix(Number), U: Vector(Number)}
-    var n = a:size(1)
-    for j = 0, n do
+-- Unblocked Householder QR of the columns j0, ..., j1 - 1 of the square
+-- matrix a. Only the columns of the panel are updated.
+local terraform panel(a: &M, u: &U, j0: int64, j1: int64) where {M, U}
+    var n: int64 = a:size(1)
+    for j = j0, j1 do
         -- Compute the norm of column j.
         -- First, we compute the square and then take the square root.
         var musqr = [M.traits.eltype](0)
@@ -53,8 +59,9 @@ terraform factorize(a: &M, u: &U) where {M: Matrix(Number), U: Vector(Number)}
             a:set(k, j, a:get(k, j) / beta)
         end
         u:set(j, -lambda * mu)
-        -- Apply the Householder reflection to the remaining columns
-        for l = j + 1, n do
+        -- Apply the Householder reflection to the remaining columns of the
+        -- panel
+        for l = j + 1, j1 do
             var dot = [M.traits.eltype](0)
             for k = j, n do
                 dot = dot + tmath.conj(a:get(k, j)) * a:get(k, l)
@@ -66,6 +73,100 @@ terraform factorize(a: &M, u: &U) where {M: Matrix(Number), U: Vector(Number)}
     end
 end
 
+-- Block size of the blocked QR factorization for non-BLAS types
+local QR_BLOCK = 32
+
+--[=[
+    Blocked Householder QR factorization. The reflections
+    H_j = I - 2 u_j u_j^H of a panel of QR_BLOCK columns are accumulated in
+    compact WY form,
+
+        H_j0 ... H_j1-1 = I - V T V^H,
+
+    with the Householder vectors as columns of V and an upper triangular
+    matrix T. The trailing matrix A2 is then updated at once with the
+    matrix-matrix products A2 = A2 - V T^H (V^H A2). The result is identical
+    to the unblocked algorithm up to rounding.
+--]=]
+terraform factorize(a: &M, u: &U) where {M: Matrix(Number), U: Vector(Number)}
+    var n: int64 = a:size(1)
+    if n <= QR_BLOCK then
+        panel(a, u, [int64](0), n)
+        return
+    end
+    var allocator: alloc.DefaultAllocator()
+    var t: alloc.SmartBlock(M.traits.eltype) = allocator:new(
+        sizeof(M.traits.eltype), QR_BLOCK * QR_BLOCK
+    )
+    var w: alloc.SmartBlock(M.traits.eltype) = allocator:new(
+        sizeof(M.traits.eltype), QR_BLOCK * n
+    )
+    for j0: int64 = 0, n, QR_BLOCK do
+        var j1 = terralib.select(j0 + QR_BLOCK < n, j0 + QR_BLOCK, n)
+        var nb = j1 - j0
+        panel(a, u, j0, j1)
+        if j1 == n then
+            break
+        end
+        -- T(i, i) = 2 and T(0:i, i) = -2 T(0:i, 0:i) V(:, 0:i)^H v_i
+        for i = 0, nb do
+            for q = 0, i do
+                var dot = [M.traits.eltype](0)
+                for r = j0 + i, n do
+                    dot = dot + tmath.conj(a:get(r, j0 + q)) * a:get(r, j0 + i)
+                end
+                w(q) = dot
+            end
+            for q = 0, i do
+                var sum = [M.traits.eltype](0)
+                for l = q, i do
+                    sum = sum + t(q * QR_BLOCK + l) * w(l)
+                end
+                t(q * QR_BLOCK + i) = -2 * sum
+            end
+            t(i * QR_BLOCK + i) = 2
+        end
+        -- W = V^H A2
+        var m = n - j1
+        for l = 0, nb * m do
+            w(l) = 0
+        end
+        for r = j0, n do
+            var last = terralib.select(r - j0 + 1 < nb, r - j0 + 1, nb)
+            for p = 0, last do
+                var vrp = tmath.conj(a:get(r, j0 + p))
+                for c = 0, m do
+                    w(p * m + c) = w(p * m + c) + vrp * a:get(r, j1 + c)
+                end
+            end
+        end
+        -- W = T^H W, T^H is lower triangular
+        for pp = 0, nb do
+            var p = nb - 1 - pp
+            var tpp = tmath.conj(t(p * QR_BLOCK + p))
+            for c = 0, m do
+                w(p * m + c) = tpp * w(p * m + c)
+            end
+            for q = 0, p do
+                var tqp = tmath.conj(t(q * QR_BLOCK + p))
+                for c = 0, m do
+                    w(p * m + c) = w(p * m + c) + tqp * w(q * m + c)
+                end
+            end
+        end
+        -- A2 = A2 - V W
+        for r = j0, n do
+            var last = terralib.select(r - j0 + 1 < nb, r - j0 + 1, nb)
+            for p = 0, last do
+                var vrp = a:get(r, j0 + p)
+                for c = 0, m do
+                    a:set(r, j1 + c, a:get(r, j1 + c) - vrp * w(p * m + c))
+                end
+            end
+        end
+    end
+end
+
 terraform factorize(a: &M, u: &U) where {M: BLASMatrix(BLASNumber), U: ContiguousVector(BLASNumber)}
     var n, m, adata, lda = a:getblasdenseinfo()
     err.assert(n == m)
@@ -147,12 +248,111 @@ terraform solve(trans: B, a: &M, u: &U, x: &V)
     end
 end
 
+-- Number of right-hand sides that are processed together by the generic
+-- multi-RHS solve
+local NRHS_BLOCK = 64
+
+-- Apply the i-th Householder reflection to the columns c0, ..., c1 - 1 of x
+local terraform blockhouseholder(a: &M, x: &X, i: int64, c0: int64, c1: int64)
+    where {M, X}
+    var n: int64 = a:size(0)
+    for c = c0, c1 do
+        var dot = [M.traits.eltype](0)
+        for k = i, n do
+            dot = dot + tmath.conj(a:get(k, i)) * x:get(k, c)
+        end
+        for k = i, n do
+            x:set(k, c, x:get(k, c) - 2 * dot * a:get(k, i))
+        end
+    end
+end
+
+--[=[
+    Solve with all columns of x as right-hand sides. The columns are
+    processed in blocks of NRHS_BLOCK, and the entries of R are loaded once
+    per block instead of once per right-hand side.
+--]=]
+terraform matsolve(trans: B, a: &M, u: &U, x: &X)
+    where {B: Bool, M: Matrix(Number), U: Vector(Number), X: Matrix(Number)}
+    var n: int64 = a:size(0)
+    var nrhs: int64 = x:size(1)
+    err.assert(x:size(0) == n)
+    for c0: int64 = 0, nrhs, NRHS_BLOCK do
+        var c1 = terralib.select(c0 + NRHS_BLOCK < nrhs, c0 + NRHS_BLOCK, nrhs)
+        if trans then
+            for i = 0, n do
+                for j = 0, i do
+                    var aji = tmath.conj(a:get(j, i))
+                    for c = c0, c1 do
+                        x:set(i, c, x:get(i, c) - aji * x:get(j, c))
+                    end
+                end
+                var ui = tmath.conj(u:get(i))
+                for c = c0, c1 do
+                    x:set(i, c, x:get(i, c) / ui)
+                end
+            end
+
+            for ii: int64 = 0, n do
+                var i = n - 1 - ii
+                blockhouseholder(a, x, i, c0, c1)
+            end
+        else
+            for i: int64 = 0, n do
+                blockhouseholder(a, x, i, c0, c1)
+            end
+
+            for ii = 0, n do
+                var i = n - 1 - ii
+                for j = i + 1, n do
+                    var aij = a:get(i, j)
+                    for c = c0, c1 do
+                        x:set(i, c, x:get(i, c) - aij * x:get(j, c))
+                    end
+                end
+                var ui = u:get(i)
+                for c = c0, c1 do
+                    x:set(i, c, x:get(i, c) / ui)
+                end
+            end
+        end
+    end
+end
+
+terraform matsolve(trans: B, a: &M, u: &U, x: &X)
+    where {
+        B: Bool,
+        M: BLASMatrix(BLASNumber),
+        U: ContiguousVector(BLASNumber),
+        X: BLASMatrix(BLASNumber)
+    }
+    var n, m, adata, lda = a:getblasdenseinfo()
+    err.assert(n == m)
+    var nu, udata = u:getbuffer()
+    err.assert(n == nu)
+    var nx, nrhs, xdata, ldx = x:getblasdenseinfo()
+    err.assert(n == nx)
+    var lapack_trans = [get_trans(M.traits.eltype)]
+    if trans then
+        lapack.trtrs(lapack.ROW_MAJOR, @"U", @lapack_trans, @"N", n, nrhs,
+                     adata, lda, xdata, ldx)
+        lapack.ormqr(lapack.ROW_MAJOR, @"L", @"N", n, nrhs, n,
+                     adata, lda, udata, xdata, ldx)
+    else
+        lapack.ormqr(lapack.ROW_MAJOR, @"L", @lapack_trans, n, nrhs, n,
+                     adata, lda, udata, xdata, ldx)
+        lapack.trtrs(lapack.ROW_MAJOR, @"U", @"N", @"N", n, nrhs,
+                     adata, lda, xdata, ldx)
+    end
+end
+
 local QRFactory = parametrized.type(function(M, U)
 
     local T = M.traits.eltype
     local Vector = concepts.Vector(T)
     local Matrix = concepts.Matrix(T)
     local Factorization = concepts.Factorization(T)
+    local DMat = darray.DynamicMatrix(T)
     assert(Matrix(M), "Type " .. tostring(M)
                               .. " does not implement the matrix interface")
     assert(Vector(U), "Type " .. tostring(U)
@@ -186,6 +386,11 @@ local QRFactory = parametrized.type(function(M, U)
         return solve(trans, self.a, self.u, x)
     end
 
+    -- Solve for all columns of x in a single call
+    terraform qr:solve(trans: B, x: &DMat) where {B: Bool}
+        return matsolve(trans, self.a, self.u, x)
+    end
+
     terraform qr:apply(trans: B, a: T, x: &V1, b: T, y: &V2)
         where {B: Bool, V1: Vector(T), V2: Vector(T)}
         self:solve(trans, x)
@@ -204,6 +409,310 @@ local QRFactory = parametrized.type(function(M, U)
     return qr
 end)
 
+-- Householder QR of the row major rows x n matrix v with rows >= n. As in
+-- panel, the Householder vectors are stored in the lower trapezoid of v and
+-- the diagonal of R in u.
+local hqr = terralib.memoize(function(T)
+    return terra(v: &T, rows: int64, n: int64, u: &T)
+        for j = 0, n do
+            var musqr = [T](0)
+            for k = j, rows do
+                musqr = musqr + v[k * n + j] * tmath.conj(v[k * n + j])
+            end
+            var mu = tmath.sqrt(tmath.real(musqr))
+            var diag = tmath.abs(v[j * n + j])
+            -- Any phase works for a zero leading entry
+            var lambda = [T](1)
+            if diag ~= 0 then
+                lambda = v[j * n + j] / diag
+            end
+            var beta = tmath.sqrt(2 * mu * (mu + diag))
+            v[j * n + j] = lambda * (diag + mu) / beta
+            for k = j + 1, rows do
+                v[k * n + j] = v[k * n + j] / beta
+            end
+            u[j] = -lambda * mu
+            for l = j + 1, n do
+                var dot = [T](0)
+                for k = j, rows do
+                    dot = dot + tmath.conj(v[k * n + j]) * v[k * n + l]
+                end
+                for k = j, rows do
+                    v[k * n + l] = v[k * n + l] - 2 * dot * v[k * n + j]
+                end
+            end
+        end
+    end
+end)
+
+-- Apply the reflections of hqr in order to the vector b of length rows,
+-- that is b = Q^H b.
+local hqrapply = terralib.memoize(function(T)
+    return terra(v: &T, rows: int64, n: int64, b: &T)
+        for j = 0, n do
+            var dot = [T](0)
+            for k = j, rows do
+                dot = dot + tmath.conj(v[k * n + j]) * b[k]
+            end
+            for k = j, rows do
+                b[k] = b[k] - 2 * dot * v[k * n + j]
+            end
+        end
+    end
+end)
+
+--[=[
+    Communication-avoiding QR factorization of a tall and skinny m x n
+    matrix (TSQR). The rows are split into one block per thread. The blocks
+    are factorized in parallel, and their R factors are combined pairwise
+    in a binary reduction tree, where each node factorizes the stacked
+    2n x n matrix of two R factors. Q is kept implicitly as the Householder
+    vectors of the leaves and the tree nodes. Each leaf reads its rows
+    once, so the factorization is not limited by the memory bandwidth of a
+    single core. BLAS types factorize the leaves with LAPACK geqrf. The
+    thread pool is created once with the factorization and reused.
+--]=]
+local TSQR = parametrized.type(function(M)
+
+    local T = M.traits.eltype
+    local Vector = concepts.Vector(T)
+    local Matrix = concepts.Matrix(T)
+    local SmartT = alloc.SmartBlock(T)
+    local SmartI = alloc.SmartBlock(int64)
+    local Pool = alloc.SmartObject(thread.threadpool)
+    local factor = hqr(T)
+    local reflect = hqrapply(T)
+    assert(Matrix(M), "Type " .. tostring(M)
+                              .. " does not implement the matrix interface")
+
+    local struct tsqr {
+        a: &M
+        m: int64
+        n: int64
+        nblocks: int64
+        -- First row of each block
+        blkptr: SmartI
+        -- Householder vectors and diagonal of R of the blocks. For BLAS
+        -- types qu holds the scalar factors of the reflectors of geqrf.
+        q: SmartT
+        qu: SmartT
+        -- Stacked R factors of the tree nodes. The node that combines
+        -- block i with block j > i is stored at position j.
+        node: SmartT
+        nodeu: SmartT
+        -- Current R factor of each block
+        r: SmartT
+        work: SmartT
+        pool: Pool
+    }
+    function tsqr.metamethods.__typename(self)
+        return ("TSQR(%s)"):format(tostring(M))
+    end
+    base.AbstractBase(tsqr)
+
+    terra tsqr:rows()
+        return self.m
+    end
+
+    terra tsqr:cols()
+        return self.n
+    end
+
+    -- Entry (i, j) of the R factor
+    terra tsqr:getr(i: int64, j: int64)
+        err.assert(i < self.n and j < self.n)
+        return self.r(i * self.n + j)
+    end
+
+    local leaf = terra(b: int64, self: &tsqr)
+        var n = self.n
+        var r0 = self.blkptr(b)
+        var rows = self.blkptr(b + 1) - r0
+        var v = &self.q(r0 * n)
+        var u = &self.qu(b * n)
+        for i = 0, rows do
+            for j = 0, n do
+                v[i * n + j] = self.a:get(r0 + i, j)
+            end
+        end
+        var r = &self.r(b * n * n)
+        escape
+            if BLASNumber(T) then
+                emit quote
+                    var info = lapack.geqrf(lapack.ROW_MAJOR, rows, n, v, n, u)
+                    err.assert(info == 0)
+                    for i = 0, n do
+                        for j = 0, n do
+                            r[i * n + j] = terralib.select(j < i, [T](0), v[i * n + j])
+                        end
+                    end
+                end
+            else
+                emit quote
+                    factor(v, rows, n, u)
+                    for i = 0, n do
+                        for j = 0, n do
+                            r[i * n + j] = terralib.select(
+                                j < i, [T](0), terralib.select(j == i, u[i], v[i * n + j])
+                            )
+                        end
+                    end
+                end
+            end
+        end
+    end
+
+    -- Combine the R factors of block i and block j
+    local combine = terra(i: int64, self: &tsqr, j: int64)
+        var n = self.n
+        var s = &self.node(j * 2 * n * n)
+        var u = &self.nodeu(j * n)
+        var ri = &self.r(i * n * n)
+        var rj = &self.r(j * n * n)
+        for k = 0, n * n do
+            s[k] = ri[k]
+            s[n * n + k] = rj[k]
+        end
+        factor(s, 2 * n, n, u)
+        for k = 0, n do
+            for l = 0, n do
+                ri[k * n + l] = terralib.select(
+                    l < k, [T](0), terralib.select(l == k, u[k], s[k * n + l])
+                )
+            end
+        end
+    end
+
+    terra tsqr:factorize()
+        var allocator: alloc.DefaultAllocator()
+        for b = 0, self.nblocks do
+            self.pool:submit(&allocator, lambda.new(leaf, {self = self}), b)
+        end
+        self.pool:barrier()
+        var h: int64 = 1
+        while h < self.nblocks do
+            for i: int64 = 0, self.nblocks - h, 2 * h do
+                self.pool:submit(
+                    &allocator, lambda.new(combine, {self = self, j = i + h}), i
+                )
+            end
+            self.pool:barrier()
+            h = 2 * h
+        end
+    end
+
+    local leafapply = terra(b: int64, self: &tsqr)
+        var n = self.n
+        var r0 = self.blkptr(b)
+        var rows = self.blkptr(b + 1) - r0
+        escape
+            if BLASNumber(T) then
+                emit quote
+                    var trans = [get_trans(T)]
+                    lapack.ormqr(
+                        lapack.ROW_MAJOR, @"L", @trans, rows, 1, n,
+                        &self.q(r0 * n), n, &self.qu(b * n), &self.work(r0), 1
+                    )
+                end
+            else
+                emit quote reflect(&self.q(r0 * n), rows, n, &self.work(r0)) end
+            end
+        end
+    end
+
+    local combineapply = terra(i: int64, self: &tsqr, j: int64, c: &T)
+        var n = self.n
+        var ci = &self.work(self.blkptr(i))
+        var cj = &self.work(self.blkptr(j))
+        for k = 0, n do
+            c[k] = ci[k]
+            c[n + k] = cj[k]
+        end
+        reflect(&self.node(j * 2 * n * n), 2 * n, n, c)
+        for k = 0, n do
+            ci[k] = c[k]
+            cj[k] = c[n + k]
+        end
+    end
+
+    -- b = Q^H b. The first n entries of the result are the coordinates of b
+    -- in the range of the matrix, and the norm of the remaining entries is
+    -- the norm of the least squares residual.
+    terraform tsqr:qhmul(b: &V) where {V: Vector}
+        err.assert(b:length() == self.m)
+        var n = self.n
+        for k = 0, self.m do
+            self.work(k) = b:get(k)
+        end
+        var allocator: alloc.DefaultAllocator()
+        for blk = 0, self.nblocks do
+            self.pool:submit(&allocator, lambda.new(leafapply, {self = self}), blk)
+        end
+        self.pool:barrier()
+        -- Scratch space for the stacked vectors of the tree nodes
+        var c: SmartT = allocator:new(sizeof(T), 2 * n * self.nblocks)
+        var h: int64 = 1
+        while h < self.nblocks do
+            for i: int64 = 0, self.nblocks - h, 2 * h do
+                self.pool:submit(
+                    &allocator,
+                    lambda.new(
+                        combineapply, {self = self, j = i + h, c = &c(2 * n * i)}
+                    ),
+                    i
+                )
+            end
+            self.pool:barrier()
+            h = 2 * h
+        end
+        for k = 0, self.m do
+            b:set(k, self.work(k))
+        end
+    end
+
+    -- Least squares solution x of min |a x - b|. On return b holds Q^H b.
+    terraform tsqr:solve(b: &V1, x: &V2) where {V1: Vector, V2: Vector}
+        err.assert(x:length() == self.n)
+        self:qhmul(b)
+        var n = self.n
+        for ii = 0, n do
+            var i = n - 1 - ii
+            var xi = b:get(i)
+            for j = i + 1, n do
+                xi = xi - self:getr(i, j) * x:get(j)
+            end
+            x:set(i, xi / self:getr(i, i))
+        end
+    end
+
+    tsqr.staticmethods.new = terra(A: alloc.Allocator, a: &M)
+        var f: tsqr
+        f.a = a
+        f.m = a:size(0)
+        f.n = a:size(1)
+        err.assert(f.m >= f.n and f.n > 0)
+        -- Every block needs at least n rows.
+        var maxblocks = f.m / f.n
+        var nthreads: int64 = thread.omp_get_num_threads()
+        f.nblocks = terralib.select(nthreads < maxblocks, nthreads, maxblocks)
+        f.blkptr = A:new(sizeof(int64), f.nblocks + 1)
+        for b = 0, f.nblocks + 1 do
+            f.blkptr(b) = (b * f.m) / f.nblocks
+        end
+        f.q = A:new(sizeof(T), f.m * f.n)
+        f.qu = A:new(sizeof(T), f.nblocks * f.n)
+        f.node = A:new(sizeof(T), 2 * f.nblocks * f.n * f.n)
+        f.nodeu = A:new(sizeof(T), f.nblocks * f.n)
+        f.r = A:new(sizeof(T), f.nblocks * f.n * f.n)
+        f.work = A:new(sizeof(T), f.m)
+        f.pool = thread.threadpool.new(A, f.nblocks)
+        return f
+    end
+
+    return tsqr
+end)
+
 return {
     QRFactory = QRFactory,
+    TSQR = TSQR,
 }
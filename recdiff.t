@@ -8,7 +8,7 @@
 local concepts = require("concepts")
 local sarray = require("sarray")
 local darray = require("darray")
-local qr = require("qr")
+local banded = require("banded")
 local range = require("range")
 
 import "terraform"
@@ -31,9 +31,12 @@ local terraform olver(alloc, rec: &R, yn: &V)
     var nmax = yn:length()
     var n0 = y0:length()
     var dim: int64 = nmax - n0
-    var sys = [darray.DynamicMatrix(R.traits.eltype)].zeros(alloc, {dim, dim})
+    -- Each row of the system couples depth consecutive unknowns, so the
+    -- system matrix is banded.
+    var kl: int64 = [R.traits.depth] / 2
+    var ku: int64 = [R.traits.depth] - 1 - kl
+    var sys = [banded.BandedMatrix(R.traits.eltype)].new(alloc, dim, kl, ku)
     var rhs = [darray.DynamicVector(R.traits.eltype)].zeros(alloc, dim)
-    var hrf = [darray.DynamicVector(R.traits.eltype)].zeros(alloc, dim)
     var y = [sarray.StaticVector(R.traits.eltype, R.traits.depth + 1)].zeros()
     for i = 0, dim do
         var n = n0 + i
@@ -41,7 +44,7 @@ local terraform olver(alloc, rec: &R, yn: &V)
         for offset = 0, [R.traits.depth] do
             var j = i + offset - [R.traits.depth] / 2
             if j >= 0 and j < dim then
-                sys(i, j) = y:get(offset)
+                sys:set(i, j, y:get(offset))
             end
         end
         rhs:set(i, y:get([R.traits.depth]))
@@ -55,9 +58,9 @@ local terraform olver(alloc, rec: &R, yn: &V)
         end
         rhs:set(i, r)
     end
-    var qr = [qr.QRFactory(sys.type, rhs.type)].new(&sys, &hrf)
-    qr:factorize()
-    qr:solve(false, &rhs)
+    var lu = [banded.BandedLUFactory(R.traits.eltype)].new(alloc, &sys)
+    lu:factorize()
+    lu:solve(false, &rhs)
     for i = 0, n0 do
         yn:set(i, y0:get(i))
     end
@@ -0,0 +1,425 @@
+-- SPDX-FileCopyrightText: 2024 René Hiemstra <rrhiemstar@gmail.com>
+-- SPDX-FileCopyrightText: 2024 Torsten Keßler <t.kessler@posteo.de>
+-- SPDX-FileCopyrightText: 2025 René Hiemstra <rrhiemstar@gmail.com>
+-- SPDX-FileCopyrightText: 2025 Torsten Keßler <t.kessler@posteo.de>
+--
+-- SPDX-License-Identifier: MIT
+
+local alloc = require("alloc")
+local base = require("base")
+local concepts = require("concepts")
+local darray = require("darray")
+local err = require("assert")
+local lambda = require("lambda")
+local range = require("range")
+local sparse = require("sparse")
+local stack = require("stack")
+local thread = require("thread")
+local parametrized = require("parametrized")
+
+import "terraform"
+
+local C = terralib.includec("stdlib.h")
+
+--[=[
+    Permutations are stored as arrays perm of length n that map the new
+    index to the old index, that is row k of the reordered matrix is row
+    perm[k] of the original matrix.
+--]=]
+
+-- y[k] = x[perm[k]]
+local terraform permute(perm: &I, x: &V1, y: &V2)
+    where {
+        I: concepts.Integer,
+        V1: concepts.Vector(concepts.Number),
+        V2: concepts.Vector(concepts.Number)
+    }
+    for k = 0, y:size() do
+        y:set(k, x:get(perm[k]))
+    end
+end
+
+-- y[perm[k]] = x[k], the inverse of permute
+local terraform unpermute(perm: &I, x: &V1, y: &V2)
+    where {
+        I: concepts.Integer,
+        V1: concepts.Vector(concepts.Number),
+        V2: concepts.Vector(concepts.Number)
+    }
+    for k = 0, x:size() do
+        y:set(perm[k], x:get(k))
+    end
+end
+
+local Reorder = parametrized.type(function(T, I)
+    local CSR = sparse.CSRMatrix(T, I)
+    local Mat = darray.DynamicMatrix(T)
+    local ST = stack.DynamicStack(T)
+    local SI = stack.DynamicStack(I)
+    local SmartI = alloc.SmartBlock(I)
+    local SmartInt = alloc.SmartBlock(int64)
+    local SmartBool = alloc.SmartBlock(bool)
+    local Alloc = alloc.Allocator
+
+    local struct reorder {}
+    reorder.metamethods.__typename = function(self)
+        return ("Reorder(%s, %s)"):format(tostring(T), tostring(I))
+    end
+    base.AbstractBase(reorder)
+
+    -- Maximal distance of a nonzero entry to the diagonal
+    reorder.staticmethods.bandwidth = terra(a: &CSR)
+        var bw: int64 = 0
+        for i = 0, a.rows do
+            for idx = a.rowptr(i), a.rowptr(i + 1) do
+                var d = [int64](a.col(idx)) - [int64](i)
+                d = terralib.select(d < 0, -d, d)
+                bw = terralib.select(d > bw, d, bw)
+            end
+        end
+        return bw
+    end
+
+    --
+    -- Reverse Cuthill-McKee
+    --
+    -- E. Cuthill and J. McKee, Reducing the bandwidth of sparse symmetric
+    -- matrices, Proceedings of the 24th National Conference ACM, 1969.
+    -- The start node of each connected component is a pseudo-peripheral node
+    -- computed with the algorithm of Gibbs, Poole and Stockmeyer.
+    --
+
+    -- Breadth first search from root. Nodes with nonnegative level are
+    -- skipped. Returns the number of nodes reached and the depth of the
+    -- level structure. The nodes are stored in queue in the order they
+    -- are visited.
+    local terra bfs(adjptr: &I, adj: &I, root: I, level: &int64, queue: &I)
+        var head: int64 = 0
+        var tail: int64 = 1
+        var depth: int64 = 0
+        queue[0] = root
+        level[root] = 0
+        while head < tail do
+            var i = queue[head]
+            head = head + 1
+            for idx = adjptr[i], adjptr[i + 1] do
+                var j = adj[idx]
+                if level[j] < 0 then
+                    level[j] = level[i] + 1
+                    depth = terralib.select(level[j] > depth, level[j], depth)
+                    queue[tail] = j
+                    tail = tail + 1
+                end
+            end
+        end
+        return tail, depth
+    end
+
+    local terra resetlevel(size: int64, level: &int64, queue: &I)
+        for k = 0, size do
+            level[queue[k]] = -1
+        end
+    end
+
+    local terra pseudoperipheral(
+        adjptr: &I, adj: &I, root: I, level: &int64, queue: &I
+    )
+        var size, depth = bfs(adjptr, adj, root, level, queue)
+        while true do
+            -- Node of minimal degree in the last level
+            var cand = root
+            var mindeg: I = 0
+            var found = false
+            for k = 0, size do
+                var j = queue[k]
+                var deg = adjptr[j + 1] - adjptr[j]
+                if level[j] == depth and (not found or deg < mindeg) then
+                    cand = j
+                    mindeg = deg
+                    found = true
+                end
+            end
+            resetlevel(size, level, queue)
+            var newsize, newdepth = bfs(adjptr, adj, cand, level, queue)
+            resetlevel(newsize, level, queue)
+            if newdepth <= depth then
+                break
+            end
+            root = cand
+            size, depth = bfs(adjptr, adj, root, level, queue)
+        end
+        return root
+    end
+
+    -- Symmetric adjacency structure of a + a^T without the diagonal.
+    -- Neighbors are sorted in increasing order.
+    local terra adjacency(A: Alloc, a: &CSR, adjptr: &SmartI, adj: &SmartI)
+        var n = a.rows
+        var nnz = a:nnz()
+        var tptr: SmartI = A:new(sizeof(I), n + 1)
+        for i = 0, n + 1 do
+            tptr(i) = 0
+        end
+        for idx = 0, nnz do
+            tptr(a.col(idx) + 1) = tptr(a.col(idx) + 1) + 1
+        end
+        for i = 0, n do
+            tptr(i + 1) = tptr(i + 1) + tptr(i)
+        end
+        var tcol: SmartI = A:new(sizeof(I), terralib.select(nnz > 0, nnz, 1))
+        var slot: SmartI = A:new(sizeof(I), n + 1)
+        for i = 0, n do
+            slot(i) = tptr(i)
+        end
+        for i = 0, n do
+            for idx = a.rowptr(i), a.rowptr(i + 1) do
+                var j = a.col(idx)
+                tcol(slot(j)) = i
+                slot(j) = slot(j) + 1
+            end
+        end
+        @adjptr = A:new(sizeof(I), n + 1)
+        @adj = A:new(sizeof(I), terralib.select(nnz > 0, 2 * nnz, 1))
+        var pos: I = 0
+        for i = 0, n do
+            (@adjptr)(i) = pos
+            var p = a.rowptr(i)
+            var q = tptr(i)
+            while p < a.rowptr(i + 1) or q < tptr(i + 1) do
+                var j: I
+                if q >= tptr(i + 1) or (p < a.rowptr(i + 1) and a.col(p) <= tcol(q)) then
+                    j = a.col(p)
+                    p = p + 1
+                else
+                    j = tcol(q)
+                    q = q + 1
+                end
+                if j ~= i and (pos == (@adjptr)(i) or (@adj)(pos - 1) ~= j) then
+                    (@adj)(pos) = j
+                    pos = pos + 1
+                end
+            end
+        end
+        (@adjptr)(n) = pos
+    end
+
+    -- Compute the reverse Cuthill-McKee ordering of a square matrix.
+    -- Unsymmetric matrices are ordered according to the structure of a + a^T.
+    reorder.staticmethods.rcm = terra(A: Alloc, a: &CSR)
+        err.assert(a.rows == a.cols)
+        var n = a.rows
+        var adjptr: SmartI
+        var adj: SmartI
+        adjacency(A, a, &adjptr, &adj)
+        var pa = &adjptr(0)
+        var pj = &adj(0)
+
+        var cap = terralib.select(n > 0, n, 1)
+        var perm: SmartI = A:new(sizeof(I), cap)
+        var queue: SmartI = A:new(sizeof(I), cap)
+        var level: SmartInt = A:new(sizeof(int64), cap)
+        var visited: SmartBool = A:new(sizeof(bool), cap)
+        for i = 0, n do
+            level(i) = -1
+            visited(i) = false
+        end
+
+        var count: I = 0
+        while count < n do
+            -- Start with the unvisited node of minimal degree
+            var root: I = 0
+            var mindeg: I = 0
+            var found = false
+            for i = 0, n do
+                var deg = pa[i + 1] - pa[i]
+                if not visited(i) and (not found or deg < mindeg) then
+                    root = i
+                    mindeg = deg
+                    found = true
+                end
+            end
+            root = pseudoperipheral(pa, pj, root, &level(0), &queue(0))
+
+            var head = count
+            perm(count) = root
+            visited(root) = true
+            count = count + 1
+            while head < count do
+                var i = perm(head)
+                head = head + 1
+                var first = count
+                for idx = pa[i], pa[i + 1] do
+                    var j = pj[idx]
+                    if not visited(j) then
+                        visited(j) = true
+                        perm(count) = j
+                        count = count + 1
+                    end
+                end
+                -- Neighbors are numbered in order of increasing degree
+                for k = first + 1, count do
+                    var j = perm(k)
+                    var deg = pa[j + 1] - pa[j]
+                    var l = k
+                    while l > first and pa[perm(l - 1) + 1] - pa[perm(l - 1)] > deg do
+                        perm(l) = perm(l - 1)
+                        l = l - 1
+                    end
+                    perm(l) = j
+                end
+            end
+        end
+
+        for k = 0, n / 2 do
+            var tmp = perm(k)
+            perm(k) = perm(n - 1 - k)
+            perm(n - 1 - k) = tmp
+        end
+        return perm
+    end
+
+    --
+    -- Morton (Z-order) ordering
+    --
+    -- Sorts points along a space filling curve so that points close in
+    -- space are close in memory. Useful for unstructured meshes where the
+    -- coordinates of the degrees of freedom are known.
+    --
+    local struct mortonkey {
+        key: uint64
+        idx: I
+    }
+
+    local terra compare_key(x: &opaque, y: &opaque): int
+        var a = [&mortonkey](x).key
+        var b = [&mortonkey](y).key
+        return terralib.select(a < b, -1, terralib.select(a > b, 1, 0))
+    end
+
+    -- Coordinates are given as the rows of x with 1 <= x:cols() <= 3.
+    reorder.staticmethods.morton = terra(A: Alloc, x: &Mat)
+        var n = x:rows()
+        var dim = x:cols()
+        err.assert(n > 0 and dim >= 1 and dim <= 3)
+        -- Number of bits per coordinate such that all fit into 64 bits
+        var bits = 63 / dim
+        var lo: double[3]
+        var hi: double[3]
+        for d = 0, dim do
+            lo[d] = [double](x(0, d))
+            hi[d] = lo[d]
+            for i = 1, n do
+                var v = [double](x(i, d))
+                lo[d] = terralib.select(v < lo[d], v, lo[d])
+                hi[d] = terralib.select(v > hi[d], v, hi[d])
+            end
+        end
+        var keys: alloc.SmartBlock(mortonkey) = A:new(sizeof(mortonkey), n)
+        var maxint = ([uint64](1) << bits) - 1
+        for i = 0, n do
+            var key: uint64 = 0
+            for d = 0, dim do
+                var w = hi[d] - lo[d]
+                var s = terralib.select(w > 0, ([double](x(i, d)) - lo[d]) / w, 0.0)
+                var q = [uint64](s * maxint)
+                for b = 0, bits do
+                    key = key or (((q >> b) and 1) << (dim * b + d))
+                end
+            end
+            keys(i).key = key
+            keys(i).idx = i
+        end
+        C.qsort(&keys(0), n, sizeof(mortonkey), compare_key)
+        var perm: SmartI = A:new(sizeof(I), n)
+        for k = 0, n do
+            perm(k) = keys(k).idx
+        end
+        return perm
+    end
+
+    --
+    -- Symmetric permutation
+    --
+    -- Rows are permuted in blocks, as a single row is too little work for
+    -- a task of the thread pool.
+    local PERMUTE_ROWBLOCK = 1024
+
+    local terra permute_row(k: I, a: &CSR, b: &CSR, perm: &I, iperm: &I)
+        var i = perm[k]
+        var first = b.rowptr(k)
+        var pos = first
+        for idx = a.rowptr(i), a.rowptr(i + 1) do
+            var j = iperm[a.col(idx)]
+            var x = a.data(idx)
+            -- Insertion sort of the new column indices
+            var l = pos
+            while l > first and b.col(l - 1) > j do
+                b.col(l) = b.col(l - 1)
+                b.data(l) = b.data(l - 1)
+                l = l - 1
+            end
+            b.col(l) = j
+            b.data(l) = x
+            pos = pos + 1
+        end
+    end
+
+    local terra permute_block(blk: I, a: &CSR, b: &CSR, perm: &I, iperm: &I)
+        var k0 = blk * PERMUTE_ROWBLOCK
+        var k1 = terralib.select(
+            k0 + PERMUTE_ROWBLOCK < b.rows, k0 + PERMUTE_ROWBLOCK, b.rows
+        )
+        for k = k0, k1 do
+            permute_row(k, a, b, perm, iperm)
+        end
+    end
+
+    -- Returns the matrix with entries b(k, l) = a(perm[k], perm[l]). Blocks
+    -- of rows are filled in parallel.
+    reorder.staticmethods.permute = terra(A: Alloc, a: &CSR, perm: &I)
+        err.assert(a.rows == a.cols)
+        var n = a.rows
+        var nnz = a:nnz()
+        var iperm: SmartI = A:new(sizeof(I), terralib.select(n > 0, n, 1))
+        for k = 0, n do
+            iperm(perm[k]) = k
+        end
+        var b: CSR
+        b.rows = n
+        b.cols = n
+        b.rowptr = SI.new(A, n + 1)
+        b.rowptr:push(0)
+        for k = 0, n do
+            var i = perm[k]
+            b.rowptr:push(b.rowptr(k) + a.rowptr(i + 1) - a.rowptr(i))
+        end
+        var cap = terralib.select(nnz > 0, nnz, 1)
+        b.data = ST.new(A, cap)
+        b.col = SI.new(A, cap)
+        for idx = 0, nnz do
+            b.data:push(0)
+            b.col:push(0)
+        end
+        var nblocks: I = (n + PERMUTE_ROWBLOCK - 1) / PERMUTE_ROWBLOCK
+        var rn = [range.Unitrange(I)].new(0, nblocks)
+        do
+            var allocator: alloc.DefaultAllocator()
+            thread.parfor(
+                &allocator,
+                rn,
+                lambda.new(
+                    permute_block, {a = a, b = &b, perm = perm, iperm = &iperm(0)}
+                )
+            )
+        end
+        return b
+    end
+
+    return reorder
+end)
+
+return {
+    Reorder = Reorder,
+    permute = permute,
+    unpermute = unpermute,
+}
@@ -65,7 +65,7 @@ local VectorFactory = parametrized.type(function(T, N)
         return vec {self.data - other.data}
     end
 
-    terra vec.metamethods.__ne(self: vec)
+    terra vec.metamethods.__unm(self: vec)
         return vec {-self.data}
     end
 
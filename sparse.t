@@ -11,6 +11,7 @@ local concepts = require("concepts")
 local err = require("assert")
 local base = require("base")
 local matrix = require("matrix")
+local darray = require("darray")
 local packed = require("packed")
 local simd = require("simd")
 local lambda = require("lambda")
@@ -18,9 +19,17 @@ local thread = require("thread")
 local range = require("range")
 local parametrized = require("parametrized")
 local timeit = require("timeit")
+local timing = require("timing")
 
 import "terraform"
 
+local C = terralib.includecstring[[
+    #include <stdio.h>
+    #include <stdlib.h>
+]]
+
+local Pool = alloc.SmartObject(thread.threadpool)
+
 local CSRMatrix = parametrized.type(function(T, I)
 
     local Integral = concepts.Integral
@@ -28,7 +37,7 @@ local CSRMatrix = parametrized.type(function(T, I)
     local Vector = concepts.Vector(T)
     local Matrix = concepts.Matrix(T)
 
-    I = I or int64
+    I = I or int32
     local ST = stack.DynamicStack(T)
     local SI = stack.DynamicStack(I)
     local struct csr {
@@ -37,6 +46,10 @@ local CSRMatrix = parametrized.type(function(T, I)
         data: ST
         col: SI
         rowptr: SI
+        -- SpMV kernel selected by tune, 0 for the default heuristic
+        kernel: int32
+        -- Thread pool of the threaded kernels, created by tune and loadkernel
+        pool: Pool
     }
     csr.metamethods.__typename = function(self)
         return ("CSRMatrix(%s, %s)"):format(tostring(T), tostring(I))
@@ -45,6 +58,14 @@ local CSRMatrix = parametrized.type(function(T, I)
     base.AbstractBase(csr)
     csr.traits.eltype = T
 
+    csr.methods.__init = terra(self: &csr)
+        self.data:__init()
+        self.col:__init()
+        self.rowptr:__init()
+        self.kernel = 0
+        self.pool:__init()
+    end
+
     terra csr:rows()
         return self.rows
     end
@@ -123,10 +144,50 @@ local CSRMatrix = parametrized.type(function(T, I)
 
     local Primitive = concepts.Primitive
     if Primitive(T) then
+        -- y(i) = alpha (A x)(i) + beta y(i) for rows r0, ..., r1 - 1.
         -- Inspired by the GPU implementation
         -- https://gpuopen.com/learn/amd-lab-notes/amd-lab-notes-spmv-docs-spmv_part1/
-        local VecApply = parametrized.type(function(N)
+        local VecRows = parametrized.type(function(N)
             local SIMD = simd.VectorFactory(T, N)
+            local terraform vecrows(
+                self: &csr,
+                r0: I,
+                r1: I,
+                alpha: T,
+                x: &V1,
+                beta: T,
+                y: &V2
+            ) where {V1: Vector, V2: Vector}
+                for i = r0, r1 do
+                    var first = self.rowptr(i)
+                    var last = self.rowptr(i + 1)
+                    var len = last - first
+                    var veclen = len - len % N
+                    var vecres: SIMD = [T](0)
+                    for idx = first, first + veclen, N do
+                        var avec: SIMD = &self.data(idx)
+                        var xvec: SIMD = (
+                            escape
+                                local arg = terralib.newlist()
+                                for j = 0, N - 1 do
+                                    arg:insert(`x:get(self.col(idx + j)))
+                                end
+                                emit `vectorof(T, [arg])
+                            end
+                        )
+                        vecres = vecres + avec * xvec
+                    end
+                    var res = vecres:hsum()
+                    for idx = first + veclen, first + len do
+                        res = res + self.data(idx) * x:get(self.col(idx))
+                    end
+                    y:set(i, beta * y:get(i) + alpha * res)
+                end
+            end
+            return vecrows
+        end)
+
+        local VecApply = parametrized.type(function(N)
             local terraform vecapply(
                 self: &csr,
                 trans: bool,
@@ -136,31 +197,7 @@ local CSRMatrix = parametrized.type(function(T, I)
                 y: &V2
             ) where {V1: Vector, V2: Vector}
                 if not trans then
-                    for i = 0, self.rows do
-                        var first = self.rowptr(i)
-                        var last = self.rowptr(i + 1)
-                        var len = last - first
-                        var veclen = len - len % N
-                        var vecres: SIMD = [T](0)
-                        for idx = first, first + veclen, N do
-                            var avec: SIMD = &self.data(idx)
-                            var xvec: SIMD = (
-                                escape
-                                    local arg = terralib.newlist()
-                                    for j = 0, N - 1 do
-                                        arg:insert(`x:get(self.col(idx + j)))
-                                    end
-                                    emit `vectorof(T, [arg])
-                                end
-                            )
-                            vecres = vecres + avec * xvec
-                        end
-                        var res = vecres:hsum()
-                        for idx = first + veclen, first + len do
-                            res = res + self.data(idx) * x:get(self.col(idx))
-                        end
-                        y:set(i, beta * y:get(i) + alpha * res)
-                    end
+                    [VecRows(N)](self, 0, self.rows, alpha, x, beta, y)
                 else
                     y:scal(beta)
                     for i = 0, self.rows do
@@ -176,8 +213,111 @@ local CSRMatrix = parametrized.type(function(T, I)
         end)
         local MAX_POWER = 5
         local MAX_VECLEN = 2 ^ MAX_POWER
+
+        local terraform scalarrows(
+            self: &csr,
+            r0: I,
+            r1: I,
+            alpha: T,
+            x: &V1,
+            beta: T,
+            y: &V2
+        ) where {V1: Vector, V2: Vector}
+            for i = r0, r1 do
+                var res = [T](0)
+                for idx = self.rowptr(i), self.rowptr(i + 1) do
+                    res = res + self.data(idx) * x:get(self.col(idx))
+                end
+                y:set(i, alpha * res + beta * y:get(i))
+            end
+        end
+
+        -- Candidate kernels of the autotuner. Each row kernel, scalar or with
+        -- SIMD width 2, ..., MAX_VECLEN, runs either serially or in parallel
+        -- over blocks of TUNE_ROWBLOCK rows.
+        local TUNE_ROWBLOCK = 1024
+        local ROWKERNELS = terralib.newlist({scalarrows})
+        for i = 1, MAX_POWER do
+            ROWKERNELS:insert(VecRows(2 ^ i))
+        end
+        local KERNELS = terralib.newlist()
+        for _, threaded in ipairs({false, true}) do
+            for _, rows in ipairs(ROWKERNELS) do
+                KERNELS:insert({rows = rows, threaded = threaded})
+            end
+        end
+        -- Number of candidate kernels. Valid values of kernel are 0, ..., nkernels.
+        csr.traits.nkernels = #KERNELS
+
+        local terraform tunedapply(self: &csr, alpha: T, x: &V1, beta: T, y: &V2)
+            where {V1: Vector, V2: Vector}
+            escape
+                for k, kernel in ipairs(KERNELS) do
+                    local rows = kernel.rows
+                    if kernel.threaded then
+                        emit quote
+                            if self.kernel == k then
+                                var nblocks: I = (
+                                    (self.rows + TUNE_ROWBLOCK - 1) / TUNE_ROWBLOCK
+                                )
+                                var rn = [range.Unitrange(I)].new(0, nblocks)
+                                var go = lambda.new(
+                                    [
+                                        terra(
+                                            b: I,
+                                            self: &csr,
+                                            alpha: T,
+                                            x: x.type,
+                                            beta: T,
+                                            y: y.type
+                                        )
+                                            var r0 = b * TUNE_ROWBLOCK
+                                            var r1 = terralib.select(
+                                                r0 + TUNE_ROWBLOCK < self.rows,
+                                                r0 + TUNE_ROWBLOCK,
+                                                self.rows
+                                            )
+                                            rows(self, r0, r1, alpha, x, beta, y)
+                                        end
+                                    ],
+                                    {
+                                        self = self,
+                                        alpha = alpha,
+                                        x = x,
+                                        beta = beta,
+                                        y = y,
+                                    }
+                                )
+                                var allocator: alloc.DefaultAllocator()
+                                if self.pool:isempty() then
+                                    -- Kernel set by hand, without a pool
+                                    thread.parfor(&allocator, rn, go)
+                                else
+                                    for b in rn do
+                                        self.pool:submit(&allocator, go, b)
+                                    end
+                                    self.pool:barrier()
+                                end
+                                return
+                            end
+                        end
+                    else
+                        emit quote
+                            if self.kernel == k then
+                                rows(self, 0, self.rows, alpha, x, beta, y)
+                                return
+                            end
+                        end
+                    end
+                end
+            end
+        end
+
         terraform csr:apply(trans: bool, alpha: T, x: &V1, beta: T, y: &V2)
             where {V1: Vector, V2: Vector}
+            if not trans and self.kernel > 0 then
+                return tunedapply(self, alpha, x, beta, y)
+            end
             var nnzrow = self.data:size() / self:rows()
             var veclen = 1
             while veclen < nnzrow do
@@ -197,6 +337,203 @@ local CSRMatrix = parametrized.type(function(T, I)
                 end
             end
         end
+
+        -- Create the pool of the threaded kernels once for all calls of apply
+        local terra initpool(self: &csr, A: alloc.Allocator)
+            if self.pool:isempty() then
+                self.pool = thread.threadpool.new(A, thread.omp_get_num_threads())
+            end
+        end
+
+        -- Time nrep products with each candidate kernel and keep the fastest
+        -- one for all following calls of apply. Returns the selected kernel.
+        -- The tuning only pays off if the matrix is applied many times.
+        -- Threaded kernels are timed on the pool that apply reuses later.
+        local Vec = darray.DynamicVector(T)
+        terra csr:tune(A: alloc.Allocator, nrep: int64)
+            initpool(self, A)
+            var x = Vec.ones(A, self.cols)
+            var y = Vec.zeros(A, self.rows)
+            var best: int32 = 0
+            var tbest: double = -1
+            for k = 1, [#KERNELS + 1] do
+                self.kernel = k
+                -- Warm up the caches
+                self:apply(false, [T](1), &x, [T](0), &y)
+                var sw: timing.parallel_timer
+                sw:start()
+                for rep = 0, nrep do
+                    self:apply(false, [T](1), &x, [T](0), &y)
+                end
+                var t = sw:stop()
+                if tbest < 0 or t < tbest then
+                    tbest = t
+                    best = k
+                end
+            end
+            self.kernel = best
+            return best
+        end
+
+        -- The kernel selected by tune is stored together with the dimensions
+        -- and the number of nonzeros of the matrix, so that it is only
+        -- restored for a matrix of the same shape.
+        terra csr:savekernel(filename: rawstring)
+            var f = C.fopen(filename, "w")
+            err.assert(f ~= nil)
+            C.fprintf(
+                f,
+                "CSRKERNEL %lld %lld %lld %d\n",
+                [int64](self.rows),
+                [int64](self.cols),
+                [int64](self:nnz()),
+                self.kernel
+            )
+            C.fclose(f)
+        end
+
+        -- Returns true if a kernel for a matrix of the same shape was read.
+        -- A is the allocator for the pool of the threaded kernels.
+        terra csr:loadkernel(A: alloc.Allocator, filename: rawstring)
+            var f = C.fopen(filename, "r")
+            if f == nil then
+                return false
+            end
+            var rows: int64
+            var cols: int64
+            var nnz: int64
+            var kernel: int32
+            var n = C.fscanf(f, "CSRKERNEL %lld %lld %lld %d", &rows, &cols, &nnz, &kernel)
+            C.fclose(f)
+            if (
+                n ~= 4 or rows ~= self.rows or cols ~= self.cols
+                or nnz ~= self:nnz() or kernel < 0 or kernel > [#KERNELS]
+            ) then
+                return false
+            end
+            self.kernel = kernel
+            if kernel > [#ROWKERNELS] then
+                initpool(self, A)
+            end
+            return true
+        end
+    end
+
+
+    -- Sparse matrix times a small block of k vectors stored as the columns of
+    -- a dense, row major matrix (SpMM). For each row of the sparse matrix
+    -- we stream over its nonzeros once and update the corresponding row of
+    -- all k columns at the same time. Columns are processed in panels of
+    -- at most MAX_PANEL entries so that the partial sums stay in registers.
+    local Mat = darray.DynamicMatrix(T)
+    local MAX_PANEL = 32
+
+    local terra spmm_transposed(self: &csr, alpha: T, x: &Mat, beta: T, y: &Mat)
+        var k = x:cols()
+        err.assert(y:cols() == k)
+        err.assert(x:rows() == self.rows and y:rows() == self.cols)
+        for j = 0, y:rows() do
+            for c = 0, k do
+                y(j, c) = beta * y(j, c)
+            end
+        end
+        for i = 0, self.rows do
+            var xr = &x(i, 0)
+            for idx = self.rowptr(i), self.rowptr(i + 1) do
+                var a = alpha * self.data(idx)
+                var yr = &y(self.col(idx), 0)
+                for c = 0, k do
+                    yr[c] = yr[c] + a * xr[c]
+                end
+            end
+        end
+    end
+
+    local terra spmm(self: &csr, alpha: T, x: &Mat, beta: T, y: &Mat)
+        var k = x:cols()
+        err.assert(y:cols() == k)
+        err.assert(x:rows() == self.cols and y:rows() == self.rows)
+        for i = 0, self.rows do
+            for c0 = 0, k, MAX_PANEL do
+                var w = terralib.select(k - c0 < MAX_PANEL, k - c0, MAX_PANEL)
+                var acc: T[MAX_PANEL]
+                for c = 0, w do
+                    acc[c] = [T](0)
+                end
+                for idx = self.rowptr(i), self.rowptr(i + 1) do
+                    var a = self.data(idx)
+                    var xr = &x(self.col(idx), c0)
+                    for c = 0, w do
+                        acc[c] = acc[c] + a * xr[c]
+                    end
+                end
+                var yr = &y(i, c0)
+                for c = 0, w do
+                    yr[c] = alpha * acc[c] + beta * yr[c]
+                end
+            end
+        end
+    end
+
+    if Primitive(T) then
+        -- SIMD across the columns of the panel. The width is chosen such that
+        -- one SIMD vector fills a 256 bit register.
+        local N = math.max(1, math.floor(32 / sizeof(T)))
+        local NVEC = math.floor(MAX_PANEL / N)
+        local SIMD = simd.VectorFactory(T, N)
+        spmm = terra(self: &csr, alpha: T, x: &Mat, beta: T, y: &Mat)
+            var k = x:cols()
+            err.assert(y:cols() == k)
+            err.assert(x:rows() == self.cols and y:rows() == self.rows)
+            var alphav: SIMD = alpha
+            var betav: SIMD = beta
+            for i = 0, self.rows do
+                for c0 = 0, k, MAX_PANEL do
+                    var w = terralib.select(
+                        k - c0 < MAX_PANEL, k - c0, MAX_PANEL
+                    )
+                    var nvec = w / N
+                    var rem = nvec * N
+                    var vecacc: SIMD[NVEC]
+                    for v = 0, nvec do
+                        vecacc[v] = [T](0)
+                    end
+                    var acc: T[N]
+                    for c = rem, w do
+                        acc[c - rem] = [T](0)
+                    end
+                    for idx = self.rowptr(i), self.rowptr(i + 1) do
+                        var a = self.data(idx)
+                        var av: SIMD = a
+                        var xr = &x(self.col(idx), c0)
+                        for v = 0, nvec do
+                            var xv: SIMD = xr + v * N
+                            vecacc[v] = vecacc[v] + av * xv
+                        end
+                        for c = rem, w do
+                            acc[c - rem] = acc[c - rem] + a * xr[c]
+                        end
+                    end
+                    var yr = &y(i, c0)
+                    for v = 0, nvec do
+                        var yv: SIMD = yr + v * N
+                        var res = alphav * vecacc[v] + betav * yv
+                        res:store(yr + v * N)
+                    end
+                    for c = rem, w do
+                        yr[c] = alpha * acc[c - rem] + beta * yr[c]
+                    end
+                end
+            end
+        end
+    end
+
+    terraform csr:apply(trans: bool, alpha: T, x: &Mat, beta: T, y: &Mat)
+        if not trans then
+            spmm(self, alpha, x, beta, y)
+        else
+            spmm_transposed(self, alpha, x, beta, y)
+        end
     end
 
 
@@ -281,13 +618,285 @@ local CSRMatrix = parametrized.type(function(T, I)
     local ACols = math.floor(256 * sizeof(double) / sizeof(T))
     local BCols = math.floor(256 * sizeof(double) / sizeof(T))
     local Matrix = concepts.Matrix(T)
-    -- TODO Implement missing cases
     terraform matrix.gemm(
         alpha: T,
         A: &csr,
         B: &M1,
         beta: T,
         C: &M2
+    ) where {M1: Matrix, M2: Matrix}
+        escape
+            -- For a small number of right hand sides streaming over the rows
+            -- of A is faster than packing A into tiles.
+            if M1 == Mat and M2 == Mat then
+                emit quote
+                    if B:cols() <= MAX_PANEL then
+                        A:apply(false, alpha, B, beta, C)
+                        return
+                    end
+                end
+            end
+        end
+        -- HACK: Use default allocator as we cannot access the allocator
+        -- for the sparse matrix.
+        var allocator: alloc.DefaultAllocator()
+        var ap = A:packed(&allocator)
+        matrix.gemm(alpha, &ap, B, beta, C)
+    end
+
+    -- Sparse matrix-matrix product (SpGEMM) C = A * B. The computation is
+    -- split into a symbolic phase that determines the sparsity pattern of C
+    -- and a numeric phase that computes its values. The numeric phase is a
+    -- specialization of matrix.gemm and can be repeated for matrices that
+    -- share the same pattern. Both phases run in parallel over blocks of rows.
+    -- Each task merges the rows of B with a dense accumulator of length
+    -- B:cols().
+    local SPGEMM_ROWBLOCK = 256
+    local SmartI = alloc.SmartBlock(I)
+    local SmartT = alloc.SmartBlock(T)
+
+    local terra compare_index(x: &opaque, y: &opaque): int
+        var a = @[&I](x)
+        var b = @[&I](y)
+        return terralib.select(a < b, -1, terralib.select(a > b, 1, 0))
+    end
+
+    -- Count the number of nonzeros of row i of a * b. If cols is not nil,
+    -- the column indices are written to it in unsorted order.
+    local terra symbolic_row(a: &csr, b: &csr, i: I, marker: &I, cols: &I)
+        var cnt: I = 0
+        for idx = a.rowptr(i), a.rowptr(i + 1) do
+            var k = a.col(idx)
+            for jdx = b.rowptr(k), b.rowptr(k + 1) do
+                var j = b.col(jdx)
+                if marker[j] ~= i then
+                    marker[j] = i
+                    if cols ~= nil then
+                        cols[cnt] = j
+                    end
+                    cnt = cnt + 1
+                end
+            end
+        end
+        return cnt
+    end
+
+    local terra rowblock(blk: I, rows: I)
+        var first = blk * SPGEMM_ROWBLOCK
+        var last = first + SPGEMM_ROWBLOCK
+        return first, terralib.select(last < rows, last, rows)
+    end
+
+    local terra symbolic_count(blk: I, a: &csr, b: &csr, c: &csr)
+        var allocator: alloc.DefaultAllocator()
+        var marker: SmartI = allocator:new(sizeof(I), b.cols)
+        for j = 0, b.cols do
+            marker(j) = [I](-1)
+        end
+        var first, last = rowblock(blk, c.rows)
+        for i = first, last do
+            c.rowptr(i + 1) = symbolic_row(a, b, i, &marker(0), nil)
+        end
+    end
+
+    local terra symbolic_fill(blk: I, a: &csr, b: &csr, c: &csr)
+        var allocator: alloc.DefaultAllocator()
+        var marker: SmartI = allocator:new(sizeof(I), b.cols)
+        for j = 0, b.cols do
+            marker(j) = [I](-1)
+        end
+        var first, last = rowblock(blk, c.rows)
+        for i = first, last do
+            var cols = c.col:getdataptr() + c.rowptr(i)
+            var cnt = symbolic_row(a, b, i, &marker(0), cols)
+            C.qsort(cols, cnt, sizeof(I), compare_index)
+        end
+    end
+
+    local terra numeric_block(
+        blk: I, alpha: T, a: &csr, b: &csr, beta: T, c: &csr
+    )
+        var allocator: alloc.DefaultAllocator()
+        var acc: SmartT = allocator:new(sizeof(T), b.cols)
+        var first, last = rowblock(blk, c.rows)
+        for i = first, last do
+            for idx = c.rowptr(i), c.rowptr(i + 1) do
+                acc(c.col(idx)) = [T](0)
+            end
+            for idx = a.rowptr(i), a.rowptr(i + 1) do
+                var aik = a.data(idx)
+                var k = a.col(idx)
+                for jdx = b.rowptr(k), b.rowptr(k + 1) do
+                    var j = b.col(jdx)
+                    acc(j) = acc(j) + aik * b.data(jdx)
+                end
+            end
+            for idx = c.rowptr(i), c.rowptr(i + 1) do
+                c.data(idx) = alpha * acc(c.col(idx)) + beta * c.data(idx)
+            end
+        end
+    end
+
+    -- Numeric phase of the sparse matrix-matrix product,
+    -- C = alpha * A * B + beta * C. The sparsity pattern of C has to contain
+    -- the pattern of A * B, for instance by constructing C with
+    -- CSRMatrix.symbolic. Contributions outside of the pattern are dropped.
+    terraform matrix.gemm(alpha: T, A: &csr, B: &csr, beta: T, C: &csr)
+        err.assert(A.cols == B.rows)
+        err.assert(C.rows == A.rows and C.cols == B.cols)
+        var nblocks: I = (C.rows + SPGEMM_ROWBLOCK - 1) / SPGEMM_ROWBLOCK
+        var allocator: alloc.DefaultAllocator()
+        thread.parfor(
+            &allocator,
+            [range.Unitrange(I)].new(0, nblocks),
+            lambda.new(
+                numeric_block,
+                {alpha = alpha, a = A, b = B, beta = beta, c = C}
+            )
+        )
+    end
+
+    -- Persistent packed representation of a CSR matrix for repeated
+    -- products with dense matrices. The matrix is split into tiles of size
+    -- ARows x ACols that are stored in the layout of SparsePacked, that is
+    -- column by column with the local row index of each entry. Only nonzero
+    -- entries and nonempty columns are stored. The tile data is concatenated
+    -- in row major order of the tiles with offsets in tileptr (for Ap, loc)
+    -- and colptr (for col, nnz). Each tile is terminated by a zero entry in
+    -- nnz.
+    local View = packed.SparsePackedViewFactory(T, I, ARows, ACols)
+    local struct packed_csr {
+        rows: I
+        cols: I
+        nblockrows: I
+        nblockcols: I
+        tileptr: SI
+        colptr: SI
+        Ap: ST
+        loc: SI
+        col: SI
+        nnz: SI
+    }
+    packed_csr.metamethods.__typename = function(self)
+        return ("PackedCSRMatrix(%s, %s)"):format(tostring(T), tostring(I))
+    end
+    base.AbstractBase(packed_csr)
+    packed_csr.traits.eltype = T
+    csr.packedtype = packed_csr
+
+    terra packed_csr:rows()
+        return self.rows
+    end
+
+    terra packed_csr:cols()
+        return self.cols
+    end
+
+    terra packed_csr:tilennz(idx: I, kdx: I)
+        var t = idx * self.nblockcols + kdx
+        return self.tileptr(t + 1) - self.tileptr(t)
+    end
+
+    terra packed_csr:tile(idx: I, kdx: I)
+        var t = idx * self.nblockcols + kdx
+        var v: View
+        v.Ap = self.Ap:getdataptr() + self.tileptr(t)
+        v.loc = self.loc:getdataptr() + self.tileptr(t)
+        v.col = self.col:getdataptr() + self.colptr(t)
+        v.nnz = self.nnz:getdataptr() + self.colptr(t)
+        return v
+    end
+
+    -- Pack the matrix into tiles in a single sweep over each block row.
+    -- First, we count the entries of each column within the block row and
+    -- sort the touched columns. The counts are then turned into offsets in
+    -- the packed arrays and the entries are scattered in a second sweep over
+    -- the same rows. The cost is O(nnz log(nnz per block row)) in contrast
+    -- to packing each tile separately with SparsePacked:pack.
+    terra csr:packed(A: alloc.Allocator)
+        var p: packed_csr
+        p.rows = self.rows
+        p.cols = self.cols
+        p.nblockrows = (self.rows + ARows - 1) / ARows
+        p.nblockcols = (self.cols + ACols - 1) / ACols
+        var ntiles = p.nblockrows * p.nblockcols
+        var nnz = self:nnz()
+        var cap = terralib.select(nnz > 0, nnz, 1)
+        p.tileptr = SI.new(A, ntiles + 1)
+        p.colptr = SI.new(A, ntiles + 1)
+        p.Ap = ST.new(A, cap)
+        p.loc = SI.new(A, cap)
+        p.col = SI.new(A, ntiles + 1)
+        p.nnz = SI.new(A, ntiles + 1)
+        for e = 0, nnz do
+            p.Ap:push(0)
+            p.loc:push(0)
+        end
+        p.tileptr:push(0)
+        p.colptr:push(0)
+
+        var ncols = terralib.select(self.cols > 0, self.cols, 1)
+        var count: SmartI = A:new(sizeof(I), ncols)
+        var touched: SmartI = A:new(sizeof(I), ncols)
+        for j = 0, self.cols do
+            count(j) = 0
+        end
+        var pos: I = 0
+        for idx = 0, p.nblockrows do
+            var first = idx * ARows
+            var last = terralib.select(
+                first + ARows < self.rows, first + ARows, self.rows
+            )
+            var ntouched: I = 0
+            for i = first, last do
+                for e = self.rowptr(i), self.rowptr(i + 1) do
+                    var j = self.col(e)
+                    if count(j) == 0 then
+                        touched(ntouched) = j
+                        ntouched = ntouched + 1
+                    end
+                    count(j) = count(j) + 1
+                end
+            end
+            C.qsort(&touched(0), ntouched, sizeof(I), compare_index)
+            var t: I = 0
+            for kdx = 0, p.nblockcols do
+                var colstart = kdx * ACols
+                while t < ntouched and touched(t) < colstart + ACols do
+                    var j = touched(t)
+                    var cnt = count(j)
+                    p.col:push(j - colstart)
+                    p.nnz:push(cnt)
+                    count(j) = pos
+                    pos = pos + cnt
+                    t = t + 1
+                end
+                p.col:push(0)
+                p.nnz:push(0)
+                p.tileptr:push(pos)
+                p.colptr:push(p.col:size())
+            end
+            for i = first, last do
+                for e = self.rowptr(i), self.rowptr(i + 1) do
+                    var j = self.col(e)
+                    p.Ap(count(j)) = self.data(e)
+                    p.loc(count(j)) = i - first
+                    count(j) = count(j) + 1
+                end
+            end
+            for l = 0, ntouched do
+                count(touched(l)) = 0
+            end
+        end
+        return p
+    end
+
+    terraform matrix.gemm(
+        alpha: T,
+        A: &packed_csr,
+        B: &M1,
+        beta: T,
+        C: &M2
     ) where {M1: Matrix, M2: Matrix}
         var na = A:rows()
         var ma = A:cols()
@@ -298,8 +907,7 @@ local CSRMatrix = parametrized.type(function(T, I)
         err.assert(na == nc)
         err.assert(ma == nb)
         err.assert(mb == mc)
-        var nblocka: I = (na + ARows - 1) / ARows
-        var mblocka: I = (ma + ACols - 1) / ACols
+        var nblocka: I = A.nblockrows
         var mblockb: I = (mb + BCols - 1) / BCols
 
         -- CAKE: matrix multiplication using constant-bandwidth blocks
@@ -316,36 +924,360 @@ local CSRMatrix = parametrized.type(function(T, I)
                     A: A.type,
                     B: B.type,
                     beta: beta.type,
-                    C: C.type,
-                    mblocka: mblocka.type
+                    C: C.type
                 )
                     var jdx, idx = it
-                    var ap: packed.SparsePackedFactory(T, I, ARows, ACols)
                     var bp: packed.DensePackedFactory(T, ACols, BCols)
                     var cp: packed.DensePackedFactory(T, ARows, BCols)
 
                     cp:pack(C, beta, idx * ARows, jdx * BCols)
-                    for k = 0, mblocka do
-                        var kdx = k
-                        ap:pack(A, [T](1), idx * ARows, kdx * ACols)
-                        bp:pack(B, [T](1), kdx * ACols, jdx * BCols)
-                        blocked_outer_product(alpha, &ap, &bp, &cp)
+                    for kdx = 0, A.nblockcols do
+                        -- Empty tiles don't contribute to the product.
+                        if A:tilennz(idx, kdx) > 0 then
+                            var ap = A:tile(idx, kdx)
+                            bp:pack(B, [T](1), kdx * ACols, jdx * BCols)
+                            blocked_outer_product(alpha, &ap, &bp, &cp)
+                        end
                     end
                     cp:unpack(C, idx * ARows, jdx * BCols)
                 end
             ],
-            {alpha = alpha, A = A, B = B, beta = beta, C = C, mblocka = mblocka}
+            {alpha = alpha, A = A, B = B, beta = beta, C = C}
+        )
+        var allocator: alloc.DefaultAllocator()
+        thread.parfor(&allocator, rn, go)
+    end
+
+    -- Transposed view of a CSR matrix. It has the memory layout of csr, so
+    -- csr:transpose() is a pointer cast as for dense matrices.
+    local struct tcsr {
+        parent: csr
+    }
+    tcsr.metamethods.__typename = function(self)
+        return ("Transpose{CSRMatrix(%s, %s)}"):format(tostring(T), tostring(I))
+    end
+    base.AbstractBase(tcsr)
+    tcsr.traits.eltype = T
+    tcsr.traits.istransposed = true
+
+    terra tcsr:rows()
+        return self.parent.cols
+    end
+
+    terra tcsr:cols()
+        return self.parent.rows
+    end
+
+    terra tcsr:get(i: I, j: I)
+        return self.parent:get(j, i)
+    end
+
+    terra tcsr:set(i: I, j: I, x: T)
+        self.parent:set(j, i, x)
+    end
+
+    matrix.MatrixBase(tcsr)
+    assert(Matrix(tcsr))
+
+    terra tcsr:nnz()
+        return self.parent:nnz()
+    end
+
+    terraform tcsr:apply(trans: bool, alpha: T, x: &V1, beta: T, y: &V2)
+        where {V1: Vector, V2: Vector}
+        self.parent:apply(not trans, alpha, x, beta, y)
+    end
+
+    terraform tcsr:apply(trans: bool, alpha: T, x: &Mat, beta: T, y: &Mat)
+        self.parent:apply(not trans, alpha, x, beta, y)
+    end
+
+    terra csr:transpose()
+        return [&tcsr](self)
+    end
+
+    terra tcsr:transpose()
+        return [&csr](self)
+    end
+
+    -- Explicit transpose in CSR format with sorted column indices
+    terra csr:transposed(A: alloc.Allocator)
+        var b: csr
+        b.rows = self.cols
+        b.cols = self.rows
+        b.rowptr = SI.new(A, b.rows + 1)
+        for i = 0, b.rows + 1 do
+            b.rowptr:push(0)
+        end
+        var nnz = self:nnz()
+        for idx = 0, nnz do
+            var j = self.col(idx)
+            b.rowptr(j + 1) = b.rowptr(j + 1) + 1
+        end
+        for i = 0, b.rows do
+            b.rowptr(i + 1) = b.rowptr(i + 1) + b.rowptr(i)
+        end
+        var cap = terralib.select(nnz > 0, nnz, 1)
+        b.data = ST.new(A, cap)
+        b.col = SI.new(A, cap)
+        for idx = 0, nnz do
+            b.data:push(0)
+            b.col:push(0)
+        end
+        var slot: SmartI = A:new(sizeof(I), b.rows + 1)
+        for i = 0, b.rows do
+            slot(i) = b.rowptr(i)
+        end
+        for i = 0, self.rows do
+            for idx = self.rowptr(i), self.rowptr(i + 1) do
+                var j = self.col(idx)
+                b.col(slot(j)) = i
+                b.data(slot(j)) = self.data(idx)
+                slot(j) = slot(j) + 1
+            end
+        end
+        return b
+    end
+
+    -- C = alpha A^T B + beta C. Small blocks of vectors are handled by the
+    -- transposed SpMM, otherwise A^T is formed explicitly in O(nnz) and
+    -- multiplied with the packed kernel.
+    terraform matrix.gemm(
+        alpha: T,
+        A: &tcsr,
+        B: &M1,
+        beta: T,
+        C: &M2
+    ) where {M1: Matrix, M2: Matrix}
+        escape
+            if M1 == Mat and M2 == Mat then
+                emit quote
+                    if B:cols() <= MAX_PANEL then
+                        A.parent:apply(true, alpha, B, beta, C)
+                        return
+                    end
+                end
+            end
+        end
+        var allocator: alloc.DefaultAllocator()
+        var at = A.parent:transposed(&allocator)
+        var ap = at:packed(&allocator)
+        matrix.gemm(alpha, &ap, B, beta, C)
+    end
+
+    -- Dense times sparse products are computed row by row of C. Rows are
+    -- independent, so blocks of rows are processed in parallel. For dense
+    -- matrices of type Mat the rows of B and C are accessed through
+    -- pointers, other matrix types fall back to get and set.
+    local DENSE_ROWBLOCK = 16
+
+    -- C = alpha B A + beta C. Row r of C is the linear combination of the
+    -- rows of A with coefficients from row r of B.
+    terraform matrix.gemm(
+        alpha: T,
+        B: &M1,
+        A: &csr,
+        beta: T,
+        C: &M2
+    ) where {M1: Matrix, M2: Matrix}
+        err.assert(B:cols() == A.rows)
+        err.assert(C:rows() == B:rows() and C:cols() == A.cols)
+        var nblocks: I = (C:rows() + DENSE_ROWBLOCK - 1) / DENSE_ROWBLOCK
+        var rn = [range.Unitrange(I)].new(0, nblocks)
+        var go = lambda.new(
+            [
+                terra(
+                    blk: I,
+                    alpha: alpha.type,
+                    B: B.type,
+                    A: A.type,
+                    beta: beta.type,
+                    C: C.type
+                )
+                    var r0 = blk * DENSE_ROWBLOCK
+                    var r1 = terralib.select(
+                        r0 + DENSE_ROWBLOCK < C:rows(), r0 + DENSE_ROWBLOCK, C:rows()
+                    )
+                    escape
+                        if M1 == Mat and M2 == Mat then
+                            emit quote
+                                for r = r0, r1 do
+                                    var br = &B(r, 0)
+                                    var cr = &C(r, 0)
+                                    for j = 0, C:cols() do
+                                        cr[j] = beta * cr[j]
+                                    end
+                                    for k = 0, A.rows do
+                                        var brk = alpha * br[k]
+                                        for idx = A.rowptr(k), A.rowptr(k + 1) do
+                                            var j = A.col(idx)
+                                            cr[j] = cr[j] + brk * A.data(idx)
+                                        end
+                                    end
+                                end
+                            end
+                        else
+                            emit quote
+                                for r = r0, r1 do
+                                    for j = 0, C:cols() do
+                                        C:set(r, j, beta * C:get(r, j))
+                                    end
+                                    for k = 0, A.rows do
+                                        var brk = alpha * B:get(r, k)
+                                        for idx = A.rowptr(k), A.rowptr(k + 1) do
+                                            var j = A.col(idx)
+                                            C:set(r, j, C:get(r, j) + brk * A.data(idx))
+                                        end
+                                    end
+                                end
+                            end
+                        end
+                    end
+                end
+            ],
+            {alpha = alpha, B = B, A = A, beta = beta, C = C}
+        )
+        var allocator: alloc.DefaultAllocator()
+        thread.parfor(&allocator, rn, go)
+    end
+
+    -- C = alpha B A^T + beta C. Entry (r, i) of C is the sparse dot product
+    -- of row i of A with row r of B.
+    terraform matrix.gemm(
+        alpha: T,
+        B: &M1,
+        A: &tcsr,
+        beta: T,
+        C: &M2
+    ) where {M1: Matrix, M2: Matrix}
+        var a = &A.parent
+        err.assert(B:cols() == a.cols)
+        err.assert(C:rows() == B:rows() and C:cols() == a.rows)
+        var nblocks: I = (C:rows() + DENSE_ROWBLOCK - 1) / DENSE_ROWBLOCK
+        var rn = [range.Unitrange(I)].new(0, nblocks)
+        var go = lambda.new(
+            [
+                terra(
+                    blk: I,
+                    alpha: alpha.type,
+                    B: B.type,
+                    a: &csr,
+                    beta: beta.type,
+                    C: C.type
+                )
+                    var r0 = blk * DENSE_ROWBLOCK
+                    var r1 = terralib.select(
+                        r0 + DENSE_ROWBLOCK < C:rows(), r0 + DENSE_ROWBLOCK, C:rows()
+                    )
+                    escape
+                        if M1 == Mat and M2 == Mat then
+                            emit quote
+                                for r = r0, r1 do
+                                    var br = &B(r, 0)
+                                    var cr = &C(r, 0)
+                                    for i = 0, a.rows do
+                                        var res = [T](0)
+                                        for idx = a.rowptr(i), a.rowptr(i + 1) do
+                                            res = res + a.data(idx) * br[a.col(idx)]
+                                        end
+                                        cr[i] = alpha * res + beta * cr[i]
+                                    end
+                                end
+                            end
+                        else
+                            emit quote
+                                for r = r0, r1 do
+                                    for i = 0, a.rows do
+                                        var res = [T](0)
+                                        for idx = a.rowptr(i), a.rowptr(i + 1) do
+                                            res = res + a.data(idx) * B:get(r, a.col(idx))
+                                        end
+                                        C:set(r, i, alpha * res + beta * C:get(r, i))
+                                    end
+                                end
+                            end
+                        end
+                    end
+                end
+            ],
+            {alpha = alpha, B = B, a = a, beta = beta, C = C}
         )
-        -- HACK: Use default allocator as we cannot access the allocator
-        -- for the sparse matrix.
         var allocator: alloc.DefaultAllocator()
         thread.parfor(&allocator, rn, go)
-        -- timeit.timeit([quote
-        --     for it in rn do
-        --         go(it)
-        --     end
-        --     end], true
-        -- )
+    end
+
+    -- C = alpha A B + beta C for a dense C and sparse rows of A and B.
+    local terraform sparse_dense(alpha: T, a: &csr, b: &csr, beta: T, C: &M)
+        where {M: Matrix}
+        err.assert(a.cols == b.rows)
+        err.assert(C:rows() == a.rows and C:cols() == b.cols)
+        var nblocks: I = (a.rows + DENSE_ROWBLOCK - 1) / DENSE_ROWBLOCK
+        var rn = [range.Unitrange(I)].new(0, nblocks)
+        var go = lambda.new(
+            [
+                terra(
+                    blk: I,
+                    alpha: T,
+                    a: &csr,
+                    b: &csr,
+                    beta: T,
+                    C: C.type
+                )
+                    var r0 = blk * DENSE_ROWBLOCK
+                    var r1 = terralib.select(
+                        r0 + DENSE_ROWBLOCK < a.rows, r0 + DENSE_ROWBLOCK, a.rows
+                    )
+                    for r = r0, r1 do
+                        for j = 0, b.cols do
+                            C:set(r, j, beta * C:get(r, j))
+                        end
+                        for ia = a.rowptr(r), a.rowptr(r + 1) do
+                            var k = a.col(ia)
+                            var ark = alpha * a.data(ia)
+                            for ib = b.rowptr(k), b.rowptr(k + 1) do
+                                var j = b.col(ib)
+                                C:set(r, j, C:get(r, j) + ark * b.data(ib))
+                            end
+                        end
+                    end
+                end
+            ],
+            {alpha = alpha, a = a, b = b, beta = beta, C = C}
+        )
+        var allocator: alloc.DefaultAllocator()
+        thread.parfor(&allocator, rn, go)
+    end
+
+    -- Products of two sparse factors with a dense result match both the
+    -- sparse times dense and the dense times sparse cases. Transposed
+    -- factors are formed explicitly and the product is accumulated row by
+    -- row of A.
+    for _, MA in pairs({csr, tcsr}) do
+        for _, MB in pairs({csr, tcsr}) do
+            terraform matrix.gemm(
+                alpha: T,
+                A: &MA,
+                B: &MB,
+                beta: T,
+                C: &M
+            ) where {M: Matrix}
+                var allocator: alloc.DefaultAllocator()
+                escape
+                    local a, b = A, B
+                    if MA == tcsr then
+                        a = symbol(csr)
+                        emit quote var [a] = A.parent:transposed(&allocator) end
+                        a = `&[a]
+                    end
+                    if MB == tcsr then
+                        b = symbol(csr)
+                        emit quote var [b] = B.parent:transposed(&allocator) end
+                        b = `&[b]
+                    end
+                    emit quote sparse_dense(alpha, [a], [b], beta, C) end
+                end
+            end
+        end
     end
 
     local Alloc = alloc.Allocator
@@ -375,9 +1307,491 @@ local CSRMatrix = parametrized.type(function(T, I)
         end
     )
 
+    -- Symbolic phase of the sparse matrix-matrix product a * b. Returns a
+    -- matrix with the sparsity pattern of the product, sorted column indices
+    -- in each row and all values set to zero. Use matrix.gemm to compute
+    -- the values.
+    csr.staticmethods.symbolic = terra(A: Alloc, a: &csr, b: &csr)
+        err.assert(a.cols == b.rows)
+        var c: csr
+        c.rows = a.rows
+        c.cols = b.cols
+        c.rowptr = SI.new(A, c.rows + 1)
+        for i = 0, c.rows + 1 do
+            c.rowptr:push(0)
+        end
+        var nblocks: I = (c.rows + SPGEMM_ROWBLOCK - 1) / SPGEMM_ROWBLOCK
+        var rn = [range.Unitrange(I)].new(0, nblocks)
+        do
+            var allocator: alloc.DefaultAllocator()
+            thread.parfor(
+                &allocator, rn, lambda.new(symbolic_count, {a = a, b = b, c = &c})
+            )
+        end
+        for i = 0, c.rows do
+            c.rowptr(i + 1) = c.rowptr(i + 1) + c.rowptr(i)
+        end
+        var nnz = c.rowptr(c.rows)
+        var cap = terralib.select(nnz > 0, nnz, 1)
+        c.data = ST.new(A, cap)
+        c.col = SI.new(A, cap)
+        for idx = 0, nnz do
+            c.data:push(0)
+            c.col:push(0)
+        end
+        do
+            var allocator: alloc.DefaultAllocator()
+            thread.parfor(
+                &allocator, rn, lambda.new(symbolic_fill, {a = a, b = b, c = &c})
+            )
+        end
+        return c
+    end
+
     return csr
 end)
 
+--[=[
+    CSR matrix with compressed storage for memory bound matrix-vector
+    products. Values are stored in S, for example float, while apply
+    computes in T, for example double.
+
+    Column indices are stored per block of COL_ROWBLOCK rows. If all column
+    indices of a block lie in [base, base + 65535] they are stored as uint16
+    offsets to base, otherwise as int32.
+--]=]
+local COL_ROWBLOCK = 32
+local COL_SPAN = 65536
+
+local CompressedCSRMatrix = parametrized.type(function(T, S)
+    S = S or T
+    local Vector = concepts.Vector(T)
+    local SmartS = alloc.SmartBlock(S)
+    local SmartInt = alloc.SmartBlock(int64)
+    local Smart32 = alloc.SmartBlock(int32)
+    local Smart16 = alloc.SmartBlock(uint16)
+    local Alloc = alloc.Allocator
+
+    local struct ccsr {
+        rows: int64
+        cols: int64
+        rowptr: SmartInt
+        data: SmartS
+        -- Base column of each block or -1 if the block stores int32 indices
+        base: Smart32
+        -- Indices of block b start at position colptr(b) in col16 or col32
+        colptr: SmartInt
+        col16: Smart16
+        col32: Smart32
+    }
+    ccsr.metamethods.__typename = function(self)
+        return ("CompressedCSRMatrix(%s, %s)"):format(tostring(T), tostring(S))
+    end
+    base.AbstractBase(ccsr)
+    ccsr.traits.eltype = T
+
+    terra ccsr:rows()
+        return self.rows
+    end
+
+    terra ccsr:cols()
+        return self.cols
+    end
+
+    terra ccsr:nnz()
+        return self.rowptr(self.rows)
+    end
+
+    terra ccsr:nblocks()
+        return (self.rows + COL_ROWBLOCK - 1) / COL_ROWBLOCK
+    end
+
+    terra ccsr:col(i: int64, idx: int64): int64
+        var b = i / COL_ROWBLOCK
+        var pos = self.colptr(b) + idx - self.rowptr(b * COL_ROWBLOCK)
+        if self.base(b) >= 0 then
+            return self.base(b) + self.col16(pos)
+        else
+            return self.col32(pos)
+        end
+    end
+
+    terra ccsr:get(i: int64, j: int64)
+        err.assert(i < self.rows and j < self.cols)
+        for idx = self.rowptr(i), self.rowptr(i + 1) do
+            if self:col(i, idx) == j then
+                return [T](self.data(idx))
+            end
+        end
+        return [T](0)
+    end
+
+    -- Rows r0, ..., r1 - 1 of a block with column indices base + col[k]
+    local terraform applyblock(
+        self: &ccsr,
+        r0: int64,
+        r1: int64,
+        col: &C,
+        cb: int64,
+        trans: bool,
+        alpha: T,
+        x: &V1,
+        beta: T,
+        y: &V2
+    ) where {C, V1: Vector, V2: Vector}
+        var first = self.rowptr(r0)
+        if not trans then
+            for i = r0, r1 do
+                var res = [T](0)
+                for idx = self.rowptr(i), self.rowptr(i + 1) do
+                    var j = cb + col[idx - first]
+                    res = res + [T](self.data(idx)) * x:get(j)
+                end
+                y:set(i, alpha * res + beta * y:get(i))
+            end
+        else
+            for i = r0, r1 do
+                var xi = alpha * x:get(i)
+                for idx = self.rowptr(i), self.rowptr(i + 1) do
+                    var j = cb + col[idx - first]
+                    y:set(j, y:get(j) + [T](self.data(idx)) * xi)
+                end
+            end
+        end
+    end
+
+    terraform ccsr:apply(trans: bool, alpha: T, x: &V1, beta: T, y: &V2)
+        where {V1: Vector, V2: Vector}
+        if trans then
+            y:scal(beta)
+        end
+        for b = 0, self:nblocks() do
+            var r0 = b * COL_ROWBLOCK
+            var r1 = terralib.select(
+                r0 + COL_ROWBLOCK < self.rows, r0 + COL_ROWBLOCK, self.rows
+            )
+            var pos = self.colptr(b)
+            if self.base(b) >= 0 then
+                applyblock(
+                    self, r0, r1, &self.col16(pos), self.base(b),
+                    trans, alpha, x, beta, y
+                )
+            else
+                applyblock(
+                    self, r0, r1, &self.col32(pos), 0,
+                    trans, alpha, x, beta, y
+                )
+            end
+        end
+    end
+
+    -- Compressed copy of a CSRMatrix a
+    local fromcsr = terralib.memoize(function(M)
+        return terra(A: Alloc, a: &M)
+            err.assert(a.cols <= 2147483647)
+            var c: ccsr
+            c.rows = a.rows
+            c.cols = a.cols
+            var nnz: int64 = a:nnz()
+            c.rowptr = A:new(sizeof(int64), c.rows + 1)
+            for i = 0, c.rows + 1 do
+                c.rowptr(i) = a.rowptr(i)
+            end
+            c.data = A:new(sizeof(S), terralib.select(nnz > 0, nnz, 1))
+            for idx = 0, nnz do
+                c.data(idx) = [S](a.data(idx))
+            end
+            var nblocks = c:nblocks()
+            c.base = A:new(sizeof(int32), terralib.select(nblocks > 0, nblocks, 1))
+            c.colptr = A:new(sizeof(int64), nblocks + 1)
+            var n16: int64 = 0
+            var n32: int64 = 0
+            for b = 0, nblocks do
+                var r0 = b * COL_ROWBLOCK
+                var r1 = terralib.select(
+                    r0 + COL_ROWBLOCK < c.rows, r0 + COL_ROWBLOCK, c.rows
+                )
+                var len = c.rowptr(r1) - c.rowptr(r0)
+                var lo: int64 = c.cols
+                var hi: int64 = 0
+                for idx = c.rowptr(r0), c.rowptr(r1) do
+                    var j: int64 = a.col(idx)
+                    lo = terralib.select(j < lo, j, lo)
+                    hi = terralib.select(j > hi, j, hi)
+                end
+                if len == 0 or hi - lo < COL_SPAN then
+                    c.base(b) = terralib.select(len > 0, lo, 0)
+                    c.colptr(b) = n16
+                    n16 = n16 + len
+                else
+                    c.base(b) = -1
+                    c.colptr(b) = n32
+                    n32 = n32 + len
+                end
+            end
+            c.col16 = A:new(sizeof(uint16), terralib.select(n16 > 0, n16, 1))
+            c.col32 = A:new(sizeof(int32), terralib.select(n32 > 0, n32, 1))
+            for b = 0, nblocks do
+                var r0 = b * COL_ROWBLOCK
+                var r1 = terralib.select(
+                    r0 + COL_ROWBLOCK < c.rows, r0 + COL_ROWBLOCK, c.rows
+                )
+                var pos = c.colptr(b)
+                for idx = c.rowptr(r0), c.rowptr(r1) do
+                    if c.base(b) >= 0 then
+                        c.col16(pos) = a.col(idx) - c.base(b)
+                    else
+                        c.col32(pos) = a.col(idx)
+                    end
+                    pos = pos + 1
+                end
+            end
+            return c
+        end
+    end)
+
+    ccsr.staticmethods.from = macro(function(A, a)
+        local M = a:gettype()
+        if M:ispointer() then
+            return `[fromcsr(M.type)](A, a)
+        else
+            return `[fromcsr(M)](A, &a)
+        end
+    end)
+
+    return ccsr
+end)
+
+--[=[
+    Symmetric matrix in CSR format that only stores the upper triangle,
+    including the diagonal. A stored entry a(i, j) with j > i contributes
+    a(i, j) x(j) to y(i) and a(i, j) x(i) to the mirrored row y(j).
+
+    The parallel product splits the rows into blocks of about equal number
+    of nonzeros. Mirrored contributions to rows of the same block are
+    written to y directly, contributions to rows below the block are
+    accumulated in a private buffer of the block and summed up in a second
+    pass. The buffer of a block only extends to the largest column index of
+    its rows, so a bandwidth reducing ordering (reorder.t) keeps it small.
+--]=]
+local SymmetricCSRMatrix = parametrized.type(function(T, I)
+    I = I or int32
+    local Vector = concepts.Vector(T)
+    local SmartT = alloc.SmartBlock(T)
+    local SmartI = alloc.SmartBlock(I)
+    local SmartInt = alloc.SmartBlock(int64)
+    local Alloc = alloc.Allocator
+
+    local struct scsr {
+        rows: int64
+        rowptr: SmartI
+        col: SmartI
+        data: SmartT
+        nblocks: int64
+        -- Rows of block b are blkptr(b), ..., blkptr(b + 1) - 1
+        blkptr: SmartInt
+        -- Mirrored contributions of block b reach up to row reach(b) - 1.
+        -- They are buffered from position bufptr(b) in buf.
+        reach: SmartInt
+        bufptr: SmartInt
+        buf: SmartT
+    }
+    scsr.metamethods.__typename = function(self)
+        return ("SymmetricCSRMatrix(%s, %s)"):format(tostring(T), tostring(I))
+    end
+    base.AbstractBase(scsr)
+    scsr.traits.eltype = T
+
+    terra scsr:rows()
+        return self.rows
+    end
+
+    terra scsr:cols()
+        return self.rows
+    end
+
+    -- Number of stored entries in the upper triangle
+    terra scsr:nnz(): int64
+        return self.rowptr(self.rows)
+    end
+
+    terra scsr:get(i: int64, j: int64)
+        err.assert(i < self.rows and j < self.rows)
+        if i > j then
+            i, j = j, i
+        end
+        for idx = self.rowptr(i), self.rowptr(i + 1) do
+            if self.col(idx) == j then
+                return self.data(idx)
+            end
+        end
+        return [T](0)
+    end
+
+    local getblock = terra(self: &scsr, b: int64)
+        var r0 = self.blkptr(b)
+        var r1 = self.blkptr(b + 1)
+        var buf = &self.buf(self.bufptr(b))
+        return r0, r1, buf
+    end
+
+    -- The matrix is symmetric, so trans is ignored. x and y must not alias.
+    -- The buffers are part of the matrix, so concurrent calls of apply on
+    -- the same matrix are not allowed.
+    terraform scsr:apply(trans: bool, alpha: T, x: &V1, beta: T, y: &V2)
+        where {V1: Vector, V2: Vector}
+        err.assert(x:size() == self.rows and y:size() == self.rows)
+        var rn = [range.Unitrange(int64)].new(0, self.nblocks)
+        var allocator: alloc.DefaultAllocator()
+        -- Upper triangle and mirrored entries within each block
+        thread.parfor(
+            &allocator,
+            rn,
+            lambda.new(
+                [
+                    terra(
+                        b: int64,
+                        self: &scsr,
+                        alpha: T,
+                        x: x.type,
+                        beta: T,
+                        y: y.type
+                    )
+                        var r0, r1, buf = getblock(self, b)
+                        for i = r0, r1 do
+                            y:set(i, beta * y:get(i))
+                        end
+                        for k = 0, self.reach(b) - r1 do
+                            buf[k] = 0
+                        end
+                        for i = r0, r1 do
+                            var xi = alpha * x:get(i)
+                            var res = [T](0)
+                            for idx = self.rowptr(i), self.rowptr(i + 1) do
+                                var j: int64 = self.col(idx)
+                                var a = self.data(idx)
+                                res = res + a * x:get(j)
+                                if j > i then
+                                    if j < r1 then
+                                        y:set(j, y:get(j) + a * xi)
+                                    else
+                                        buf[j - r1] = buf[j - r1] + a * xi
+                                    end
+                                end
+                            end
+                            y:set(i, y:get(i) + alpha * res)
+                        end
+                    end
+                ],
+                {self = self, alpha = alpha, x = x, beta = beta, y = y}
+            )
+        )
+        -- Mirrored entries from the buffers of the preceding blocks
+        thread.parfor(
+            &allocator,
+            rn,
+            lambda.new(
+                [
+                    terra(b: int64, self: &scsr, y: y.type)
+                        var r0 = self.blkptr(b)
+                        var r1 = self.blkptr(b + 1)
+                        for c = 0, b do
+                            var s0, s1, buf = getblock(self, c)
+                            var reach = self.reach(c)
+                            var i1 = terralib.select(reach < r1, reach, r1)
+                            for i = r0, i1 do
+                                y:set(i, y:get(i) + buf[i - s1])
+                            end
+                        end
+                    end
+                ],
+                {self = self, y = y}
+            )
+        )
+    end
+
+    -- Upper triangle of the symmetric CSRMatrix a. The strictly lower
+    -- triangle of a is ignored.
+    local fromcsr = terralib.memoize(function(M)
+        return terra(A: Alloc, a: &M)
+            err.assert(a.rows == a.cols)
+            var s: scsr
+            s.rows = a.rows
+            s.rowptr = A:new(sizeof(I), s.rows + 1)
+            s.rowptr(0) = 0
+            for i = 0, s.rows do
+                var len: I = 0
+                for idx = a.rowptr(i), a.rowptr(i + 1) do
+                    if a.col(idx) >= i then
+                        len = len + 1
+                    end
+                end
+                s.rowptr(i + 1) = s.rowptr(i) + len
+            end
+            var nnz = s:nnz()
+            var cap = terralib.select(nnz > 0, nnz, 1)
+            s.col = A:new(sizeof(I), cap)
+            s.data = A:new(sizeof(T), cap)
+            var pos: int64 = 0
+            for i = 0, s.rows do
+                for idx = a.rowptr(i), a.rowptr(i + 1) do
+                    if a.col(idx) >= i then
+                        s.col(pos) = a.col(idx)
+                        s.data(pos) = a.data(idx)
+                        pos = pos + 1
+                    end
+                end
+            end
+            -- Blocks with about the same number of stored entries
+            var nblocks: int64 = thread.omp_get_num_threads()
+            nblocks = terralib.select(nblocks < s.rows, nblocks, s.rows)
+            nblocks = terralib.select(nblocks > 0, nblocks, 1)
+            s.nblocks = nblocks
+            s.blkptr = A:new(sizeof(int64), nblocks + 1)
+            s.reach = A:new(sizeof(int64), nblocks)
+            s.bufptr = A:new(sizeof(int64), nblocks + 1)
+            s.blkptr(0) = 0
+            var i: int64 = 0
+            for b = 1, nblocks do
+                var target = (b * nnz) / nblocks
+                while i < s.rows and s.rowptr(i) < target do
+                    i = i + 1
+                end
+                s.blkptr(b) = i
+            end
+            s.blkptr(nblocks) = s.rows
+            s.bufptr(0) = 0
+            for b = 0, nblocks do
+                var r0 = s.blkptr(b)
+                var r1 = s.blkptr(b + 1)
+                var reach = r1
+                for idx = s.rowptr(r0), s.rowptr(r1) do
+                    var j: int64 = s.col(idx)
+                    reach = terralib.select(j + 1 > reach, j + 1, reach)
+                end
+                s.reach(b) = reach
+                s.bufptr(b + 1) = s.bufptr(b) + reach - r1
+            end
+            var len = s.bufptr(nblocks)
+            s.buf = A:new(sizeof(T), terralib.select(len > 0, len, 1))
+            return s
+        end
+    end)
+
+    scsr.staticmethods.from = macro(function(A, a)
+        local M = a:gettype()
+        if M:ispointer() then
+            return `[fromcsr(M.type)](A, a)
+        else
+            return `[fromcsr(M)](A, &a)
+        end
+    end)
+
+    return scsr
+end)
+
 return {
     CSRMatrix = CSRMatrix,
+    CompressedCSRMatrix = CompressedCSRMatrix,
+    SymmetricCSRMatrix = SymmetricCSRMatrix,
 }
@@ -0,0 +1,488 @@
+-- SPDX-FileCopyrightText: 2024 René Hiemstra <rrhiemstar@gmail.com>
+-- SPDX-FileCopyrightText: 2024 Torsten Keßler <t.kessler@posteo.de>
+-- SPDX-FileCopyrightText: 2025 René Hiemstra <rrhiemstar@gmail.com>
+-- SPDX-FileCopyrightText: 2025 Torsten Keßler <t.kessler@posteo.de>
+--
+-- SPDX-License-Identifier: MIT
+
+require "terralibext"
+
+local alloc = require("alloc")
+local base = require("base")
+local err = require("assert")
+local lambda = require("lambda")
+local range = require("range")
+local sparse = require("sparse")
+local stack = require("stack")
+local thread = require("thread")
+local parametrized = require("parametrized")
+
+local C = terralib.includecstring[[
+    #include <stdio.h>
+    #include <stdlib.h>
+    #include <string.h>
+    #include <strings.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+]]
+
+local size_t = uint64
+local Alloc = alloc.Allocator
+
+--
+-- Matrix Market
+-- https://math.nist.gov/MatrixMarket/formats.html
+--
+-- Only the coordinate format is supported. Entries of real, integer and
+-- pattern type are read in double precision and converted to the element
+-- type of the matrix. Symmetric and skew-symmetric matrices are expanded
+-- to full storage.
+--
+local GENERAL = 0
+local SYMMETRIC = 1
+local SKEW = 2
+
+local struct mtxheader {
+    rows: int64
+    cols: int64
+    nnz: int64
+    pattern: bool
+    symmetry: int
+    -- First line with matrix entries
+    data: &int8
+}
+
+-- Advance p to the beginning of the next line or to the end of the buffer.
+local terra nextline(p: &int8, last: &int8)
+    while p < last and @p ~= @"\n" do
+        p = p + 1
+    end
+    return terralib.select(p < last, p + 1, last)
+end
+
+-- Lines with matrix entries start with the (one based) row index.
+-- Everything else is either a comment or an empty line.
+local terra isentry(p: &int8, last: &int8)
+    while p < last and (@p == @" " or @p == @"\t") do
+        p = p + 1
+    end
+    return p < last and @p >= @"0" and @p <= @"9"
+end
+
+local terra parseheader(p: &int8, last: &int8)
+    var obj: int8[64]
+    var fmt: int8[64]
+    var field: int8[64]
+    var sym: int8[64]
+    var n = C.sscanf(
+        p,
+        "%%%%MatrixMarket %63s %63s %63s %63s",
+        &obj[0],
+        &fmt[0],
+        &field[0],
+        &sym[0]
+    )
+    err.assert(n == 4)
+    err.assert(C.strcasecmp(&obj[0], "matrix") == 0)
+    err.assert(C.strcasecmp(&fmt[0], "coordinate") == 0)
+    var h: mtxheader
+    h.pattern = C.strcasecmp(&field[0], "pattern") == 0
+    err.assert(
+        h.pattern
+        or C.strcasecmp(&field[0], "real") == 0
+        or C.strcasecmp(&field[0], "integer") == 0
+    )
+    if C.strcasecmp(&sym[0], "general") == 0 then
+        h.symmetry = GENERAL
+    elseif C.strcasecmp(&sym[0], "symmetric") == 0 then
+        h.symmetry = SYMMETRIC
+    elseif C.strcasecmp(&sym[0], "skew-symmetric") == 0 then
+        h.symmetry = SKEW
+    else
+        err.assert(false)
+    end
+    -- Skip comments until we reach the size line
+    p = nextline(p, last)
+    while p < last and not isentry(p, last) do
+        p = nextline(p, last)
+    end
+    n = C.sscanf(p, "%ld %ld %ld", &h.rows, &h.cols, &h.nnz)
+    err.assert(n == 3)
+    h.data = nextline(p, last)
+    return h
+end
+
+-- Split [first, last) into nchunks pieces that each start at the beginning
+-- of a line.
+local terra chunkbounds(first: &int8, last: &int8, nchunks: int64, bounds: &&int8)
+    var len = last - first
+    bounds[0] = first
+    for k = 1, nchunks do
+        var p = first + len * k / nchunks
+        if p < bounds[k - 1] then
+            p = bounds[k - 1]
+        end
+        if p > first and @(p - 1) ~= @"\n" then
+            p = nextline(p, last)
+        end
+        bounds[k] = p
+    end
+    bounds[nchunks] = last
+end
+
+-- Count the entries of chunk k including mirrored entries of symmetric
+-- matrices. lines[k] is the number of entries as stored in the file.
+local terra countchunk(
+    k: int64, bounds: &&int8, symmetry: int, counts: &int64, lines: &int64
+)
+    var p = bounds[k]
+    var last = bounds[k + 1]
+    var cnt: int64 = 0
+    var nlines: int64 = 0
+    while p < last do
+        if isentry(p, last) then
+            var q: &int8
+            var i = C.strtoll(p, &q, 10)
+            var j = C.strtoll(q, &q, 10)
+            cnt = cnt + terralib.select(symmetry ~= GENERAL and i ~= j, 2, 1)
+            nlines = nlines + 1
+        end
+        p = nextline(p, last)
+    end
+    counts[k] = cnt
+    lines[k] = nlines
+end
+
+local terra readfile(A: Alloc, filename: rawstring)
+    var f = C.fopen(filename, "rb")
+    err.assert(f ~= nil)
+    C.fseek(f, 0, C.SEEK_END)
+    var len = C.ftell(f)
+    C.fseek(f, 0, C.SEEK_SET)
+    -- Terminate the buffer so that strtod and friends stop at the end.
+    var buf: alloc.SmartBlock(int8) = A:new(sizeof(int8), len + 1)
+    var nread = C.fread(&buf(0), 1, len, f)
+    C.fclose(f)
+    err.assert(nread == len)
+    buf(len) = 0
+    return buf
+end
+
+--
+-- Binary format
+--
+-- The file starts with a header followed by rowptr, col and data in the
+-- same layout as in CSRMatrix. Each section starts at a multiple of
+-- ALIGNMENT bytes, so that the file can be mapped into memory and used
+-- directly as the storage of a CSRMatrix.
+--
+local MAGIC = "CSRBIN01"
+local ALIGNMENT = 64
+
+local struct binheader {
+    magic: int8[8]
+    eltsize: uint32
+    idxsize: uint32
+    rows: uint64
+    cols: uint64
+    nnz: uint64
+}
+
+local terra align(n: size_t)
+    return (n + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT
+end
+
+-- Byte offsets of rowptr, col and data, and the total size of the file.
+local terra binoffsets(h: &binheader)
+    var rowptroff = align(sizeof(binheader))
+    var coloff = align(rowptroff + (h.rows + 1) * h.idxsize)
+    var dataoff = align(coloff + h.nnz * h.idxsize)
+    var total = dataoff + h.nnz * h.eltsize
+    return rowptroff, coloff, dataoff, total
+end
+
+local terra pad(f: &C.FILE, from: size_t, to: size_t)
+    for i = from, to do
+        C.fputc(0, f)
+    end
+end
+
+local CSRIO = parametrized.type(function(T, I)
+    local CSR = sparse.CSRMatrix(T, I)
+    local ST = stack.DynamicStack(T)
+    local SI = stack.DynamicStack(I)
+    local SmartI = alloc.SmartBlock(I)
+    local SmartT = alloc.SmartBlock(T)
+
+    local struct csrio {}
+    csrio.metamethods.__typename = function(self)
+        return ("CSRIO(%s, %s)"):format(tostring(T), tostring(I))
+    end
+    base.AbstractBase(csrio)
+
+    -- Parse chunk k into the coordinate arrays starting at offsets[k].
+    local terra fillchunk(
+        k: int64,
+        bounds: &&int8,
+        h: &mtxheader,
+        offsets: &int64,
+        row: &I,
+        col: &I,
+        val: &T
+    )
+        var p = bounds[k]
+        var last = bounds[k + 1]
+        var pos = offsets[k]
+        while p < last do
+            if isentry(p, last) then
+                var q: &int8
+                var i = C.strtoll(p, &q, 10) - 1
+                var j = C.strtoll(q, &q, 10) - 1
+                var v: double = 1
+                if not h.pattern then
+                    v = C.strtod(q, &q)
+                end
+                err.assert(i >= 0 and i < h.rows and j >= 0 and j < h.cols)
+                row[pos] = i
+                col[pos] = j
+                val[pos] = [T](v)
+                pos = pos + 1
+                if h.symmetry ~= GENERAL and i ~= j then
+                    row[pos] = j
+                    col[pos] = i
+                    val[pos] = [T](terralib.select(h.symmetry == SKEW, -v, v))
+                    pos = pos + 1
+                end
+            end
+            p = nextline(p, last)
+        end
+    end
+
+    -- Read a matrix in Matrix Market coordinate format. The file is read
+    -- into memory at once and then parsed in parallel in chunks of lines.
+    -- Column indices are sorted within each row.
+    csrio.staticmethods.readmtx = terra(A: Alloc, filename: rawstring)
+        var buf = readfile(A, filename)
+        var first = &buf(0)
+        var last = first + (buf:size() - 1)
+        var h = parseheader(first, last)
+
+        var nchunks: int64 = 4 * thread.omp_get_num_threads()
+        var bounds: alloc.SmartBlock(&int8) = A:new(sizeof([&int8]), nchunks + 1)
+        var counts: alloc.SmartBlock(int64) = A:new(sizeof(int64), nchunks + 1)
+        var lines: alloc.SmartBlock(int64) = A:new(sizeof(int64), nchunks)
+        chunkbounds(h.data, last, nchunks, &bounds(0))
+        var rn = [range.Unitrange(int64)].new(0, nchunks)
+        do
+            var allocator: alloc.DefaultAllocator()
+            thread.parfor(
+                &allocator,
+                rn,
+                lambda.new(
+                    countchunk,
+                    {
+                        bounds = &bounds(0),
+                        symmetry = h.symmetry,
+                        counts = &counts(0),
+                        lines = &lines(0)
+                    }
+                )
+            )
+        end
+        var total: int64 = 0
+        var nlines: int64 = 0
+        for k = 0, nchunks do
+            var cnt = counts(k)
+            counts(k) = total
+            total = total + cnt
+            nlines = nlines + lines(k)
+        end
+        -- The size line counts the stored entries, before mirroring. A
+        -- truncated or corrupted file must not be read as a smaller matrix.
+        err.assert(nlines == h.nnz)
+
+        var cap = terralib.select(total > 0, total, 1)
+        var row: SmartI = A:new(sizeof(I), cap)
+        var col: SmartI = A:new(sizeof(I), cap)
+        var val: SmartT = A:new(sizeof(T), cap)
+        do
+            var allocator: alloc.DefaultAllocator()
+            thread.parfor(
+                &allocator,
+                rn,
+                lambda.new(
+                    fillchunk,
+                    {
+                        bounds = &bounds(0),
+                        h = &h,
+                        offsets = &counts(0),
+                        row = &row(0),
+                        col = &col(0),
+                        val = &val(0)
+                    }
+                )
+            )
+        end
+
+        -- Convert from coordinate to CSR format by counting sort on the rows
+        -- and insertion sort on the columns of each row.
+        var a: CSR
+        a.rows = h.rows
+        a.cols = h.cols
+        a.rowptr = SI.new(A, a.rows + 1)
+        for i = 0, a.rows + 1 do
+            a.rowptr:push(0)
+        end
+        for e = 0, total do
+            a.rowptr(row(e) + 1) = a.rowptr(row(e) + 1) + 1
+        end
+        for i = 0, a.rows do
+            a.rowptr(i + 1) = a.rowptr(i + 1) + a.rowptr(i)
+        end
+        a.data = ST.new(A, cap)
+        a.col = SI.new(A, cap)
+        for e = 0, total do
+            a.data:push(0)
+            a.col:push(0)
+        end
+        var slot: SmartI = A:new(sizeof(I), a.rows + 1)
+        for i = 0, a.rows do
+            slot(i) = a.rowptr(i)
+        end
+        for e = 0, total do
+            var i = row(e)
+            var pos = slot(i)
+            a.col(pos) = col(e)
+            a.data(pos) = val(e)
+            slot(i) = pos + 1
+        end
+        for i = 0, a.rows do
+            var start = a.rowptr(i)
+            for idx = start + 1, a.rowptr(i + 1) do
+                var j = a.col(idx)
+                var x = a.data(idx)
+                var l = idx
+                while l > start and a.col(l - 1) > j do
+                    a.col(l) = a.col(l - 1)
+                    a.data(l) = a.data(l - 1)
+                    l = l - 1
+                end
+                a.col(l) = j
+                a.data(l) = x
+            end
+        end
+        return a
+    end
+
+    -- Write a matrix in Matrix Market coordinate format with general
+    -- symmetry. Values are written in double precision.
+    csrio.staticmethods.writemtx = terra(a: &CSR, filename: rawstring)
+        var f = C.fopen(filename, "w")
+        err.assert(f ~= nil)
+        C.fprintf(f, "%%%%MatrixMarket matrix coordinate real general\n")
+        C.fprintf(
+            f,
+            "%lld %lld %lld\n",
+            [int64](a.rows),
+            [int64](a.cols),
+            [int64](a:nnz())
+        )
+        for i = 0, a.rows do
+            for idx = a.rowptr(i), a.rowptr(i + 1) do
+                C.fprintf(
+                    f,
+                    "%lld %lld %.17g\n",
+                    [int64](i + 1),
+                    [int64](a.col(idx) + 1),
+                    [double](a.data(idx))
+                )
+            end
+        end
+        C.fclose(f)
+    end
+
+    csrio.staticmethods.writebinary = terra(a: &CSR, filename: rawstring)
+        var h: binheader
+        C.memcpy(&h.magic[0], MAGIC, 8)
+        h.eltsize = sizeof(T)
+        h.idxsize = sizeof(I)
+        h.rows = a.rows
+        h.cols = a.cols
+        h.nnz = a:nnz()
+        var rowptroff, coloff, dataoff, total = binoffsets(&h)
+        var f = C.fopen(filename, "wb")
+        err.assert(f ~= nil)
+        C.fwrite(&h, sizeof(binheader), 1, f)
+        pad(f, sizeof(binheader), rowptroff)
+        C.fwrite(a.rowptr:getdataptr(), sizeof(I), h.rows + 1, f)
+        pad(f, rowptroff + (h.rows + 1) * sizeof(I), coloff)
+        C.fwrite(a.col:getdataptr(), sizeof(I), h.nnz, f)
+        pad(f, coloff + h.nnz * sizeof(I), dataoff)
+        C.fwrite(a.data:getdataptr(), sizeof(T), h.nnz, f)
+        C.fclose(f)
+    end
+
+    -- A CSRMatrix whose storage is a private memory mapping of a binary file.
+    -- The mapping is released when the object goes out of scope.
+    local struct mapped {
+        ptr: &opaque
+        len: size_t
+        matrix: CSR
+    }
+    mapped.metamethods.__typename = function(self)
+        return ("MappedCSRMatrix(%s, %s)"):format(tostring(T), tostring(I))
+    end
+    base.AbstractBase(mapped)
+    csrio.mapped = mapped
+
+    terra mapped:__init()
+        self.ptr = nil
+        self.len = 0
+    end
+
+    terra mapped:__dtor()
+        if self.ptr ~= nil then
+            C.munmap(self.ptr, self.len)
+            self.ptr = nil
+        end
+    end
+
+    -- Map a binary file into memory. The arrays of the matrix point directly
+    -- into the mapping, so no data is copied. The mapping is private, that is
+    -- changes to the matrix values are not written back to the file.
+    csrio.staticmethods.readbinary = terra(filename: rawstring)
+        var fd = C.open(filename, C.O_RDONLY)
+        err.assert(fd >= 0)
+        var len: size_t = C.lseek(fd, 0, C.SEEK_END)
+        var ptr = C.mmap(
+            nil, len, C.PROT_READ or C.PROT_WRITE, C.MAP_PRIVATE, fd, 0
+        )
+        C.close(fd)
+        err.assert(ptr ~= [&opaque]([int64](-1)))
+        var h = [&binheader](ptr)
+        err.assert(C.memcmp(&h.magic[0], MAGIC, 8) == 0)
+        err.assert(h.eltsize == sizeof(T) and h.idxsize == sizeof(I))
+        var rowptroff, coloff, dataoff, total = binoffsets(h)
+        err.assert(total <= len)
+        var bytes = [&int8](ptr)
+        var m: mapped
+        m.ptr = ptr
+        m.len = len
+        m.matrix = CSR.frombuffer(
+            h.rows,
+            h.cols,
+            h.nnz,
+            [&T](bytes + dataoff),
+            [&I](bytes + coloff),
+            [&I](bytes + rowptroff)
+        )
+        return m
+    end
+
+    return csrio
+end)
+
+return {
+    CSRIO = CSRIO,
+}
@@ -0,0 +1,112 @@
+-- SPDX-FileCopyrightText: 2024 René Hiemstra <rrhiemstar@gmail.com>
+-- SPDX-FileCopyrightText: 2024 Torsten Keßler <t.kessler@posteo.de>
+-- SPDX-FileCopyrightText: 2025 René Hiemstra <rrhiemstar@gmail.com>
+-- SPDX-FileCopyrightText: 2025 Torsten Keßler <t.kessler@posteo.de>
+--
+-- SPDX-License-Identifier: MIT
+
+import "terratest/terratest"
+
+local assembly = require("assembly")
+local alloc = require("alloc")
+local sparse = require("sparse")
+local lambda = require("lambda")
+local tmath = require("tmath")
+
+local tols = {
+    [float] = `1e-5f,
+    [double] = `1e-13,
+}
+
+for T, tol in pairs(tols) do
+    for _, I in pairs({int32, int64}) do
+        local Alloc = alloc.DefaultAllocator()
+        local CSR = sparse.CSRMatrix(T, I)
+        local Assembly = assembly.Assembly(T, I)
+
+        testenv(T, I) "Parallel assembly" do
+            -- Bilinear quadrilaterals on a m x m grid of elements. Element e
+            -- has the element matrix m(k, l) = (e + 1) * (k == l ? 3 : -1).
+            local m = 30
+            terracode
+                var alloc: Alloc
+                var nodes = m + 1
+                var n = nodes * nodes
+                var nelem = m * m
+                var dofs: I[4 * m * m]
+                for i = 0, m do
+                    for j = 0, m do
+                        var e = m * i + j
+                        dofs[4 * e + 0] = nodes * i + j
+                        dofs[4 * e + 1] = nodes * i + j + 1
+                        dofs[4 * e + 2] = nodes * (i + 1) + j
+                        dofs[4 * e + 3] = nodes * (i + 1) + j + 1
+                    end
+                end
+                var kernel = lambda.new(
+                    terra(e: I, mat: &T)
+                        for k = 0, 4 do
+                            for l = 0, 4 do
+                                mat[4 * k + l] = (e + 1) * terralib.select(k == l, 3, -1)
+                            end
+                        end
+                    end
+                )
+                -- Serial reference
+                var ref = CSR.new(&alloc, n, n)
+                for e = 0, nelem do
+                    for k = 0, 4 do
+                        for l = 0, 4 do
+                            var r = dofs[4 * e + k]
+                            var c = dofs[4 * e + l]
+                            var v: T = (e + 1) * terralib.select(k == l, 3, -1)
+                            ref:set(r, c, ref:get(r, c) + v)
+                        end
+                    end
+                end
+                var a = CSR.new(&alloc, n, n)
+                var asm = Assembly.new(&alloc, &a, nelem, 4, &dofs[0])
+            end
+
+            testset "Pattern" do
+                terracode
+                    var same = true
+                    for i = 0, n + 1 do
+                        same = same and a.rowptr(i) == ref.rowptr(i)
+                    end
+                    for idx = 0, ref:nnz() do
+                        same = same and a.col(idx) == ref.col(idx)
+                    end
+                end
+                test a:nnz() == ref:nnz()
+                test same
+                -- Interior nodes touch four elements, so four colors suffice
+                test asm.ncolors == 4
+            end
+
+            testset "Coloring" do
+                terracode
+                    var ok = true
+                    asm:assemble(&a, kernel)
+                    -- Repeated assembly only updates the values
+                    asm:assemble(&a, kernel)
+                    for idx = 0, ref:nnz() do
+                        ok = ok and tmath.isapprox(a.data(idx), ref.data(idx), [tol])
+                    end
+                end
+                test ok
+            end
+
+            testset "Atomic" do
+                terracode
+                    var ok = true
+                    asm:atomicassemble(&a, kernel)
+                    for idx = 0, ref:nnz() do
+                        ok = ok and tmath.isapprox(a.data(idx), ref.data(idx), [tol])
+                    end
+                end
+                test ok
+            end
+        end
+    end
+end
@@ -0,0 +1,99 @@
+-- SPDX-FileCopyrightText: 2024 René Hiemstra <rrhiemstar@gmail.com>
+-- SPDX-FileCopyrightText: 2024 Torsten Keßler <t.kessler@posteo.de>
+-- SPDX-FileCopyrightText: 2025 René Hiemstra <rrhiemstar@gmail.com>
+-- SPDX-FileCopyrightText: 2025 Torsten Keßler <t.kessler@posteo.de>
+--
+-- SPDX-License-Identifier: MIT
+
+import "terratest/terratest"
+
+local banded = require("banded")
+local alloc = require("alloc")
+local random = require("random")
+local complex = require("complex")
+local nfloat = require("nfloat")
+local darray = require("darray")
+local tmath = require("tmath")
+
+local float128 = nfloat.FixedFloat(128)
+local tol = {["float"] = 1e-6,
+             ["double"] = 1e-15,
+             [tostring(float128)] = `[float128]("1e-30"),
+            }
+
+for _, Ts in pairs({float, double, float128}) do
+    for _, is_complex in pairs({false, true}) do
+        local T = is_complex and complex.complex(Ts) or Ts
+        local unit = is_complex and T:unit() or 0
+        local Band = banded.BandedMatrix(T)
+        local BandLU = banded.BandedLUFactory(T)
+        local DVec = darray.DynamicVector(T)
+        local Alloc = alloc.DefaultAllocator()
+        local Rand = random.LibC(float)
+
+        testenv(T) "Banded matrix" do
+            terracode
+                var alloc: Alloc
+                var a = Band.new(&alloc, 5, 1, 2)
+                a:set(3, 2, [T](1))
+                a:set(2, 4, [T](2))
+            end
+
+            test a:rows() == 5 and a:cols() == 5
+            test a:get(3, 2) == [T](1)
+            test a:get(2, 4) == [T](2)
+            -- Entries outside the band are zero
+            test a:get(4, 2) == [T](0)
+            test a:get(0, 3) == [T](0)
+        end
+
+        testenv(T) "Banded LU factorization" do
+            local n = 37
+            local kl = 2
+            local ku = 3
+            terracode
+                var alloc: Alloc
+                var rand = Rand.new(730125)
+                var a = Band.new(&alloc, n, kl, ku)
+                var x = DVec.new(&alloc, n)
+                var y = DVec.zeros(&alloc, n)
+                var yt = DVec.zeros(&alloc, n)
+                for i = 0, n do
+                    x(i) = rand:random_normal(0, 1) + [unit] * rand:random_normal(0, 1)
+                end
+                -- Random entries without diagonal dominance, so rows are
+                -- interchanged during the factorization.
+                for j: int64 = 0, n do
+                    for i: int64 = j - ku, j + kl + 1 do
+                        if i >= 0 and i < n then
+                            a:set(i, j, rand:random_normal(0, 1) + [unit] * rand:random_normal(0, 1))
+                        end
+                    end
+                end
+                for i: int64 = 0, n do
+                    for j: int64 = 0, n do
+                        y(i) = y(i) + a:get(i, j) * x(j)
+                        yt(i) = yt(i) + tmath.conj(a:get(j, i)) * x(j)
+                    end
+                end
+                var tol: Ts = [ tol[tostring(Ts)] ]
+                var lu = BandLU.new(&alloc, &a)
+                lu:factorize()
+                lu:solve(false, &y)
+                lu:solve(true, &yt)
+            end
+
+            testset "Solve" do
+                for i = 0, n - 1 do
+                    test tmath.abs(y(i) - x(i)) < 1000 * tol * tmath.abs(x(i)) + tol
+                end
+            end
+
+            testset "Solve transposed" do
+                for i = 0, n - 1 do
+                    test tmath.abs(yt(i) - x(i)) < 1000 * tol * tmath.abs(x(i)) + tol
+                end
+            end
+        end
+    end
+end
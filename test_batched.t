@@ -0,0 +1,166 @@
+-- SPDX-FileCopyrightText: 2024 René Hiemstra <rrhiemstar@gmail.com>
+-- SPDX-FileCopyrightText: 2024 Torsten Keßler <t.kessler@posteo.de>
+-- SPDX-FileCopyrightText: 2025 René Hiemstra <rrhiemstar@gmail.com>
+-- SPDX-FileCopyrightText: 2025 Torsten Keßler <t.kessler@posteo.de>
+--
+-- SPDX-License-Identifier: MIT
+
+import "terratest/terratest"
+
+local batched = require("batched")
+local alloc = require("alloc")
+local random = require("random")
+local tmath = require("tmath")
+
+local tols = {
+    [float] = `1e-4f,
+    [double] = `1e-12,
+}
+
+for T, tol in pairs(tols) do
+    local Batch = batched.BatchedMatrix(T)
+    local Alloc = alloc.DefaultAllocator()
+    local Rand = random.LibC(float)
+
+    local terra isapprox(y: &Batch, x: &Batch)
+        var ok = true
+        for e = 0, x.count do
+            for i = 0, x.rows do
+                for j = 0, x.cols do
+                    ok = ok and tmath.isapprox(y:get(e, i, j), x:get(e, i, j), [tol])
+                end
+            end
+        end
+        return ok
+    end
+
+    -- Counts are no multiples of the SIMD width, so the last chunk is
+    -- padded. The larger batch is split across the thread pool.
+    for _, count in pairs({37, 301}) do
+        testenv(T, count) "Batched factorizations" do
+            local n = 6
+            local nrhs = 2
+            terracode
+                var alloc: Alloc
+                var rand = Rand.new(44021)
+                -- Symmetric positive definite matrices a = b b^T + n I
+                var a = Batch.new(&alloc, count, n, n)
+                var b = Batch.new(&alloc, count, n, n)
+                var x = Batch.new(&alloc, count, n, nrhs)
+                for e = 0, count do
+                    for i = 0, n do
+                        for j = 0, n do
+                            b:set(e, i, j, rand:random_normal(0, 1))
+                        end
+                        for j = 0, nrhs do
+                            x:set(e, i, j, rand:random_normal(0, 1))
+                        end
+                    end
+                    for i = 0, n do
+                        for j = 0, n do
+                            var sum = [T](terralib.select(i == j, n, 0))
+                            for k = 0, n do
+                                sum = sum + b:get(e, i, k) * b:get(e, j, k)
+                            end
+                            a:set(e, i, j, sum)
+                        end
+                    end
+                end
+                var alu = Batch.new(&alloc, count, n, n)
+                var acho = Batch.new(&alloc, count, n, n)
+                var aqr = Batch.new(&alloc, count, n, n)
+                var ylu = Batch.new(&alloc, count, n, nrhs)
+                var ycho = Batch.new(&alloc, count, n, nrhs)
+                var yqr = Batch.new(&alloc, count, n, nrhs)
+                for e = 0, count do
+                    for i = 0, n do
+                        for j = 0, n do
+                            alu:set(e, i, j, a:get(e, i, j))
+                            acho:set(e, i, j, a:get(e, i, j))
+                            aqr:set(e, i, j, a:get(e, i, j))
+                        end
+                        for j = 0, nrhs do
+                            var sum = [T](0)
+                            for k = 0, n do
+                                sum = sum + a:get(e, i, k) * x:get(e, k, j)
+                            end
+                            ylu:set(e, i, j, sum)
+                            ycho:set(e, i, j, sum)
+                            yqr:set(e, i, j, sum)
+                        end
+                    end
+                end
+            end
+
+            testset "LU" do
+                terracode
+                    var lu = [batched.BatchedLU(T)].new(&alloc, &alu)
+                    lu:factorize()
+                    lu:solve(&ylu)
+                end
+                test isapprox(&ylu, &x)
+            end
+
+            testset "Cholesky" do
+                terracode
+                    var cho = [batched.BatchedCholesky(T)].new(&alloc, &acho)
+                    cho:factorize()
+                    cho:solve(&ycho)
+                end
+                test isapprox(&ycho, &x)
+            end
+
+            testset "QR" do
+                terracode
+                    var qr = [batched.BatchedQR(T)].new(&alloc, &aqr)
+                    qr:factorize()
+                    qr:solve(&yqr)
+                end
+                test isapprox(&yqr, &x)
+            end
+
+            testset "LU with pivoting" do
+                terracode
+                    -- Rows of a nonsymmetric, diagonally dominant matrix d
+                    -- shifted by e mod n, so that the pivot rows differ from
+                    -- lane to lane. Below the diagonal, the first column of d is
+                    -- zero, tiny or of order one depending on e. Without
+                    -- pivoting, the factorization breaks down or loses all
+                    -- accuracy in these lanes.
+                    var ap = Batch.new(&alloc, count, n, n)
+                    var yp = Batch.new(&alloc, count, n, nrhs)
+                    for e = 0, count do
+                        var s = e % n
+                        for i = 0, n do
+                            var r = (i + s) % n
+                            for j = 0, n do
+                                var dij = [T](rand:random_normal(0, 1))
+                                if r == j then
+                                    dij = 2 * n
+                                elseif j == 0 and e % 3 == 0 then
+                                    dij = 0
+                                elseif j == 0 and e % 3 == 1 then
+                                    dij = [T](1e-3) * dij
+                                end
+                                ap:set(e, i, j, dij)
+                            end
+                        end
+                        for i = 0, n do
+                            for j = 0, nrhs do
+                                var sum = [T](0)
+                                for k = 0, n do
+                                    sum = sum + ap:get(e, i, k) * x:get(e, k, j)
+                                end
+                                yp:set(e, i, j, sum)
+                            end
+                        end
+                    end
+                    var lu = [batched.BatchedLU(T)].new(&alloc, &ap)
+                    lu:factorize()
+                    lu:solve(&yp)
+                end
+                test isapprox(&yp, &x)
+            end
+        end
+    end
+end
@@ -263,6 +263,67 @@ testenv "Full Phasespace Integral" do
             test tmath.isapprox(resval(i, j), refval(i, j), 1e-5)
         end
     end
+
+    testset "Multiple directions" do
+        local ndir = 8
+        terracode
+            -- Direction l is (l + 1) times the direction of the single call
+            var tngs = dMat.new(&alloc, {ndir, 3 * 4})
+            for l = 0, ndir do
+                for k = 0, 3 * 4 do
+                    tngs(l, k) = l + 1
+                end
+            end
+            var resvals = dMat.new(&alloc, {ntestx, ntestv})
+            var restngs = dMat.new(&alloc, {ndir, ntestx * ntestv})
+            bc.pressurebc8(
+                    ntestx,
+                    ntestv,
+                    --
+                    ntrialx,
+                    ntrialv,
+                    --
+                    &val(0, 0),
+                    &tngs(0, 0),
+                    --
+                    npts,
+                    ndim,
+                    &normal(0, 0),
+                    --
+                    testx.data:size(),
+                    &testx.data(0),
+                    &testx.col(0),
+                    &testx.rowptr(0),
+                    --
+                    trialx.data:size(),
+                    &trialx.data(0),
+                    &trialx.col(0),
+                    &trialx.rowptr(0),
+                    --
+                    1.0,
+                    &u[0],
+                    1.0,
+                    --
+                    &test_powers(0, 0),
+                    &trial_powers(0, 0),
+                    --
+                    &resvals(0, 0),
+                    &restngs(0, 0),
+                    pressure
+            )
+        end
+
+        for i = 0, 1 do
+            for j = 0, 2 do
+                test tmath.isapprox(resvals(i, j), resval(i, j), 1e-12)
+                for l = 0, ndir - 1 do
+                    test tmath.isapprox(
+                        restngs(l, j + 3 * i), (l + 1) * restng(i, j), 1e-10
+                    )
+                end
+            end
+        end
+    end
 end
 
 testenv "Half space integral interface" do
@@ -15,6 +15,7 @@ local nfloat = require("nfloat")
 local darray = require("darray")
 local matrix = require("matrix")
 local tmath = require("tmath")
+local concepts = require("concepts")
 
 local float128 = nfloat.FixedFloat(128)
 local float1024 = nfloat.FixedFloat(1024)
@@ -103,5 +104,103 @@ for _, Ts in pairs({float, double, float128, float1024}) do
                 end
             end
         end
+
+        testenv(T) "Cholesky factorization with multiple right-hand sides" do
+            local n = 41
+            -- More right-hand sides than NRHS_BLOCK with a partial last block
+            local nrhs = 70
+            terracode
+                var alloc: Alloc
+                var rand = Rand.new(22391)
+                var a = DMat.zeros(&alloc, {n, n})
+                var b = DMat.zeros(&alloc, {n, n})
+                var x = DMat.new(&alloc, {n, nrhs})
+                var y = DMat.zeros(&alloc, {n, nrhs})
+                for i = 0, n do
+                    for j = 0, n do
+                        b(i, j) = rand:random_normal(0, 1) + [unit] * rand:random_normal(0, 1)
+                    end
+                    for j = 0, nrhs do
+                        x(i, j) = rand:random_normal(0, 1) + [unit] * rand:random_normal(0, 1)
+                    end
+                end
+                matrix.gemm([T](1), &b, b:transpose(), [T](0), &a)
+                matrix.gemm([T](1), &a, &x, [T](0), &y)
+                var tol: Ts = [ tol[tostring(Ts)] ]
+                var cho = CholeskyDense.new(&a, tol)
+                cho:factorize()
+                cho:solve(false, &y)
+                var ok = true
+                for i = 0, n do
+                    for j = 0, nrhs do
+                        ok = ok and (
+                            tmath.abs(y(i, j) - x(i, j)) < 20000 * tol * tmath.abs(x(i, j)) + tol
+                        )
+                    end
+                end
+            end
+
+            testset "Solve" do
+                test ok
+            end
+        end
+
+        testenv(T) "Tiled Cholesky factorization" do
+            -- More than one tile for both the native and the BLAS kernels
+            local n = concepts.BLASNumber(T) and 300 or 150
+            terracode
+                var alloc: Alloc
+                var rand = Rand.new(734)
+                var a = DMat.zeros(&alloc, {n, n})
+                var b = DMat.zeros(&alloc, {n, n})
+                var x = DVec.new(&alloc, n)
+                var y = DVec.zeros(&alloc, n)
+                for i = 0, n do
+                    x(i) = rand:random_normal(0, 1) + [unit] * rand:random_normal(0, 1)
+                    for j = 0, n do
+                        b(i, j) = rand:random_normal(0, 1) + [unit] * rand:random_normal(0, 1)
+                    end
+                end
+                -- Hermitian positive definite a = b b^H + n I
+                for i = 0, n do
+                    for j = 0, n do
+                        var sum: T = 0
+                        for k = 0, n do
+                            sum = sum + b(i, k) * tmath.conj(b(j, k))
+                        end
+                        a(i, j) = sum
+                    end
+                    a(i, i) = a(i, i) + [T](n)
+                end
+                var a0 = DMat.zeros(&alloc, {n, n})
+                a0:copy(false, &a)
+                matrix.gemv([T](1), &a, &x, [T](0), &y)
+                var tol: Ts = [ tol[tostring(Ts)] ]
+                var cho = CholeskyDense.new(&a, tol)
+                cho:factorize()
+                cho:solve(false, &y)
+                var ok = true
+                for i = 0, n do
+                    ok = ok and (
+                        tmath.abs(y(i) - x(i)) < 20000 * tol * tmath.abs(x(i)) + tol
+                    )
+                end
+                -- The strictly upper triangle is not referenced
+                var upper = true
+                for i = 0, n do
+                    for j = i + 1, n do
+                        upper = upper and tmath.abs(a(i, j) - a0(i, j)) < tol
+                    end
+                end
+            end
+
+            testset "Solve" do
+                test ok
+            end
+
+            testset "Upper triangle" do
+                test upper
+            end
+        end
     end
 end
@@ -13,6 +13,7 @@ local darray = require("darray")
 local matrix = require("matrix")
 local nfloat = require("nfloat")
 local complex = require("complex")
+local dual = require("dual")
 local concepts = require("concepts")
 local tmath = require("tmath")
 
@@ -745,3 +746,100 @@ for _,T in ipairs{cint, cfloat, cdouble, cfloat128} do
     end
 
 end --T
+
+for _, T in ipairs{float128, cfloat128} do
+
+    local DMatrix = darray.DynamicMatrix(T)
+
+    testenv(T) "Packed GEMM" do
+        -- Large enough for the packed kernel with partial blocks and tiles
+        local m, n, k = 70, 45, 300
+        terracode
+            var alloc : DefaultAllocator
+            var A = DMatrix.new(&alloc, {m, k})
+            var At = DMatrix.new(&alloc, {k, m})
+            var B = DMatrix.new(&alloc, {k, n})
+            var C = DMatrix.new(&alloc, {m, n})
+            var Ct = DMatrix.new(&alloc, {m, n})
+            var Cref = DMatrix.new(&alloc, {m, n})
+            for i = 0, m do
+                for l = 0, k do
+                    A(i, l) = (i + 2 * l) % 7 - 3
+                    At(l, i) = A(i, l)
+                end
+            end
+            for l = 0, k do
+                for j = 0, n do
+                    B(l, j) = (3 * l + j) % 5 - 2
+                end
+            end
+            for i = 0, m do
+                for j = 0, n do
+                    C(i, j) = i - j
+                    Ct(i, j) = i - j
+                    var sum = [T](2) * (i - j)
+                    for l = 0, k do
+                        sum = sum + [T](3) * A(i, l) * B(l, j)
+                    end
+                    Cref(i, j) = sum
+                end
+            end
+            matrix.gemm([T](3), &A, &B, [T](2), &C)
+            matrix.gemm([T](3), At:transpose(), &B, [T](2), &Ct)
+        end
+
+        test tmath.isapprox(&C, &Cref, 0)
+        test tmath.isapprox(&Ct, &Cref, 0)
+    end
+end
+
+-- Dual numbers as in the Jacobian products. The sizes cover the serial and
+-- the parallel packed kernel.
+local Dual = dual.DualNumber(double)
+for _, size in ipairs{{70, 45, 300}, {150, 130, 120}} do
+
+    local DMatrix = darray.DynamicMatrix(Dual)
+    local m, n, k = size[1], size[2], size[3]
+
+    testenv(Dual, m, n, k) "Packed GEMM" do
+        terracode
+            var alloc : DefaultAllocator
+            var A = DMatrix.new(&alloc, {m, k})
+            var B = DMatrix.new(&alloc, {k, n})
+            var C = DMatrix.new(&alloc, {m, n})
+            var Cref = DMatrix.new(&alloc, {m, n})
+            for i = 0, m do
+                for l = 0, k do
+                    A(i, l) = Dual {(i + 2 * l) % 7 - 3, (i * l) % 3 - 1}
+                end
+            end
+            for l = 0, k do
+                for j = 0, n do
+                    B(l, j) = Dual {(3 * l + j) % 5 - 2, (l + j) % 2}
+                end
+            end
+            var alpha = Dual {3, 1}
+            var beta = Dual {2, -1}
+            for i = 0, m do
+                for j = 0, n do
+                    C(i, j) = Dual {i - j, j}
+                    var sum = beta * C(i, j)
+                    for l = 0, k do
+                        sum = sum + alpha * A(i, l) * B(l, j)
+                    end
+                    Cref(i, j) = sum
+                end
+            end
+            matrix.gemm(alpha, &A, &B, beta, &C)
+            -- Integer entries, so the result is exact
+            var ok = true
+            for i = 0, m do
+                for j = 0, n do
+                    ok = ok and C(i, j) == Cref(i, j)
+                end
+            end
+        end
+
+        test ok
+    end
+end
@@ -6,6 +6,7 @@
 -- SPDX-License-Identifier: MIT
 
 import "terratest/terratest"
+import "terraform"
 
 local dual = require("dual")
 local lambda = require("lambda")
@@ -219,6 +220,19 @@ for T, tol in pairs({[float] = `1e-6f, [double] = `1e-14}) do
             test tmath.isapprox(z.tng, tng, tol)
         end
 
+        testset "Comparison" do
+            terracode
+                var x = Td {1, 1}
+                var y = Td {-3, 2}
+            end
+            test x < y
+            test x <= y
+            test y > x
+            test y >= x
+            test not (x > y)
+            test not (x >= y)
+        end
+
         testset "Mixed expression" do
             terracode
                 var f = lambda.new([
@@ -237,3 +251,77 @@ for T, tol in pairs({[float] = `1e-6f, [double] = `1e-14}) do
         end
     end
 end
+
+for T, tol in pairs({[float] = `1e-5f, [double] = `1e-13}) do
+    local N = 4
+    testenv(T, N) "Multi Dual Number" do
+        local Td = dual.DualNumber(T)
+        local Tm = dual.MultiDual(T, N)
+
+        testset "Arithmetic" do
+            terracode
+                var tx = arrayof(T, 1, -2, 3, 0.5)
+                var ty = arrayof(T, -9, 4, 0, 1)
+                var x = Tm.from(-4, &tx[0])
+                var y = Tm.from(6, &ty[0])
+                var s = x + y
+                var d = x - y
+                var p = x * y
+                var q = x / y
+            end
+            test s.val == x.val + y.val
+            test d.val == x.val - y.val
+            test p.val == x.val * y.val
+            test q.val == x.val / y.val
+            for l = 0, N - 1 do
+                test s.tng[l] == x.tng[l] + y.tng[l]
+                test d.tng[l] == x.tng[l] - y.tng[l]
+                test p.tng[l] == x.tng[l] * y.val + x.val * y.tng[l]
+                test tmath.isapprox(
+                    q.tng[l], x.tng[l] / y.val - x.val * y.tng[l] / (y.val * y.val), tol
+                )
+            end
+        end
+
+        testset "Comparison" do
+            terracode
+                var tx = arrayof(T, 1, 0, -1, 0)
+                var ty = arrayof(T, 2, -2, 0, 1)
+                var x = Tm.from(1, &tx[0])
+                var y = Tm.from(-3, &ty[0])
+            end
+            test x < y
+            test x <= y
+            test y > x
+            test y >= x
+            test not (x > y)
+            test not (x >= y)
+        end
+
+        -- Each tangent equals the tangent of the single direction dual
+        -- number with the same direction.
+        testset "Mixed expression" do
+            local terraform f(x)
+                var arg = 2 * tmath.sqrt(x)
+                var y = tmath.sqrt(tmath.pi) * tmath.erf(arg) / arg
+                return (
+                    y * tmath.exp(-x) + tmath.sin(x) * tmath.pow(x, 3)
+                    + tmath.fdexpm1(x) - tmath.cos(x) / tmath.pow(x, x)
+                )
+            end
+            terracode
+                var t = arrayof(T, 1, -0.5, 2, 0)
+                var x = Tm.from(0.1, &t[0])
+                var y = f(x)
+                var yref: Td[N]
+                for l = 0, N do
+                    yref[l] = f(Td {0.1, t[l]})
+                end
+            end
+            test tmath.isapprox(y.val, yref[0].val, tol)
+            for l = 0, N - 1 do
+                test tmath.isapprox(y.tng[l], yref[l].tng, tol)
+            end
+        end
+    end
+end
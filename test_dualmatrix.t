@@ -0,0 +1,95 @@
+-- SPDX-FileCopyrightText: 2024 René Hiemstra <rrhiemstar@gmail.com>
+-- SPDX-FileCopyrightText: 2024 Torsten Keßler <t.kessler@posteo.de>
+-- SPDX-FileCopyrightText: 2025 René Hiemstra <rrhiemstar@gmail.com>
+-- SPDX-FileCopyrightText: 2025 Torsten Keßler <t.kessler@posteo.de>
+--
+-- SPDX-License-Identifier: MIT
+
+import "terratest/terratest"
+
+local dualmatrix = require("dualmatrix")
+local alloc = require("alloc")
+local darray = require("darray")
+local dual = require("dual")
+local matrix = require("matrix")
+local random = require("random")
+local tmath = require("tmath")
+
+for T, tol in pairs({[float] = `1e-4f, [double] = `1e-12}) do
+    local D = dual.DualNumber(T)
+    local DMat = darray.DynamicMatrix(D)
+    local Split = dualmatrix.SplitDualMatrix(T)
+    local Alloc = alloc.DefaultAllocator()
+    local Rand = random.LibC(float)
+
+    local terra isapprox(x: D, y: D)
+        return (
+            tmath.abs(x.val - y.val) < [tol] * (1 + tmath.abs(y.val))
+            and tmath.abs(x.tng - y.tng) < [tol] * (1 + tmath.abs(y.tng))
+        )
+    end
+
+    testenv(T) "Dual GEMM" do
+        local m = 70
+        local n = 45
+        local k = 30
+        terracode
+            var alloc: Alloc
+            var rand = Rand.new(918273)
+            var a = DMat.zeros(&alloc, {m, k})
+            var b = DMat.zeros(&alloc, {k, n})
+            var c = DMat.zeros(&alloc, {m, n})
+            var cref = DMat.zeros(&alloc, {m, n})
+            for i = 0, m do
+                for l = 0, k do
+                    a:set(i, l, D {rand:random_normal(0, 1), rand:random_normal(0, 1)})
+                end
+            end
+            for l = 0, k do
+                for j = 0, n do
+                    b:set(l, j, D {rand:random_normal(0, 1), rand:random_normal(0, 1)})
+                end
+            end
+            for i = 0, m do
+                for j = 0, n do
+                    var cij = D {rand:random_normal(0, 1), rand:random_normal(0, 1)}
+                    c:set(i, j, cij)
+                    cref:set(i, j, cij)
+                end
+            end
+            var alpha = D {[T](0.5), [T](-2)}
+            var beta = D {[T](1.5), [T](3)}
+            -- Reference computed entry by entry in dual arithmetic
+            for i = 0, m do
+                for j = 0, n do
+                    var sum = beta * cref:get(i, j)
+                    for l = 0, k do
+                        sum = sum + alpha * a:get(i, l) * b:get(l, j)
+                    end
+                    cref:set(i, j, sum)
+                end
+            end
+            var as = Split.from(&alloc, &a)
+            var bs = Split.from(&alloc, &b)
+            var cs = Split.from(&alloc, &c)
+            matrix.gemm(alpha, &a, &b, beta, &c)
+            matrix.gemm(alpha, &as, &bs, beta, &cs)
+        end
+
+        testset "Interleaved storage" do
+            for i = 0, m - 1, 7 do
+                for j = 0, n - 1, 5 do
+                    test isapprox(c:get(i, j), cref:get(i, j))
+                end
+            end
+        end
+
+        testset "Split storage" do
+            for i = 0, m - 1, 7 do
+                for j = 0, n - 1, 5 do
+                    test isapprox(cs:get(i, j), cref:get(i, j))
+                end
+            end
+        end
+    end
+end
@@ -0,0 +1,184 @@
+-- SPDX-FileCopyrightText: 2024 René Hiemstra <rrhiemstar@gmail.com>
+-- SPDX-FileCopyrightText: 2024 Torsten Keßler <t.kessler@posteo.de>
+-- SPDX-FileCopyrightText: 2025 René Hiemstra <rrhiemstar@gmail.com>
+-- SPDX-FileCopyrightText: 2025 Torsten Keßler <t.kessler@posteo.de>
+--
+-- SPDX-License-Identifier: MIT
+
+import "terratest/terratest"
+
+local ilu = require("ilu")
+local krylov = require("krylov")
+local alloc = require("alloc")
+local sparse = require("sparse")
+local darray = require("darray")
+local tmath = require("tmath")
+
+local tols = {
+    [float] = `1e-5f,
+    [double] = `1e-12,
+}
+
+for T, tol in pairs(tols) do
+    for _, I in pairs({int32, int64}) do
+        local Alloc = alloc.DefaultAllocator()
+        local CSR = sparse.CSRMatrix(T, I)
+        local DVec = darray.DynamicVector(T)
+        local ILU = ilu.ILUFactory(T, I)
+        local IC = ilu.ICFactory(T, I)
+        local CG = krylov.CGFactory(T)
+
+        testenv(T, I) "Incomplete factorizations" do
+            local n = 30
+            terracode
+                var alloc: Alloc
+                -- For tridiagonal matrices the incomplete factorizations
+                -- are exact.
+                var a = CSR.new(&alloc, n, n)
+                var c = CSR.new(&alloc, n, n)
+                for i = 0, n do
+                    a:set(i, i, 2)
+                    c:set(i, i, 3)
+                end
+                for i = 1, n do
+                    a:set(i, i - 1, -1)
+                    a:set(i - 1, i, -1)
+                    c:set(i, i - 1, -1.5)
+                    c:set(i - 1, i, -0.5)
+                end
+                var b = DVec.new(&alloc, n)
+                for i = 0, n do
+                    b(i) = i % 4 + 1
+                end
+                var r = DVec.zeros(&alloc, n)
+            end
+
+            testset "ILU(0) schedule" do
+                terracode
+                    var f = ILU.new(&alloc, &c)
+                end
+                test f.lower.nlevels == n
+                test f.upper.nlevels == n
+            end
+
+            testset "ILU(0) solve" do
+                terracode
+                    var f = ILU.new(&alloc, &c)
+                    f:factorize()
+                    var x = DVec.new(&alloc, n)
+                    x:copy(&b)
+                    f:solve(false, &x)
+                    c:apply(false, [T](-1), &x, [T](0), &r)
+                    r:axpy([T](1), &b)
+                end
+                test r:norm() <= 10 * tol * b:norm()
+            end
+
+            testset "ILU(0) transposed solve" do
+                terracode
+                    var f = ILU.new(&alloc, &c)
+                    f:factorize()
+                    var x = DVec.new(&alloc, n)
+                    x:copy(&b)
+                    f:solve(true, &x)
+                    c:apply(true, [T](-1), &x, [T](0), &r)
+                    r:axpy([T](1), &b)
+                end
+                test r:norm() <= 10 * tol * b:norm()
+            end
+
+            testset "IC(0) solve" do
+                terracode
+                    var f = IC.new(&alloc, &a)
+                    f:factorize()
+                    var x = DVec.zeros(&alloc, n)
+                    f:apply(false, [T](1), &b, [T](0), &x)
+                    a:apply(false, [T](-1), &x, [T](0), &r)
+                    r:axpy([T](1), &b)
+                end
+                test r:norm() <= 10 * tol * b:norm()
+            end
+        end
+
+        testenv(T, I) "Parallel levels" do
+            -- 2 x 2 diagonal blocks give two levels with m rows each.
+            local m = 1000
+            terracode
+                var alloc: Alloc
+                var n = 2 * m
+                var a = CSR.new(&alloc, n, n)
+                for k = 0, m do
+                    a:set(2 * k, 2 * k, 4)
+                    a:set(2 * k, 2 * k + 1, -1)
+                    a:set(2 * k + 1, 2 * k, -1)
+                    a:set(2 * k + 1, 2 * k + 1, 4)
+                end
+                var b = DVec.new(&alloc, n)
+                for i = 0, n do
+                    b(i) = i % 5 - 2
+                end
+                var r = DVec.zeros(&alloc, n)
+            end
+
+            testset "ILU(0)" do
+                terracode
+                    var f = ILU.new(&alloc, &a)
+                    f:factorize()
+                    var x = DVec.zeros(&alloc, n)
+                    f:apply(false, [T](1), &b, [T](0), &x)
+                    a:apply(false, [T](-1), &x, [T](0), &r)
+                    r:axpy([T](1), &b)
+                end
+                test f.lower.nlevels == 2
+                test r:norm() <= 10 * tol * b:norm()
+            end
+
+            testset "IC(0)" do
+                terracode
+                    var f = IC.new(&alloc, &a)
+                    f:factorize()
+                    var x = DVec.zeros(&alloc, n)
+                    f:apply(false, [T](1), &b, [T](0), &x)
+                    a:apply(false, [T](-1), &x, [T](0), &r)
+                    r:axpy([T](1), &b)
+                end
+                test f.upper.nlevels == 2
+                test r:norm() <= 10 * tol * b:norm()
+            end
+        end
+
+        testenv(T, I) "Preconditioned CG" do
+            -- 5-point Laplacian on a m x m grid
+            local m = 12
+            terracode
+                var alloc: Alloc
+                var n = m * m
+                var a = CSR.new(&alloc, n, n)
+                for i = 0, m do
+                    for j = 0, m do
+                        var k = m * i + j
+                        a:set(k, k, 4)
+                        if i > 0 then a:set(k, k - m, -1) end
+                        if i < m - 1 then a:set(k, k + m, -1) end
+                        if j > 0 then a:set(k, k - 1, -1) end
+                        if j < m - 1 then a:set(k, k + 1, -1) end
+                    end
+                end
+                var b = DVec.ones(&alloc, n)
+                var cg = CG.new(&alloc, n, tol, 1000)
+                var x = DVec.zeros(&alloc, n)
+                var plain = cg:solve(&a, &b, &x)
+                var f = IC.new(&alloc, &a)
+                f:factorize()
+                x:fill(0)
+                var precond = cg:solve(&a, &f, &b, &x)
+            end
+
+            testset "Iterations" do
+                test plain.converged
+                test precond.converged
+                test precond.iterations < plain.iterations
+            end
+        end
+    end
+end
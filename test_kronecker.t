@@ -0,0 +1,103 @@
+-- SPDX-FileCopyrightText: 2024 René Hiemstra <rrhiemstar@gmail.com>
+-- SPDX-FileCopyrightText: 2024 Torsten Keßler <t.kessler@posteo.de>
+-- SPDX-FileCopyrightText: 2025 René Hiemstra <rrhiemstar@gmail.com>
+-- SPDX-FileCopyrightText: 2025 Torsten Keßler <t.kessler@posteo.de>
+--
+-- SPDX-License-Identifier: MIT
+
+import "terratest/terratest"
+
+local kronecker = require("kronecker")
+local alloc = require("alloc")
+local sparse = require("sparse")
+local darray = require("darray")
+local matrix = require("matrix")
+local tmath = require("tmath")
+
+local tols = {
+    [float] = `1e-5f,
+    [double] = `1e-13,
+}
+
+for T, tol in pairs(tols) do
+    local Alloc = alloc.DefaultAllocator()
+    local CSR = sparse.CSRMatrix(T, int32)
+    local Mat = darray.DynamicMatrix(T)
+    local Vec = darray.DynamicVector(T)
+
+    for _, sparseb in pairs({false, true}) do
+        local MB = sparseb and CSR or Mat
+        local Kron = kronecker.KroneckerOperator(Mat, MB)
+
+        testenv(T, MB) "Kronecker operator" do
+            terracode
+                var alloc: Alloc
+                var a = Mat.from(&alloc, {{1, 2}, {-1, 3}, {0, 4}})
+                var bd = Mat.from(
+                    &alloc, {{2, -1, 0}, {-1, 2, -1}, {0, -1, 2}, {1, 0, 0}}
+                )
+                var bs = CSR.new(&alloc, 4, 3)
+                for k = 0, 4 do
+                    for l = 0, 3 do
+                        if bd(k, l) ~= 0 then
+                            bs:set(k, l, bd(k, l))
+                        end
+                    end
+                end
+                -- Explicit Kronecker product for reference
+                var ab = Mat.zeros(&alloc, {12, 6})
+                for i = 0, 3 do
+                    for j = 0, 2 do
+                        for k = 0, 4 do
+                            for l = 0, 3 do
+                                ab(4 * i + k, 3 * j + l) = a(i, j) * bd(k, l)
+                            end
+                        end
+                    end
+                end
+                var op = Kron.new(&alloc, &a, &[sparseb and bs or bd])
+            end
+
+            testset "Dimensions" do
+                test op:rows() == 12
+                test op:cols() == 6
+            end
+
+            testset "Apply" do
+                terracode
+                    var x = Vec.new(&alloc, 6)
+                    for j = 0, 6 do
+                        x(j) = j - 2
+                    end
+                    var y = Vec.ones(&alloc, 12)
+                    var yref = Vec.ones(&alloc, 12)
+                    op:apply(false, [T](2), &x, [T](-1), &y)
+                    matrix.gemv([T](2), &ab, &x, [T](-1), &yref)
+                    var ok = true
+                    for i = 0, 12 do
+                        ok = ok and tmath.isapprox(y(i), yref(i), [tol])
+                    end
+                end
+                test ok
+            end
+
+            testset "Apply transposed" do
+                terracode
+                    var x = Vec.new(&alloc, 12)
+                    for i = 0, 12 do
+                        x(i) = i % 5 - 1
+                    end
+                    var y = Vec.ones(&alloc, 6)
+                    var yref = Vec.ones(&alloc, 6)
+                    op:apply(true, [T](2), &x, [T](3), &y)
+                    matrix.gemv([T](2), ab:transpose(), &x, [T](3), &yref)
+                    var ok = true
+                    for j = 0, 6 do
+                        ok = ok and tmath.isapprox(y(j), yref(j), [tol])
+                    end
+                end
+                test ok
+            end
+        end
+    end
+end
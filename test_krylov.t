@@ -0,0 +1,128 @@
+-- SPDX-FileCopyrightText: 2024 René Hiemstra <rrhiemstar@gmail.com>
+-- SPDX-FileCopyrightText: 2024 Torsten Keßler <t.kessler@posteo.de>
+-- SPDX-FileCopyrightText: 2025 René Hiemstra <rrhiemstar@gmail.com>
+-- SPDX-FileCopyrightText: 2025 Torsten Keßler <t.kessler@posteo.de>
+--
+-- SPDX-License-Identifier: MIT
+
+import "terratest/terratest"
+
+local krylov = require("krylov")
+local lu = require("lu")
+local alloc = require("alloc")
+local sparse = require("sparse")
+local darray = require("darray")
+local matrix = require("matrix")
+local tmath = require("tmath")
+
+local tols = {
+    [float] = `1e-5f,
+    [double] = `1e-12,
+}
+
+for T, tol in pairs(tols) do
+    local Alloc = alloc.DefaultAllocator()
+    local CSR = sparse.CSRMatrix(T, int64)
+    local DMat = darray.DynamicMatrix(T)
+    local DVec = darray.DynamicVector(T)
+    local PVec = darray.DynamicVector(int32)
+    local CG = krylov.CGFactory(T)
+    local GMRES = krylov.GMRESFactory(T)
+    local BiCGStab = krylov.BiCGStabFactory(T)
+    local LUDense = lu.LUFactory(DMat, PVec)
+
+    testenv(T) "Krylov solvers" do
+        local n = 20
+        terracode
+            var alloc: Alloc
+            -- Symmetric positive definite 1D Laplacian
+            var a = CSR.new(&alloc, n, n)
+            -- Nonsymmetric convection diffusion matrix
+            var c = CSR.new(&alloc, n, n)
+            var ad = DMat.zeros(&alloc, {n, n})
+            for i = 0, n do
+                a:set(i, i, 2)
+                c:set(i, i, 3)
+                ad(i, i) = 2
+            end
+            for i = 1, n do
+                a:set(i, i - 1, -1)
+                a:set(i - 1, i, -1)
+                c:set(i, i - 1, -1.5)
+                c:set(i - 1, i, -0.5)
+                ad(i, i - 1) = -1
+                ad(i - 1, i) = -1
+            end
+            var b = DVec.new(&alloc, n)
+            for i = 0, n do
+                b(i) = i % 3 + 1
+            end
+            var r = DVec.zeros(&alloc, n)
+        end
+
+        testset "CG sparse" do
+            terracode
+                var cg = CG.new(&alloc, n, tol, 100)
+                var x = DVec.zeros(&alloc, n)
+                var stats = cg:solve(&a, &b, &x)
+                matrix.gemv([T](-1), &ad, &x, [T](0), &r)
+                r:axpy([T](1), &b)
+            end
+            test stats.converged
+            test stats.iterations <= n
+            test r:norm() <= 10 * tol * b:norm()
+        end
+
+        testset "CG dense with LU preconditioner" do
+            terracode
+                var cg = CG.new(&alloc, n, tol, 100)
+                var x = DVec.zeros(&alloc, n)
+                var lud = DMat.zeros(&alloc, {n, n})
+                lud:copy(false, &ad)
+                var p = PVec.zeros(&alloc, n)
+                var lu = LUDense.new(&lud, &p, tol)
+                lu:factorize()
+                var stats = cg:solve(&ad, &lu, &b, &x)
+            end
+            test stats.converged
+            test stats.iterations <= 2
+        end
+
+        testset "CG workspace reuse" do
+            terracode
+                var cg = CG.new(&alloc, n, tol, 100)
+                var x = DVec.zeros(&alloc, n)
+                var first = cg:solve(&a, &b, &x)
+                -- Restart from the solution
+                var second = cg:solve(&a, &b, &x)
+            end
+            test first.converged
+            test second.converged
+            test second.iterations == 0
+        end
+
+        testset "GMRES" do
+            terracode
+                var gmres = GMRES.new(&alloc, n, 8, tol, 200)
+                var x = DVec.zeros(&alloc, n)
+                var stats = gmres:solve(&c, &b, &x)
+                c:apply(false, [T](-1), &x, [T](0), &r)
+                r:axpy([T](1), &b)
+            end
+            test stats.converged
+            test r:norm() <= 10 * tol * b:norm()
+        end
+
+        testset "BiCGStab" do
+            terracode
+                var bicgstab = BiCGStab.new(&alloc, n, tol, 200)
+                var x = DVec.zeros(&alloc, n)
+                var stats = bicgstab:solve(&c, &b, &x)
+                c:apply(false, [T](-1), &x, [T](0), &r)
+                r:axpy([T](1), &b)
+            end
+            test stats.converged
+            test r:norm() <= 10 * tol * b:norm()
+        end
+    end
+end
@@ -6,6 +6,7 @@
 -- SPDX-License-Identifier: MIT
 
 local lapack = require("lapack")
+local alloc = require("alloc")
 local blas = require("blas")
 local complex = require("complex")
 local io = terralib.includec("stdio.h")
@@ -155,4 +156,41 @@ for prefix, T in pairs(types) do
         end
 
     end -- LDL
+
+    testenv(T) "Work space" do
+        local n = 2
+        local Tr = (T == complexFloat or T == complexDouble) and T.traits.eltype or T
+        local Workspace = lapack.Workspace(T)
+        local Alloc = alloc.DefaultAllocator()
+        terracode
+            var alloc: Alloc
+            var ws = Workspace.new(&alloc)
+            var a = arrayof(T, 2, 1, 1, 2)
+            var w: Tr[n]
+            var info = ws:syev(lapack.COL_MAJOR, @'N', @'U', n, &a[0], n, &w[0])
+            var lwork = ws.lwork
+            -- Second call of the same size reuses the buffers
+            a = arrayof(T, 2, 1, 1, 2)
+            var info2 = ws:syev(lapack.COL_MAJOR, @'N', @'U', n, &a[0], n, &w[0])
+            var b = arrayof(T, 3, 0, 0, 4)
+            var s: Tr[n]
+            var superb: Tr[n - 1]
+            var info3 = ws:gesvd(lapack.COL_MAJOR, @'N', @'N', n, n, &b[0], n,
+                                 &s[0], nil, 1, nil, 1, &superb[0])
+        end
+
+        testset "Symmetric eigenvalues" do
+            test info == 0
+            test info2 == 0
+            test ws.lwork == lwork
+            test abs(w[0] - 1) < rtol
+            test abs(w[1] - 3) < rtol
+        end
+
+        testset "Singular values" do
+            test info3 == 0
+            test abs(s[0] - 4) < rtol
+            test abs(s[1] - 3) < rtol
+        end
+    end -- Work space
 end -- for type
@@ -110,5 +110,176 @@ for _, Ts in pairs({float, double, float128, float1024}) do
                 end
             end
         end
+
+        testenv(T) "LU factorization with multiple right-hand sides" do
+            local n = 41
+            -- More right-hand sides than NRHS_BLOCK with a partial last block
+            local nrhs = 70
+            terracode
+                var alloc: Alloc
+                var rand = Rand.new(5102)
+                var a = DMat.new(&alloc, {n, n})
+                var x = DMat.new(&alloc, {n, nrhs})
+                var y = DMat.zeros(&alloc, {n, nrhs})
+                var yt = DMat.zeros(&alloc, {n, nrhs})
+                for i = 0, n do
+                    for j = 0, n do
+                        a(i, j) = rand:random_normal(0, 1) + [unit] * rand:random_normal(0, 1)
+                    end
+                    for j = 0, nrhs do
+                        x(i, j) = rand:random_normal(0, 1) + [unit] * rand:random_normal(0, 1)
+                    end
+                end
+                matrix.gemm([T](1), &a, &x, [T](0), &y)
+                matrix.gemm([T](1), a:transpose(), &x, [T](0), &yt)
+                var p = PVec.zeros(&alloc, n)
+                var tol: Ts = [ tol[tostring(Ts)] ]
+                var lu = LUDense.new(&a, &p, tol)
+                lu:factorize()
+                lu:solve(false, &y)
+                lu:solve(true, &yt)
+                var ok = true
+                var okt = true
+                for i = 0, n do
+                    for j = 0, nrhs do
+                        ok = ok and (
+                            tmath.abs(y(i, j) - x(i, j)) < 1000 * tol * tmath.abs(x(i, j)) + tol
+                        )
+                        okt = okt and (
+                            tmath.abs(yt(i, j) - x(i, j)) < 2000 * tol * tmath.abs(x(i, j)) + tol
+                        )
+                    end
+                end
+            end
+
+            testset "Solve" do
+                test ok
+            end
+
+            testset "Solve transposed" do
+                test okt
+            end
+        end
+
+        if not concepts.BLASNumber(T) then
+            testenv(T) "Blocked LU factorization" do
+                -- Larger than the block size with a partial last block
+                local n = 150
+                terracode
+                    var alloc: Alloc
+                    var rand = Rand.new(9481)
+                    var a = DMat.new(&alloc, {n, n})
+                    var x = DVec.new(&alloc, n)
+                    var y = DVec.zeros(&alloc, n)
+                    for i = 0, n do
+                        x(i) = rand:random_normal(0, 1) + [unit] * rand:random_normal(0, 1)
+                        for j = 0, n do
+                            a(i, j) = rand:random_normal(0, 1) + [unit] * rand:random_normal(0, 1)
+                        end
+                    end
+                    matrix.gemv([T](1), &a, &x, [T](0), &y)
+                    var p = PVec.zeros(&alloc, n)
+                    var tol: Ts = [ tol[tostring(Ts)] ]
+                    var lu = LUDense.new(&a, &p, tol)
+                    lu:factorize()
+                    lu:solve(false, &y)
+                    var ok = true
+                    for i = 0, n do
+                        ok = ok and (
+                            tmath.abs(y(i) - x(i)) < 10000 * tol * tmath.abs(x(i)) + tol
+                        )
+                    end
+                end
+
+                testset "Solve" do
+                    test ok
+                end
+            end
+        end
+    end
+end
+
+do
+    local T = double
+    local DMat = darray.DynamicMatrix(T)
+    local DVec = darray.DynamicVector(T)
+    local PVec = darray.DynamicVector(int32)
+    local Alloc = alloc.DefaultAllocator()
+    local Rand = random.LibC(float)
+    local MixedLU = lu.MixedLUFactory(DMat, PVec)
+
+    testenv(T) "Mixed-precision LU factorization" do
+        local n = 41
+        terracode
+            var alloc: Alloc
+            var rand = Rand.new(94611)
+            var a = DMat.new(&alloc, {n, n})
+            var x = DVec.new(&alloc, n)
+            var y = DVec.zeros(&alloc, n)
+            var yt = DVec.zeros(&alloc, n)
+            for i = 0, n do
+                x(i) = rand:random_normal(0, 1)
+                for j = 0, n do
+                    a(i, j) = rand:random_normal(0, 1)
+                end
+                a(i, i) = a(i, i) + n
+            end
+            matrix.gemv([T](1), &a, &x, [T](0), &y)
+            matrix.gemv([T](1), a:transpose(), &x, [T](0), &yt)
+            var p = PVec.zeros(&alloc, n)
+            var lu = MixedLU.new(&alloc, &a, &p)
+            lu:factorize()
+            lu:solve(false, &y)
+            var iter = lu.iter
+            lu:solve(true, &yt)
+            var itert = lu.iter
+        end
+
+        testset "Refinement" do
+            test not lu.fallback
+            test iter >= 0
+            test itert >= 0
+        end
+
+        testset "Solve" do
+            for i = 0, n - 1 do
+                test tmath.abs(y(i) - x(i)) < 1e-13 * tmath.abs(x(i)) + 1e-13
+            end
+        end
+
+        testset "Solve transposed" do
+            for i = 0, n - 1 do
+                test tmath.abs(yt(i) - x(i)) < 1e-13 * tmath.abs(x(i)) + 1e-13
+            end
+        end
+    end
+
+    testenv(T) "Mixed-precision LU fallback" do
+        -- The Hilbert matrix of order 8 has condition number 1.5e10, too
+        -- large for a single precision factorization.
+        local n = 8
+        terracode
+            var alloc: Alloc
+            var a = DMat.new(&alloc, {n, n})
+            var x = DVec.new(&alloc, n)
+            var y = DVec.zeros(&alloc, n)
+            for i = 0, n do
+                x(i) = 1
+                for j = 0, n do
+                    a(i, j) = 1.0 / (i + j + 1)
+                end
+            end
+            matrix.gemv([T](1), &a, &x, [T](0), &y)
+            var p = PVec.zeros(&alloc, n)
+            var lu = MixedLU.new(&alloc, &a, &p)
+            lu:factorize()
+            lu:solve(false, &y)
+        end
+
+        test lu.fallback
+        test lu.iter == -1
+        for i = 0, n - 1 do
+            test tmath.abs(y(i) - x(i)) < 1e-5
+        end
     end
 end
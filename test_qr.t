@@ -15,6 +15,7 @@ local nfloat = require("nfloat")
 local darray = require("darray")
 local matrix = require("matrix")
 local tmath = require("tmath")
+local concepts = require("concepts")
 
 local float128 = nfloat.FixedFloat(128)
 local float1024 = nfloat.FixedFloat(1024)
@@ -40,6 +41,7 @@ for _, Ts in pairs({float, double, float128, float1024}) do
         local Alloc = alloc.DefaultAllocator()
         local Rand = random.LibC(float)
         local QRDense = qr.QRFactory(DMat, DVec)
+        local TSQRDense = qr.TSQR(DMat)
 
         testenv(T) "QR factorization of random matrix" do
             local n = 41
@@ -78,5 +80,148 @@ for _, Ts in pairs({float, double, float128, float1024}) do
                 end
             end
         end
+
+        testenv(T) "QR factorization with multiple right-hand sides" do
+            local n = 41
+            -- More right-hand sides than NRHS_BLOCK with a partial last block
+            local nrhs = 70
+            terracode
+                var alloc: Alloc
+                var rand = Rand.new(61877)
+                var a = DMat.new(&alloc, {n, n})
+                var x = DMat.new(&alloc, {n, nrhs})
+                var y = DMat.zeros(&alloc, {n, nrhs})
+                var yt = DMat.zeros(&alloc, {n, nrhs})
+                for i = 0, n do
+                    for j = 0, n do
+                        a(i, j) = rand:random_normal(0, 1) + [unit] * rand:random_normal(0, 1)
+                    end
+                    for j = 0, nrhs do
+                        x(i, j) = rand:random_normal(0, 1) + [unit] * rand:random_normal(0, 1)
+                    end
+                end
+                matrix.gemm([T](1), &a, &x, [T](0), &y)
+                matrix.gemm([T](1), a:transpose(), &x, [T](0), &yt)
+                var u = DVec.new(&alloc, n)
+                var tol: Ts = [ tol[tostring(Ts)] ]
+                var qr = QRDense.new(&a, &u)
+                qr:factorize()
+                qr:solve(false, &y)
+                qr:solve(true, &yt)
+                var ok = true
+                var okt = true
+                for i = 0, n do
+                    for j = 0, nrhs do
+                        ok = ok and (
+                            tmath.abs(y(i, j) - x(i, j)) < 1000 * tol * tmath.abs(x(i, j)) + tol
+                        )
+                        okt = okt and (
+                            tmath.abs(yt(i, j) - x(i, j)) < 2000 * tol * tmath.abs(x(i, j)) + tol
+                        )
+                    end
+                end
+            end
+
+            testset "Solve" do
+                test ok
+            end
+
+            testset "Solve transposed" do
+                test okt
+            end
+        end
+
+        testenv(T) "TSQR least squares" do
+            local m = 1000
+            local n = 7
+            terracode
+                var alloc: Alloc
+                var rand = Rand.new(80931)
+                var a = DMat.new(&alloc, {m, n})
+                var x = DVec.new(&alloc, n)
+                var y = DVec.zeros(&alloc, n)
+                var b = DVec.zeros(&alloc, m)
+                for j = 0, n do
+                    x(j) = rand:random_normal(0, 1) + [unit] * rand:random_normal(0, 1)
+                end
+                for i = 0, m do
+                    for j = 0, n do
+                        a(i, j) = rand:random_normal(0, 1) + [unit] * rand:random_normal(0, 1)
+                    end
+                end
+                -- Zero leading entries in the upper half of the first column,
+                -- so at least the first leaf starts with a zero entry
+                for i = 0, m / 2 do
+                    a(i, 0) = 0
+                end
+                -- Consistent system, so the least squares residual vanishes
+                matrix.gemv([T](1), &a, &x, [T](0), &b)
+                var tol: Ts = [ tol[tostring(Ts)] ]
+                var qr = TSQRDense.new(&alloc, &a)
+                qr:factorize()
+                qr:solve(&b, &y)
+                var res = [Ts](0)
+                for i = n, m do
+                    res = res + tmath.abs(b(i))
+                end
+            end
+
+            testset "Solve" do
+                for i = 0, n - 1 do
+                    test tmath.abs(y(i) - x(i)) < 1000 * tol * tmath.abs(x(i)) + tol
+                end
+            end
+
+            testset "Residual" do
+                test res < 1000 * m * tol
+            end
+        end
+
+        if not concepts.BLASNumber(T) then
+            testenv(T) "Blocked QR factorization" do
+                -- Several panels and a partial last panel
+                local n = 100
+                terracode
+                    var alloc: Alloc
+                    var rand = Rand.new(55123)
+                    var a = DMat.new(&alloc, {n, n})
+                    var x = DVec.new(&alloc, n)
+                    var y = DVec.zeros(&alloc, n)
+                    var yt = DVec.zeros(&alloc, n)
+                    for i = 0, n do
+                        x(i) = rand:random_normal(0, 1) + [unit] * rand:random_normal(0, 1)
+                        for j = 0, n do
+                            a(i, j) = rand:random_normal(0, 1) + [unit] * rand:random_normal(0, 1)
+                        end
+                    end
+                    matrix.gemv([T](1), &a, &x, [T](0), &y)
+                    matrix.gemv([T](1), a:transpose(), &x, [T](0), &yt)
+                    var u = DVec.new(&alloc, n)
+                    var tol: Ts = [ tol[tostring(Ts)] ]
+                    var qr = QRDense.new(&a, &u)
+                    qr:factorize()
+                    qr:solve(false, &y)
+                    qr:solve(true, &yt)
+                    var ok = true
+                    var okt = true
+                    for i = 0, n do
+                        ok = ok and (
+                            tmath.abs(y(i) - x(i)) < 10000 * tol * tmath.abs(x(i)) + tol
+                        )
+                        okt = okt and (
+                            tmath.abs(yt(i) - x(i)) < 10000 * tol * tmath.abs(x(i)) + tol
+                        )
+                    end
+                end
+
+                testset "Solve" do
+                    test ok
+                end
+
+                testset "Solve transposed" do
+                    test okt
+                end
+            end
+        end
     end
 end
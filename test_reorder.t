@@ -0,0 +1,110 @@
+-- SPDX-FileCopyrightText: 2024 René Hiemstra <rrhiemstar@gmail.com>
+-- SPDX-FileCopyrightText: 2024 Torsten Keßler <t.kessler@posteo.de>
+-- SPDX-FileCopyrightText: 2025 René Hiemstra <rrhiemstar@gmail.com>
+-- SPDX-FileCopyrightText: 2025 Torsten Keßler <t.kessler@posteo.de>
+--
+-- SPDX-License-Identifier: MIT
+
+local alloc = require("alloc")
+local sparse = require("sparse")
+local reorder = require("reorder")
+local darray = require("darray")
+local matrix = require("matrix")
+local tmath = require("tmath")
+
+import "terratest/terratest"
+
+local DefaultAlloc = alloc.DefaultAllocator()
+for _, T in pairs({float, double}) do
+    for _, I in pairs({int32, int64, uint32, uint64}) do
+        local CSR = sparse.CSRMatrix(T, I)
+        local R = reorder.Reorder(T, I)
+        local Vec = darray.DynamicVector(T)
+        local Mat = darray.DynamicMatrix(T)
+        testenv(T, I) "Reordering" do
+            terracode
+                var alloc: DefaultAlloc
+                -- Path graph with scrambled numbering
+                var n = 10
+                var label = arrayof(I, 3, 7, 0, 9, 5, 1, 8, 2, 6, 4)
+                var a = CSR.new(&alloc, n, n)
+                for k = 0, n do
+                    a:set(label[k], label[k], 2)
+                end
+                for k = 1, n do
+                    a:set(label[k], label[k - 1], -1)
+                    a:set(label[k - 1], label[k], -1)
+                end
+            end
+
+            testset "RCM" do
+                terracode
+                    var perm = R.rcm(&alloc, &a)
+                    var seen: bool[10]
+                    for k = 0, n do
+                        seen[k] = false
+                    end
+                    for k = 0, n do
+                        seen[perm(k)] = true
+                    end
+                    var ispermutation = true
+                    for k = 0, n do
+                        ispermutation = ispermutation and seen[k]
+                    end
+                    var b = R.permute(&alloc, &a, &perm(0))
+                end
+                test ispermutation
+                test R.bandwidth(&a) > 1
+                test R.bandwidth(&b) == 1
+                test b:nnz() == a:nnz()
+            end
+
+            testset "Permuted apply" do
+                terracode
+                    var perm = R.rcm(&alloc, &a)
+                    var b = R.permute(&alloc, &a, &perm(0))
+                    var x = Vec.new(&alloc, n)
+                    var y = Vec.zeros(&alloc, n)
+                    for i = 0, n do
+                        x(i) = i + 1
+                    end
+                    matrix.gemv([T](1), &a, &x, [T](0), &y)
+                    var xp = Vec.new(&alloc, n)
+                    var yp = Vec.zeros(&alloc, n)
+                    var z = Vec.new(&alloc, n)
+                    reorder.permute(&perm(0), &x, &xp)
+                    matrix.gemv([T](1), &b, &xp, [T](0), &yp)
+                    reorder.unpermute(&perm(0), &yp, &z)
+                    var ok = true
+                    for i = 0, n do
+                        ok = ok and tmath.isapprox(z(i), y(i), [T](1e-6))
+                    end
+                end
+                test ok
+            end
+
+            testset "Morton" do
+                terracode
+                    -- 4 x 4 grid of points, numbered column by column
+                    var m = 4
+                    var x = Mat.new(&alloc, {m * m, 2})
+                    for i = 0, m do
+                        for j = 0, m do
+                            x(m * j + i, 0) = i
+                            x(m * j + i, 1) = j
+                        end
+                    end
+                    var perm = R.morton(&alloc, &x)
+                    -- The first quadrant is traversed first
+                    var ok = true
+                    for k = 0, 4 do
+                        ok = ok and x(perm(k), 0) < 2 and x(perm(k), 1) < 2
+                    end
+                end
+                test perm(0) == 0
+                test perm(m * m - 1) == m * m - 1
+                test ok
+            end
+        end
+    end
+end
@@ -107,6 +107,230 @@ for T, tol in pairs(tols) do
                 end
             end
 
+            testset "Apply multiple vectors" do
+                terracode
+                    var rows = 6
+                    var k = 9
+                    var d = CSR.new(&alloc, rows, rows)
+                    for i = 0, rows do
+                        d:set(i, i, 2)
+                    end
+                    for i = 1, rows do
+                        d:set(i, i - 1, -1)
+                    end
+                    d:set(0, rows - 1, 3)
+                    var xm = Mat.new(&alloc, {rows, k})
+                    var ym = Mat.new(&alloc, {rows, k})
+                    var ymt = Mat.new(&alloc, {rows, k})
+                    for i = 0, rows do
+                        for j = 0, k do
+                            xm(i, j) = i + 2 * j
+                            ym(i, j) = 1 - j
+                            ymt(i, j) = 1 - j
+                        end
+                    end
+                    var alpha: T = -2
+                    var beta: T = 3
+                    d:apply(false, alpha, &xm, beta, &ym)
+                    d:apply(true, alpha, &xm, beta, &ymt)
+                    var ok = true
+                    var okt = true
+                    for i = 0, rows do
+                        for j = 0, k do
+                            var res: T = 0
+                            var rest: T = 0
+                            for l = 0, rows do
+                                res = res + d:get(i, l) * xm(l, j)
+                                rest = rest + d:get(l, i) * xm(l, j)
+                            end
+                            var yref = alpha * res + beta * (1 - j)
+                            var ytref = alpha * rest + beta * (1 - j)
+                            ok = ok and tmath.isapprox(ym(i, j), yref, [tol])
+                            okt = okt and tmath.isapprox(ymt(i, j), ytref, [tol])
+                        end
+                    end
+                end
+
+                test ok
+                test okt
+            end
+
+            testset "Sparse times sparse" do
+                terracode
+                    var n = 5
+                    var m = 4
+                    var l = 6
+                    var sa = CSR.new(&alloc, n, m)
+                    var sb = CSR.new(&alloc, m, l)
+                    for i = 0, n do
+                        sa:set(i, i % m, i + 1)
+                        sa:set(i, (2 * i + 1) % m, -1)
+                    end
+                    for i = 0, m do
+                        sb:set(i, i, 2)
+                        sb:set(i, l - 1 - i, i - 3)
+                    end
+                    var sc = CSR.symbolic(&alloc, &sa, &sb)
+                    matrix.gemm([T](1), &sa, &sb, [T](0), &sc)
+                    var ok = true
+                    for i = 0, n do
+                        for j = 0, l do
+                            var res: T = 0
+                            for k = 0, m do
+                                res = res + sa:get(i, k) * sb:get(k, j)
+                            end
+                            ok = ok and tmath.isapprox(sc:get(i, j), res, [tol])
+                        end
+                    end
+                    var sorted = true
+                    for i = 0, n do
+                        for idx = sc.rowptr(i) + 1, sc.rowptr(i + 1) do
+                            sorted = sorted and sc.col(idx - 1) < sc.col(idx)
+                        end
+                    end
+                    var c00 = sc:get(0, 0)
+                    matrix.gemm([T](2), &sa, &sb, [T](-1), &sc)
+                end
+
+                test sc:rows() == n
+                test sc:cols() == l
+                test ok
+                test sorted
+                test tmath.isapprox(sc:get(0, 0), c00, [tol])
+            end
+
+            testset "Packed mult" do
+                terracode
+                    var rows = 600
+                    var cols = 40
+                    var a = CSR.new(&alloc, rows, rows)
+                    for i = 0, rows do
+                        a:set(i, i, 3)
+                        a:set(i, (7 * i + 3) % rows, -1)
+                    end
+                    var ap = a:packed(&alloc)
+                    var b = Mat.new(&alloc, {rows, cols})
+                    var c = Mat.new(&alloc, {rows, cols})
+                    var ok = true
+                    for rep = 0, 2 do
+                        for i = 0, rows do
+                            for j = 0, cols do
+                                b(i, j) = (i + rep * j) % 5
+                                c(i, j) = 1
+                            end
+                        end
+                        matrix.gemm([T](2), &ap, &b, [T](-1), &c)
+                        for i = 0, rows do
+                            for j = 0, cols do
+                                var res: T = 0
+                                for idx = a.rowptr(i), a.rowptr(i + 1) do
+                                    res = res + a.data(idx) * b(a.col(idx), j)
+                                end
+                                ok = ok and tmath.isapprox(c(i, j), 2 * res - 1, [tol])
+                            end
+                        end
+                    end
+                end
+                test ap:rows() == rows
+                test ap:cols() == rows
+                test ok
+            end
+
+            testset "Transposed and dense mult" do
+                terracode
+                    var n = 7
+                    var m = 5
+                    var k = 3
+                    var sa = CSR.new(&alloc, n, m)
+                    for i = 0, n do
+                        sa:set(i, i % m, i + 1)
+                        sa:set(i, (3 * i + 2) % m, -2)
+                    end
+                    var sat = sa:transposed(&alloc)
+                    var bl = Mat.new(&alloc, {k, n})
+                    var br = Mat.new(&alloc, {n, k})
+                    for i = 0, n do
+                        for j = 0, k do
+                            bl(j, i) = (i + 2 * j) % 4 - 1
+                            br(i, j) = (2 * i + j) % 3
+                        end
+                    end
+                    -- C = A^T B
+                    var c1 = Mat.new(&alloc, {m, k})
+                    c1:fill([T](1))
+                    matrix.gemm([T](2), sa:transpose(), &br, [T](-1), &c1)
+                    -- C = B A
+                    var c2 = Mat.new(&alloc, {k, m})
+                    c2:fill([T](1))
+                    matrix.gemm([T](2), &bl, &sa, [T](-1), &c2)
+                    -- C = B A^T
+                    var bt = Mat.new(&alloc, {k, m})
+                    for i = 0, m do
+                        for j = 0, k do
+                            bt(j, i) = i - j
+                        end
+                    end
+                    var c3 = Mat.new(&alloc, {k, n})
+                    c3:fill([T](1))
+                    matrix.gemm([T](2), &bt, sa:transpose(), [T](-1), &c3)
+                    -- C = A^T A
+                    var c4 = Mat.new(&alloc, {m, m})
+                    c4:fill([T](1))
+                    matrix.gemm([T](2), sa:transpose(), &sa, [T](-1), &c4)
+                    -- Dense results that are not of type Mat
+                    var c5m = Mat.new(&alloc, {m, k})
+                    c5m:fill([T](1))
+                    var c5 = c5m:transpose()
+                    matrix.gemm([T](2), &bl, &sa, [T](-1), c5)
+                    var c6m = Mat.new(&alloc, {m, m})
+                    c6m:fill([T](1))
+                    var c6 = c6m:transpose()
+                    matrix.gemm([T](2), sa:transpose(), &sa, [T](-1), c6)
+                    var ok = true
+                    for i = 0, m do
+                        for j = 0, k do
+                            var r1: T = 0
+                            var r2: T = 0
+                            for l = 0, n do
+                                r1 = r1 + sa:get(l, i) * br(l, j)
+                                r2 = r2 + bl(j, l) * sa:get(l, i)
+                            end
+                            ok = ok and tmath.isapprox(c1(i, j), 2 * r1 - 1, [tol])
+                            ok = ok and tmath.isapprox(c2(j, i), 2 * r2 - 1, [tol])
+                            ok = ok and tmath.isapprox(c5:get(j, i), 2 * r2 - 1, [tol])
+                        end
+                        for j = 0, m do
+                            var r4: T = 0
+                            for l = 0, n do
+                                r4 = r4 + sa:get(l, i) * sa:get(l, j)
+                            end
+                            ok = ok and tmath.isapprox(c4(i, j), 2 * r4 - 1, [tol])
+                            ok = ok and tmath.isapprox(c6:get(i, j), 2 * r4 - 1, [tol])
+                        end
+                    end
+                    for i = 0, n do
+                        for j = 0, k do
+                            var r3: T = 0
+                            for l = 0, m do
+                                r3 = r3 + bt(j, l) * sa:get(i, l)
+                            end
+                            ok = ok and tmath.isapprox(c3(j, i), 2 * r3 - 1, [tol])
+                        end
+                    end
+                    var okt = true
+                    for i = 0, m do
+                        for j = 0, n do
+                            okt = okt and sat:get(i, j) == sa:get(j, i)
+                        end
+                    end
+                end
+                test sat:rows() == m
+                test sat:cols() == n
+                test sat:nnz() == sa:nnz()
+                test okt
+                test ok
+            end
+
             testset "Mult" do
                 terracode
                     var rows = 1500
@@ -132,3 +356,198 @@ for T, tol in pairs(tols) do
         end
     end
 end
+
+for _, T in pairs({float, double}) do
+    local CSR = sparse.CSRMatrix(T, int64)
+    local CCSR = sparse.CompressedCSRMatrix(double, T)
+    local Vec = darray.DynamicVector(double)
+    testenv(T) "Compressed CSR Matrix" do
+        terracode
+            var alloc: DefaultAlloc
+            -- The first block of rows has a column span that does not fit
+            -- into 16 bits, the second one does.
+            var rows = 40
+            var cols = 70000
+            var a = CSR.new(&alloc, rows, cols)
+            for i = 0, rows do
+                a:set(i, i, 2)
+                a:set(i, i + 1, -1)
+            end
+            a:set(0, cols - 1, 0.5)
+            var c = CCSR.from(&alloc, &a)
+        end
+
+        testset "Storage" do
+            test c:nblocks() == 2
+            test c.base(0) == -1
+            test c.base(1) == 32
+            test c:nnz() == a:nnz()
+            test c:get(0, cols - 1) == 0.5
+            test c:get(35, 36) == -1
+        end
+
+        testset "Apply" do
+            terracode
+                var x = Vec.new(&alloc, cols)
+                for j = 0, cols do
+                    x(j) = j % 7
+                end
+                var y = Vec.ones(&alloc, rows)
+                c:apply(false, 2, &x, 3, &y)
+                var ok = true
+                for i = 0, rows do
+                    var ref = 3 + 2 * (2 * x(i) - x(i + 1))
+                    if i == 0 then
+                        ref = ref + x(cols - 1)
+                    end
+                    ok = ok and tmath.isapprox(y(i), ref, 1e-14)
+                end
+                var xt = Vec.ones(&alloc, rows)
+                var yt = Vec.zeros(&alloc, cols)
+                c:apply(true, 1, &xt, 0, &yt)
+                var okt = (
+                    yt(0) == 2 and yt(1) == 1 and yt(rows) == -1
+                    and yt(cols - 1) == 0.5
+                )
+            end
+            test ok
+            test okt
+        end
+    end
+end
+
+for T, tol in pairs({[float] = `1e-5f, [double] = `1e-13}) do
+    for _, I in pairs({int32, int64}) do
+        local CSR = sparse.CSRMatrix(T, I)
+        local SCSR = sparse.SymmetricCSRMatrix(T, I)
+        local Vec = darray.DynamicVector(T)
+        testenv(T, I) "Symmetric CSR Matrix" do
+            -- 5-point Laplacian on a m x m grid with additional couplings
+            -- of row i and n - 1 - i that reach into all row blocks.
+            local m = 40
+            terracode
+                var alloc: DefaultAlloc
+                var n = m * m
+                var a = CSR.new(&alloc, n, n)
+                for i = 0, m do
+                    for j = 0, m do
+                        var k = m * i + j
+                        a:set(k, k, 4)
+                        if i > 0 then a:set(k, k - m, -1) end
+                        if i < m - 1 then a:set(k, k + m, -1) end
+                        if j > 0 then a:set(k, k - 1, -1) end
+                        if j < m - 1 then a:set(k, k + 1, -1) end
+                    end
+                end
+                for k = 0, n / 2 do
+                    a:set(k, n - 1 - k, 0.25)
+                    a:set(n - 1 - k, k, 0.25)
+                end
+                var s = SCSR.from(&alloc, &a)
+            end
+
+            testset "Storage" do
+                test s:rows() == n
+                test 2 * s:nnz() == a:nnz() + n
+                test s:get(1, 0) == -1
+                test s:get(0, n - 1) == [T](0.25)
+                test s:get(n - 1, 0) == [T](0.25)
+            end
+
+            testset "Apply" do
+                terracode
+                    var x = Vec.new(&alloc, n)
+                    for k = 0, n do
+                        x(k) = k % 7 - 3
+                    end
+                    var y = Vec.ones(&alloc, n)
+                    var yref = Vec.ones(&alloc, n)
+                    s:apply(false, [T](2), &x, [T](-1), &y)
+                    a:apply(false, [T](2), &x, [T](-1), &yref)
+                    var ok = true
+                    for k = 0, n do
+                        ok = ok and tmath.isapprox(y(k), yref(k), 10 * [tol])
+                    end
+                    -- Repeated products reuse the buffers
+                    s:apply(true, [T](1), &x, [T](0), &y)
+                    a:apply(false, [T](1), &x, [T](0), &yref)
+                    for k = 0, n do
+                        ok = ok and tmath.isapprox(y(k), yref(k), 10 * [tol])
+                    end
+                end
+                test ok
+            end
+        end
+    end
+end
+
+for T, tol in pairs({[float] = `1e-5f, [double] = `1e-13}) do
+    local CSR = sparse.CSRMatrix(T, int32)
+    local Vec = darray.DynamicVector(T)
+    local kernelfile = os.tmpname()
+    testenv(T) "Autotuned SpMV" do
+        local n = 5000
+        terracode
+            var alloc: DefaultAlloc
+            var a = CSR.new(&alloc, n, n)
+            for i = 0, n do
+                a:set(i, i, 4)
+                -- Rows of varying length
+                for l = 1, i % 11 do
+                    a:set(i, (i + 37 * l) % n, -0.25)
+                end
+            end
+            var x = Vec.new(&alloc, n)
+            for i = 0, n do
+                x(i) = i % 9 - 4
+            end
+            var yref = Vec.ones(&alloc, n)
+            a:apply(false, [T](2), &x, [T](-1), &yref)
+        end
+
+        testset "Tune" do
+            terracode
+                var kernel = a:tune(&alloc, 3)
+                var y = Vec.ones(&alloc, n)
+                a:apply(false, [T](2), &x, [T](-1), &y)
+                var ok = true
+                for i = 0, n do
+                    ok = ok and tmath.isapprox(y(i), yref(i), [tol])
+                end
+                -- All candidates, not only the selected one
+                for k = 1, [CSR.traits.nkernels + 1] do
+                    a.kernel = k
+                    var yk = Vec.ones(&alloc, n)
+                    a:apply(false, [T](2), &x, [T](-1), &yk)
+                    for i = 0, n do
+                        ok = ok and tmath.isapprox(yk(i), yref(i), [tol])
+                    end
+                end
+                a.kernel = kernel
+            end
+            test kernel > 0
+            test a.kernel == kernel
+            test ok
+        end
+
+        testset "Persist" do
+            terracode
+                var kernel = a:tune(&alloc, 1)
+                a:savekernel([kernelfile])
+                var b = CSR.new(&alloc, n, n)
+                for i = 0, n do
+                    for idx = a.rowptr(i), a.rowptr(i + 1) do
+                        b:set(i, a.col(idx), a.data(idx))
+                    end
+                end
+                var loaded = b:loadkernel(&alloc, [kernelfile])
+                var c = CSR.new(&alloc, n, n)
+                var rejected = not c:loadkernel(&alloc, [kernelfile])
+            end
+            test loaded
+            test b.kernel == kernel
+            test rejected
+            test c.kernel == 0
+        end
+    end
+end
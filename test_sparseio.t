@@ -0,0 +1,147 @@
+-- SPDX-FileCopyrightText: 2024 René Hiemstra <rrhiemstar@gmail.com>
+-- SPDX-FileCopyrightText: 2024 Torsten Keßler <t.kessler@posteo.de>
+-- SPDX-FileCopyrightText: 2025 René Hiemstra <rrhiemstar@gmail.com>
+-- SPDX-FileCopyrightText: 2025 Torsten Keßler <t.kessler@posteo.de>
+--
+-- SPDX-License-Identifier: MIT
+
+local alloc = require("alloc")
+local sparse = require("sparse")
+local sparseio = require("sparseio")
+
+import "terratest/terratest"
+
+local function writefile(filename, content)
+    local f = assert(io.open(filename, "w"))
+    f:write(content)
+    f:close()
+end
+
+local general = os.tmpname()
+writefile(general, [[
+%%MatrixMarket matrix coordinate real general
+% A comment
+%
+3 4 5
+3 1 -2.5
+1 1 1.0
+1 4 2.0
+
+2 2 3.0
+3 3 0.5
+]])
+
+local symmetric = os.tmpname()
+writefile(symmetric, [[
+%%MatrixMarket matrix coordinate integer symmetric
+3 3 4
+1 1 4
+2 1 -1
+3 2 -1
+3 3 4
+]])
+
+local pattern = os.tmpname()
+writefile(pattern, [[
+%%MatrixMarket matrix coordinate pattern skew-symmetric
+2 2 1
+2 1
+]])
+
+local DefaultAlloc = alloc.DefaultAllocator()
+for _, T in pairs({float, double}) do
+    for _, I in pairs({int32, int64}) do
+        local CSR = sparse.CSRMatrix(T, I)
+        local IO = sparseio.CSRIO(T, I)
+        testenv(T, I) "Sparse IO" do
+            terracode
+                var alloc: DefaultAlloc
+            end
+
+            testset "Matrix Market general" do
+                terracode
+                    var a = IO.readmtx(&alloc, [general])
+                    var ref = arrayof(T, 1, 0, 0, 2, 0, 3, 0, 0, -2.5, 0, 0.5, 0)
+                    var ok = true
+                    for i = 0, 3 do
+                        for j = 0, 4 do
+                            ok = ok and a:get(i, j) == ref[4 * i + j]
+                        end
+                    end
+                    var sorted = true
+                    for i = 0, 3 do
+                        for idx = a.rowptr(i) + 1, a.rowptr(i + 1) do
+                            sorted = sorted and a.col(idx - 1) < a.col(idx)
+                        end
+                    end
+                end
+                test a:rows() == 3
+                test a:cols() == 4
+                test a:nnz() == 5
+                test ok
+                test sorted
+            end
+
+            testset "Matrix Market symmetric" do
+                terracode
+                    var a = IO.readmtx(&alloc, [symmetric])
+                    var ref = arrayof(T, 4, -1, 0, -1, 4, -1, 0, -1, 4)
+                    var ok = true
+                    for i = 0, 3 do
+                        for j = 0, 3 do
+                            ok = ok and a:get(i, j) == ref[3 * i + j]
+                        end
+                    end
+                end
+                test a:nnz() == 6
+                test ok
+            end
+
+            testset "Matrix Market skew-symmetric pattern" do
+                terracode
+                    var a = IO.readmtx(&alloc, [pattern])
+                end
+                test a:nnz() == 2
+                test a:get(1, 0) == 1
+                test a:get(0, 1) == -1
+            end
+
+            local mtxname = os.tmpname()
+            testset "Matrix Market roundtrip" do
+                terracode
+                    var a = IO.readmtx(&alloc, [general])
+                    IO.writemtx(&a, [mtxname])
+                    var b = IO.readmtx(&alloc, [mtxname])
+                    var ok = true
+                    for i = 0, 3 do
+                        for j = 0, 4 do
+                            ok = ok and a:get(i, j) == b:get(i, j)
+                        end
+                    end
+                end
+                test b:nnz() == a:nnz()
+                test ok
+            end
+
+            local binname = os.tmpname()
+            testset "Binary roundtrip" do
+                terracode
+                    var a = IO.readmtx(&alloc, [symmetric])
+                    IO.writebinary(&a, [binname])
+                    var m = IO.readbinary([binname])
+                    var b = &m.matrix
+                    var ok = true
+                    for i = 0, 3 do
+                        for j = 0, 3 do
+                            ok = ok and a:get(i, j) == b:get(i, j)
+                        end
+                    end
+                end
+                test b:rows() == 3
+                test b:cols() == 3
+                test b:nnz() == a:nnz()
+                test ok
+            end
+        end
+    end
+end
@@ -323,14 +323,17 @@ threadpool.staticmethods.worker_thread = (
             --
             -- Work distribution
             --
+            -- The thread counts as working before the work item leaves the
+            -- queue. Otherwise, barrier() could observe an empty queue and no
+            -- working threads while the item is about to run.
             var t: thread
+            atomics.add(&tp.threads_working, 1)
             var has_work = tp.work_queue:try_pop(&t)
             tp.work_mutex:unlock()
             if has_work then
-                atomics.add(&tp.threads_working, 1)
                 t.func(&t.arg(0))
-                atomics.sub(&tp.threads_working, 1)
             end
+            atomics.sub(&tp.threads_working, 1)
             --
             -- Barrier check
             --